@@ -0,0 +1,441 @@
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <limits>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+namespace {
+    constexpr uint32_t NO_GROUP = std::numeric_limits<uint32_t>::max();
+
+    // FNV-1a с перемешиванием в конце, чтобы младшие биты годились для номера слота
+    uint64_t hash_bytes(std::string_view data) {
+        uint64_t hash = 14695981039346656037ull;
+        for (char ch: data) {
+            hash ^= static_cast<uint8_t>(ch);
+            hash *= 1099511628211ull;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // Перемешивание из MurmurHash3 для ключа-числа
+    uint64_t hash_int(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    // Хеш-таблица групп с открытой адресацией и линейным пробированием. В слоте только хеш и номер
+    // группы, ключи лежат подряд в arena, так что соседние пробы попадают в одну строку кеша,
+    // а ключ читается лишь при совпадении хеша
+    class GroupTable {
+    public:
+        GroupTable() : slots(16) {}
+
+        // Номер группы ключа; новый ключ получает следующий номер
+        uint32_t find_or_insert(std::string_view key, uint64_t hash) {
+            size_t mask = slots.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                Slot &slot = slots[i];
+                if (slot.group == NO_GROUP) {
+                    auto group = static_cast<uint32_t>(size());
+                    slot = {hash, group};
+                    arena.append(key);
+                    offsets.push_back(arena.size());
+                    if (size() * 2 > slots.size()) {
+                        grow();
+                    }
+                    return group;
+                }
+                if (slot.hash == hash && key_of(slot.group) == key) {
+                    return slot.group;
+                }
+            }
+        }
+
+        [[nodiscard]] size_t size() const {
+            return offsets.size() - 1;
+        }
+
+    private:
+        struct Slot {
+            uint64_t hash = 0;
+            uint32_t group = NO_GROUP;
+        };
+
+        [[nodiscard]] std::string_view key_of(uint32_t group) const {
+            return std::string_view(arena).substr(offsets[group], offsets[group + 1] - offsets[group]);
+        }
+
+        void grow() {
+            std::vector<Slot> old(slots.size() * 2);
+            old.swap(slots);
+            size_t mask = slots.size() - 1;
+            for (const Slot &slot: old) {
+                if (slot.group == NO_GROUP) {
+                    continue;
+                }
+                size_t i = slot.hash & mask;
+                while (slots[i].group != NO_GROUP) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+
+        std::vector<Slot> slots;
+        std::string arena;
+        std::vector<size_t> offsets{0};
+    };
+
+    // Ключ группы: по каждой колонке байт null и значение; у string и bytes перед значением длина,
+    // чтобы разные наборы значений не давали одинаковых байтов
+    void encode_key(const memdb::Table &table, size_t row_index, const std::vector<size_t> &columns,
+                    std::string &out) {
+        out.clear();
+        for (size_t column: columns) {
+            memdb::Table::ColumnType::type_kind kind = table.info_row[column].column_type.kind;
+            if (kind == memdb::Table::ColumnType::INT32 || kind == memdb::Table::ColumnType::BOOL) {
+                int32_t value;
+                if (!memdb::read_int(table, row_index, column, value)) {
+                    out.push_back(0);
+                    continue;
+                }
+                out.push_back(1);
+                out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+            } else {
+                std::string_view data;
+                if (!memdb::read_bytes(table, row_index, column, data)) {
+                    out.push_back(0);
+                    continue;
+                }
+                out.push_back(1);
+                auto size = static_cast<uint32_t>(data.size());
+                out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+                out.append(data);
+            }
+        }
+    }
+
+    bool is_integer(const memdb::Table &table, size_t column) {
+        memdb::Table::ColumnType::type_kind kind = table.info_row[column].column_type.kind;
+        return kind == memdb::Table::ColumnType::INT32 || kind == memdb::Table::ColumnType::BOOL;
+    }
+
+    // Значения колонки агрегата для отобранных строк подряд: дальше циклы идут по плотным массивам.
+    // У null значение 0 и valid 0, поэтому сумма и счётчик обходятся без ветвлений
+    struct Input {
+        std::vector<int32_t> ints;
+        std::vector<std::string_view> bytes;
+        std::vector<uint8_t> valid;
+    };
+
+    void gather(const memdb::Table &table, const std::vector<size_t> &row_ids, size_t column, size_t begin,
+                size_t end, Input &input) {
+        if (is_integer(table, column)) {
+            if (table.layout == memdb::Table::COLUMN_LAYOUT && table.columns[column].null_count == 0 &&
+                table.columns[column].kind == memdb::Table::Column::INT32) {
+                const int32_t *values = table.columns[column].ints.data();
+                for (size_t k = begin; k < end; ++k) {
+                    input.ints[k] = values[row_ids[k]];
+                    input.valid[k] = 1;
+                }
+                return;
+            }
+            for (size_t k = begin; k < end; ++k) {
+                int32_t value = 0;
+                input.valid[k] = memdb::read_int(table, row_ids[k], column, value);
+                input.ints[k] = value;
+            }
+            return;
+        }
+        for (size_t k = begin; k < end; ++k) {
+            input.valid[k] = memdb::read_bytes(table, row_ids[k], column, input.bytes[k]);
+        }
+    }
+
+    struct Accumulator {
+        std::vector<int64_t> count; // Непустые значения или строки для count(*)
+        std::vector<int64_t> value; // Сумма или текущий min/max для int32 и bool
+        std::vector<uint32_t> best; // Позиция текущего min/max для string и bytes
+    };
+
+    // Группы одной части входа: у каждой позиция первой строки и накопители всех агрегатов
+    struct Partial {
+        GroupTable groups;
+        std::vector<size_t> first;
+        std::vector<Accumulator> accumulators;
+    };
+
+    // Ключ из одной колонки int32 или bool: бит null и значение в одном числе
+    uint64_t pack_key(const Input &keys, size_t k) {
+        return static_cast<uint64_t>(keys.valid[k]) << 32 | static_cast<uint32_t>(keys.ints[k]);
+    }
+
+    // Считает агрегаты по позициям positions[0..count) в row_ids, или по всем позициям подряд,
+    // если positions пуст. packed, если не пуст, — ключи групп одной целочисленной колонки;
+    // hashes, если заданы, — готовые хеши ключей
+    void aggregate_positions(const memdb::Table &table, const std::vector<size_t> &row_ids,
+                             const std::vector<size_t> &group_columns,
+                             const std::vector<memdb::Aggregate> &aggregates, const std::vector<Input> &inputs,
+                             const Input &packed, const std::vector<uint64_t> *hashes, const uint32_t *positions,
+                             size_t count, Partial &partial) {
+        std::vector<uint32_t> group_of(count);
+        if (group_columns.empty()) {
+            partial.first.push_back(0);
+        } else {
+            std::string key;
+            for (size_t j = 0; j < count; ++j) {
+                size_t k = positions != nullptr ? positions[j] : j;
+                uint32_t group;
+                if (!packed.valid.empty()) {
+                    uint64_t number = pack_key(packed, k);
+                    group = partial.groups.find_or_insert({reinterpret_cast<const char *>(&number), sizeof(number)},
+                                                          hashes != nullptr ? (*hashes)[k] : hash_int(number));
+                } else {
+                    encode_key(table, row_ids[k], group_columns, key);
+                    group = partial.groups.find_or_insert(key, hashes != nullptr ? (*hashes)[k] : hash_bytes(key));
+                }
+                if (group == partial.first.size()) {
+                    partial.first.push_back(k);
+                }
+                group_of[j] = group;
+            }
+        }
+
+        size_t groups = partial.first.size();
+        partial.accumulators.resize(aggregates.size());
+        for (size_t a = 0; a < aggregates.size(); ++a) {
+            const memdb::Aggregate &aggregate = aggregates[a];
+            Accumulator &accumulator = partial.accumulators[a];
+            accumulator.count.assign(groups, 0);
+            if (aggregate.kind == memdb::Aggregate::VALUE) {
+                continue;
+            }
+            if (aggregate.column == static_cast<size_t>(-1)) {
+                for (size_t j = 0; j < count; ++j) {
+                    ++accumulator.count[group_of[j]];
+                }
+                continue;
+            }
+
+            const Input &input = inputs[a];
+            const uint8_t *valid = input.valid.data();
+            if (aggregate.kind == memdb::Aggregate::COUNT || aggregate.kind == memdb::Aggregate::SUM ||
+                aggregate.kind == memdb::Aggregate::AVG) {
+                for (size_t j = 0; j < count; ++j) {
+                    size_t k = positions != nullptr ? positions[j] : j;
+                    accumulator.count[group_of[j]] += valid[k];
+                }
+                if (aggregate.kind != memdb::Aggregate::COUNT) {
+                    accumulator.value.assign(groups, 0);
+                    const int32_t *values = input.ints.data();
+                    for (size_t j = 0; j < count; ++j) {
+                        size_t k = positions != nullptr ? positions[j] : j;
+                        accumulator.value[group_of[j]] += values[k];
+                    }
+                }
+            } else if (is_integer(table, aggregate.column)) {
+                bool minimum = aggregate.kind == memdb::Aggregate::MIN;
+                accumulator.value.assign(groups, minimum ? std::numeric_limits<int64_t>::max() :
+                                                 std::numeric_limits<int64_t>::min());
+                const int32_t *values = input.ints.data();
+                for (size_t j = 0; j < count; ++j) {
+                    size_t k = positions != nullptr ? positions[j] : j;
+                    if (valid[k]) {
+                        int64_t &best = accumulator.value[group_of[j]];
+                        best = minimum ? std::min<int64_t>(best, values[k]) : std::max<int64_t>(best, values[k]);
+                        ++accumulator.count[group_of[j]];
+                    }
+                }
+            } else {
+                bool minimum = aggregate.kind == memdb::Aggregate::MIN;
+                accumulator.best.assign(groups, NO_GROUP);
+                for (size_t j = 0; j < count; ++j) {
+                    size_t k = positions != nullptr ? positions[j] : j;
+                    if (!valid[k]) {
+                        continue;
+                    }
+                    uint32_t &best = accumulator.best[group_of[j]];
+                    if (best == NO_GROUP || (minimum ? input.bytes[k] < input.bytes[best] :
+                                             input.bytes[best] < input.bytes[k])) {
+                        best = static_cast<uint32_t>(k);
+                    }
+                    ++accumulator.count[group_of[j]];
+                }
+            }
+        }
+    }
+
+    const char *function_name(memdb::Aggregate::function kind) {
+        switch (kind) {
+            case memdb::Aggregate::COUNT:
+                return "count";
+            case memdb::Aggregate::SUM:
+                return "sum";
+            case memdb::Aggregate::MIN:
+                return "min";
+            case memdb::Aggregate::MAX:
+                return "max";
+            case memdb::Aggregate::AVG:
+                return "avg";
+            default:
+                return "";
+        }
+    }
+}
+
+memdb::Table memdb::aggregate_rows(const Table &table, const std::vector<size_t> &row_ids,
+                                   const std::vector<size_t> &group_columns, const std::vector<Aggregate> &aggregates,
+                                   const ScanOptions &options) {
+    size_t rows = row_ids.size();
+    if (rows > NO_GROUP) {
+        throw BadQuery("Bad query: too many rows to aggregate");
+    }
+    bool parallel = options.pool != nullptr && options.pool->size() != 0 && rows >= options.threshold &&
+                    !group_columns.empty();
+    size_t morsel = std::max<size_t>(1, options.morsel_size);
+    size_t morsels = (rows + morsel - 1) / morsel;
+
+    std::vector<Input> inputs(aggregates.size());
+    for (size_t a = 0; a < aggregates.size(); ++a) {
+        size_t column = aggregates[a].column;
+        if (aggregates[a].kind == Aggregate::VALUE || column == static_cast<size_t>(-1)) {
+            continue;
+        }
+        if (is_integer(table, column)) {
+            inputs[a].ints.resize(rows);
+        } else {
+            inputs[a].bytes.resize(rows);
+        }
+        inputs[a].valid.resize(rows);
+    }
+    // Ключи из одной колонки int32 или bool собираются плотным массивом, как значения агрегатов,
+    // и хешируются как числа без кодирования в байты
+    Input packed;
+    if (group_columns.size() == 1 && is_integer(table, group_columns[0])) {
+        packed.ints.resize(rows);
+        packed.valid.resize(rows);
+    }
+    auto gather_range = [&](size_t begin, size_t end) {
+        for (size_t a = 0; a < aggregates.size(); ++a) {
+            if (!inputs[a].valid.empty()) {
+                gather(table, row_ids, aggregates[a].column, begin, end, inputs[a]);
+            }
+        }
+        if (!packed.valid.empty()) {
+            gather(table, row_ids, group_columns[0], begin, end, packed);
+        }
+    };
+
+    std::vector<Partial> partials;
+    if (!parallel) {
+        gather_range(0, rows);
+        partials.resize(1);
+        aggregate_positions(table, row_ids, group_columns, aggregates, inputs, packed, nullptr, nullptr, rows,
+                            partials[0]);
+    } else {
+        // Сначала кусками считаются входы и хеши ключей, затем строки раскладываются по частям
+        // по старшим битам хеша: одна группа целиком в одной части, и части считаются независимо
+        std::vector<uint64_t> hashes(rows);
+        options.pool->parallel_for(morsels, [&](size_t task) {
+            size_t begin = task * morsel;
+            size_t end = std::min(rows, begin + morsel);
+            gather_range(begin, end);
+            std::string key;
+            for (size_t k = begin; k < end; ++k) {
+                if (!packed.valid.empty()) {
+                    hashes[k] = hash_int(pack_key(packed, k));
+                } else {
+                    encode_key(table, row_ids[k], group_columns, key);
+                    hashes[k] = hash_bytes(key);
+                }
+            }
+        });
+        size_t parts = options.pool->size() * 2;
+        std::vector<std::vector<uint32_t>> positions(parts);
+        for (size_t k = 0; k < rows; ++k) {
+            positions[(hashes[k] >> 32) % parts].push_back(static_cast<uint32_t>(k));
+        }
+        partials.resize(parts);
+        options.pool->parallel_for(parts, [&](size_t part) {
+            aggregate_positions(table, row_ids, group_columns, aggregates, inputs, packed, &hashes,
+                                positions[part].data(), positions[part].size(), partials[part]);
+        });
+    }
+
+    Table result;
+    result.name = "select_table";
+    for (const auto &aggregate: aggregates) {
+        if (aggregate.kind == Aggregate::VALUE) {
+            Table::column_info info = table.info_row[aggregate.column];
+            info.key = info.unique = info.autoincrement = info.dictionary = false;
+            result.info_row.push_back(info);
+            continue;
+        }
+        std::string name = std::string(function_name(aggregate.kind)) + "(" +
+                           (aggregate.column == static_cast<size_t>(-1) ? "*" : table.info_row[aggregate.column].name) +
+                           ")";
+        bool keeps_type = aggregate.kind == Aggregate::MIN || aggregate.kind == Aggregate::MAX;
+        result.info_row.emplace_back(false, false, false, name,
+                                     keeps_type ? table.info_row[aggregate.column].type : "int32", std::monostate{});
+    }
+    result.rebuild_catalog();
+
+    // Группы всех частей в порядке первой строки, как при последовательном подсчёте
+    std::vector<std::pair<size_t, size_t>> order;
+    for (size_t part = 0; part < partials.size(); ++part) {
+        for (size_t group = 0; group < partials[part].first.size(); ++group) {
+            order.emplace_back(part, group);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](const auto &lhs, const auto &rhs) {
+        return partials[lhs.first].first[lhs.second] < partials[rhs.first].first[rhs.second];
+    });
+
+    for (auto [part, group]: order) {
+        const Partial &partial = partials[part];
+        Table::row row;
+        row.values.reserve(aggregates.size());
+        for (size_t a = 0; a < aggregates.size(); ++a) {
+            const Aggregate &aggregate = aggregates[a];
+            const Accumulator &accumulator = partial.accumulators[a];
+            if (aggregate.kind == Aggregate::VALUE) {
+                row.values.push_back(table.get(row_ids[partial.first[group]], aggregate.column));
+                continue;
+            }
+            int64_t count = accumulator.count[group];
+            if (aggregate.kind == Aggregate::COUNT) {
+                row.values.emplace_back(static_cast<int>(count));
+            } else if (count == 0) {
+                row.values.emplace_back(std::monostate{});
+            } else if (aggregate.kind == Aggregate::SUM || aggregate.kind == Aggregate::AVG) {
+                int64_t value = accumulator.value[group];
+                if (aggregate.kind == Aggregate::AVG) {
+                    value /= count;
+                }
+                if (value < std::numeric_limits<int32_t>::min() || value > std::numeric_limits<int32_t>::max()) {
+                    throw BadQuery("Bad query: " + result.info_row[a].name + " doesn't fit int32");
+                }
+                row.values.emplace_back(static_cast<int>(value));
+            } else if (!accumulator.best.empty()) {
+                row.values.push_back(table.get(row_ids[accumulator.best[group]], aggregate.column));
+            } else if (table.info_row[aggregate.column].column_type.kind == Table::ColumnType::BOOL) {
+                row.values.emplace_back(accumulator.value[group] != 0);
+            } else {
+                row.values.emplace_back(static_cast<int>(accumulator.value[group]));
+            }
+        }
+        result.rows.push_back(std::move(row));
+    }
+    result.deleted.resize(result.rows.size());
+    return result;
+}
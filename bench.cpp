@@ -0,0 +1,362 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <sys/resource.h>
+#include "memdb.h"
+#include "exceptions.h"
+
+// Бенчмарки отдельных стадий и целых запросов через Database::execute.
+// Запуск: bench [--rows N] [--width W] [--selectivity S] [--iterations K] [--seed X]
+//               [--filter подстрока] [--format text|json|csv]
+// Данные детерминированы сидом, поэтому результаты разных версий можно сравнивать
+
+namespace {
+    struct Options {
+        size_t rows = 100000;
+        size_t width = 12;          // Длина логина без кавычек
+        double selectivity = 0.1;   // Доля строк, проходящих условие age < threshold
+        size_t iterations = 30;
+        uint32_t seed = 42;
+        std::string filter;
+        std::string format = "text";
+    };
+
+    struct Result {
+        std::string name;
+        size_t iterations = 0;
+        size_t rows_per_op = 0;
+        double ops_per_sec = 0;
+        double ns_per_row = 0;
+        double p50_ns = 0;
+        double p99_ns = 0;
+        long peak_rss_kb = 0;
+    };
+
+    long peak_rss_kb() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    double percentile(std::vector<double> sorted, double fraction) {
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    // Синтетические данные: users(id, age, login, is_admin); age равномерно в [0, 1000)
+    class DataGenerator {
+    public:
+        explicit DataGenerator(const Options &options) : options(options), random(options.seed) {}
+
+        std::string schema(const std::string &table_name, const std::string &attributes = "") const {
+            return "create table " + table_name + " ({key} id: int32, age: int32, login: string[" +
+                   std::to_string(options.width + 2) + "], is_admin: bool = false)" + attributes;
+        }
+
+        std::string login(size_t id) {
+            std::string value = "\"";
+            std::string digits = std::to_string(id);
+            for (size_t i = 0; i + digits.size() < options.width; ++i) {
+                value += static_cast<char>('a' + random() % 26);
+            }
+            value += digits.substr(0, options.width);
+            value += '"';
+            return value;
+        }
+
+        std::vector<memdb::Table::row> rows(size_t first_id, size_t count) {
+            std::vector<memdb::Table::row> result;
+            result.reserve(count);
+            std::uniform_int_distribution<int> age(0, 999);
+            for (size_t i = 0; i < count; ++i) {
+                size_t id = first_id + i;
+                result.push_back({{static_cast<int>(id), age(random), login(id), random() % 2 == 0}});
+            }
+            return result;
+        }
+
+        // Порог, под который попадает примерно selectivity строк
+        int threshold() const {
+            return static_cast<int>(options.selectivity * 1000);
+        }
+
+    private:
+        const Options &options;
+        std::mt19937 random;
+    };
+
+    class Runner {
+    public:
+        explicit Runner(const Options &options) : options(options) {}
+
+        // setup выполняется перед каждой итерацией и в замер не попадает
+        void run(const std::string &name, size_t rows_per_op, const std::function<void()> &operation,
+                 const std::function<void()> &setup = {}) {
+            if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+                return;
+            }
+            if (setup) {
+                setup();
+            }
+            operation(); // Прогрев
+
+            std::vector<double> samples;
+            samples.reserve(options.iterations);
+            double total = 0;
+            for (size_t i = 0; i < options.iterations; ++i) {
+                if (setup) {
+                    setup();
+                }
+                auto start = std::chrono::steady_clock::now();
+                operation();
+                auto finish = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double, std::nano>(finish - start).count();
+                samples.push_back(elapsed);
+                total += elapsed;
+            }
+
+            Result result;
+            result.name = name;
+            result.iterations = options.iterations;
+            result.rows_per_op = rows_per_op;
+            result.ops_per_sec = total == 0 ? 0 : 1e9 * static_cast<double>(samples.size()) / total;
+            result.ns_per_row = total / static_cast<double>(samples.size()) / static_cast<double>(rows_per_op);
+            result.p50_ns = percentile(samples, 0.5);
+            result.p99_ns = percentile(samples, 0.99);
+            result.peak_rss_kb = peak_rss_kb();
+            results.push_back(result);
+            if (options.format == "text") {
+                print_text(result);
+            }
+        }
+
+        void finish() const {
+            if (options.format == "json") {
+                print_json();
+            } else if (options.format == "csv") {
+                print_csv();
+            }
+        }
+
+    private:
+        static void print_text(const Result &result) {
+            std::cout << std::left << std::setw(32) << result.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << result.ops_per_sec << " ops/s" << std::setw(12) << result.ns_per_row
+                      << " ns/row" << std::setw(14) << result.p50_ns << " p50" << std::setw(14) << result.p99_ns
+                      << " p99" << std::setw(10) << result.peak_rss_kb << " KB" << std::endl;
+        }
+
+        void print_json() const {
+            std::cout << "{\"rows\": " << options.rows << ", \"width\": " << options.width << ", \"selectivity\": "
+                      << options.selectivity << ", \"seed\": " << options.seed << ", \"results\": [";
+            for (size_t i = 0; i < results.size(); ++i) {
+                const Result &result = results[i];
+                std::cout << (i == 0 ? "\n" : ",\n") << "  {\"name\": \"" << result.name << "\", \"iterations\": "
+                          << result.iterations << ", \"rows_per_op\": " << result.rows_per_op
+                          << ", \"ops_per_sec\": " << result.ops_per_sec << ", \"ns_per_row\": " << result.ns_per_row
+                          << ", \"p50_ns\": " << result.p50_ns << ", \"p99_ns\": " << result.p99_ns
+                          << ", \"peak_rss_kb\": " << result.peak_rss_kb << "}";
+            }
+            std::cout << "\n]}" << std::endl;
+        }
+
+        void print_csv() const {
+            std::cout << "name,iterations,rows_per_op,ops_per_sec,ns_per_row,p50_ns,p99_ns,peak_rss_kb" << std::endl;
+            for (const auto &result: results) {
+                std::cout << result.name << ',' << result.iterations << ',' << result.rows_per_op << ','
+                          << result.ops_per_sec << ',' << result.ns_per_row << ',' << result.p50_ns << ','
+                          << result.p99_ns << ',' << result.peak_rss_kb << std::endl;
+            }
+        }
+
+        const Options &options;
+        std::vector<Result> results;
+    };
+
+    Options parse_options(int argc, char **argv) {
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+            std::string flag = argv[i];
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("missing value for " + flag);
+            }
+            std::string value = argv[++i];
+            if (flag == "--rows") {
+                options.rows = std::stoull(value);
+            } else if (flag == "--width") {
+                options.width = std::stoull(value);
+            } else if (flag == "--selectivity") {
+                options.selectivity = std::stod(value);
+            } else if (flag == "--iterations") {
+                options.iterations = std::stoull(value);
+            } else if (flag == "--seed") {
+                options.seed = static_cast<uint32_t>(std::stoul(value));
+            } else if (flag == "--filter") {
+                options.filter = value;
+            } else if (flag == "--format") {
+                options.format = value;
+            } else {
+                throw std::invalid_argument("unknown option " + flag);
+            }
+        }
+        if (options.rows == 0 || options.iterations == 0 || options.width == 0 ||
+            options.selectivity < 0 || options.selectivity > 1 ||
+            (options.format != "text" && options.format != "json" && options.format != "csv")) {
+            throw std::invalid_argument("bad option value");
+        }
+        return options;
+    }
+
+    void run_benchmarks(const Options &options) {
+        Runner runner(options);
+        DataGenerator generator(options);
+        std::string condition = "age < " + std::to_string(generator.threshold());
+        std::string select_query = "select id, login from users where " + condition;
+
+        memdb::Database db;
+        db.set_parallelism(1);
+        db.execute(generator.schema("users"));
+        db.execute(generator.schema("users_columnar", " {columnar}"));
+        std::vector<memdb::Table::row> data = generator.rows(0, options.rows);
+        db.bulk_insert("users", data);
+        db.bulk_insert("users_columnar", data);
+        memdb::Table &users = db.find_table("users");
+        memdb::Table &users_columnar = db.find_table("users_columnar");
+
+        // Стадии разбора
+        runner.run("tokenize", 1, [&] {
+            auto tokens = memdb::tokenize(select_query);
+            if (tokens.empty()) {
+                throw std::logic_error("tokenize returned nothing");
+            }
+        });
+        runner.run("check_syntax", 1, [&, tokens = memdb::tokenize(select_query)] {
+            memdb::check_syntax(tokens);
+        });
+        std::string insert_query = "insert (" + std::to_string(options.rows) + ", 5, " +
+                                   generator.login(options.rows) + ", true) to users";
+        runner.run("insert_row", 1, [&, tokens = memdb::tokenize(insert_query)] {
+            memdb::insert_row(tokens, users);
+        });
+        runner.run("prepare", 1, [&] {
+            db.prepare(select_query);
+        });
+
+        // Фильтрация без разбора запроса
+        memdb::Predicate predicate = memdb::compile_condition(
+                memdb::prepare_condition(memdb::tokenize(select_query)), users.info_row);
+        runner.run("check_condition/row", options.rows, [&] {
+            memdb::check_condition(predicate, users);
+        });
+        runner.run("check_condition/columnar", options.rows, [&] {
+            memdb::check_condition(predicate, users_columnar);
+        });
+
+        // Целые запросы
+        for (const char *table_name: {"users", "users_columnar"}) {
+            std::string suffix = std::string("/") + (table_name == std::string("users") ? "row" : "columnar");
+            std::string query = "select id, login from " + std::string(table_name) + " where " + condition;
+            runner.run("select" + suffix, options.rows, [&] {
+                db.execute(query);
+            });
+            runner.run("select+materialize" + suffix, options.rows, [&] {
+                memdb::Table materialized = db.execute(query).materialize();
+                (void) materialized;
+            });
+            std::string ordered = "select id, login from " + std::string(table_name) + " where " + condition;
+            runner.run("order_by_age" + suffix, options.rows, [&] {
+                db.execute(ordered + " order by age desc");
+            });
+            runner.run("order_by_login" + suffix, options.rows, [&] {
+                db.execute(ordered + " order by login");
+            });
+            runner.run("top10_by_age" + suffix, options.rows, [&] {
+                db.execute(ordered + " order by age desc limit 10");
+            });
+            runner.run("aggregate" + suffix, options.rows, [&] {
+                db.execute("select count(*), sum(age), max(age) from " + std::string(table_name) + " where " +
+                           condition);
+            });
+            runner.run("group_by" + suffix, options.rows, [&] {
+                db.execute("select is_admin, count(*), avg(age) from " + std::string(table_name) + " where " +
+                           condition + " group by is_admin");
+            });
+            std::string point = "select login from " + std::string(table_name) + " where id == " +
+                                std::to_string(options.rows / 2);
+            runner.run("point_select" + suffix, 1, [&] {
+                db.execute(point);
+            });
+        }
+
+        // Соединение с заказами: хеш-соединение против вложенных циклов по Table::rows в клиенте
+        db.execute("create table orders ({key} id: int32, user: int32, amount: int32)");
+        std::vector<memdb::Table::row> order_rows;
+        std::mt19937 order_random(7);
+        for (size_t i = 0; i < options.rows / 100 + 1; ++i) {
+            order_rows.push_back({{static_cast<int>(i), static_cast<int>(order_random() % options.rows),
+                                   static_cast<int>(order_random() % 1000)}});
+        }
+        db.bulk_insert("orders", order_rows);
+        memdb::Table &orders = db.find_table("orders");
+        runner.run("hash_join", options.rows + orders.size(), [&] {
+            db.execute("select users.login, orders.amount from users join orders on users.id == orders.user "
+                       "where " + condition);
+        });
+        runner.run("nested_loop_join", options.rows + orders.size(), [&] {
+            std::vector<memdb::Table::row> joined;
+            for (const auto &user: users.rows) {
+                if (std::get<int>(user.values[1]) >= generator.threshold()) {
+                    continue;
+                }
+                for (const auto &order: orders.rows) {
+                    if (order.values[1] == user.values[0]) {
+                        joined.push_back({{user.values[2], order.values[2]}});
+                    }
+                }
+            }
+        });
+
+        memdb::PreparedStatement prepared = db.prepare("select login from users where id == ?");
+        size_t next_id = 0;
+        runner.run("prepared_point_select/row", 1, [&] {
+            prepared.bind(0, static_cast<int>(next_id++ % options.rows));
+            prepared.execute();
+        });
+
+        size_t inserted = options.rows;
+        runner.run("insert/execute", 1, [&] {
+            db.execute("insert (" + std::to_string(++inserted) + ", 7, \"x\", false) to users");
+        });
+
+        // Удаление: перед каждой итерацией таблица заполняется заново вне замера
+        size_t delete_rows = std::min<size_t>(options.rows, 100000);
+        std::vector<memdb::Table::row> delete_data = generator.rows(0, delete_rows);
+        db.execute(generator.schema("scratch"));
+        runner.run("delete", delete_rows, [&] {
+            db.execute("delete scratch where " + condition);
+        }, [&] {
+            db.execute("delete scratch where age >= 0");
+            db.collect_garbage();
+            db.bulk_insert("scratch", delete_data);
+        });
+
+        runner.finish();
+    }
+}
+
+int main(int argc, char **argv) {
+    try {
+        run_benchmarks(parse_options(argc, argv));
+    }
+    catch (const std::exception &error) {
+        std::cerr << "bench: " << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,447 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <variant>
+#include <algorithm>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+std::vector<memdb::Token> memdb::prepare_condition(const std::vector<Token>& tokens) {
+    size_t where_index = 0;
+    bool found_where = false;
+
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (iequals(tokens[i].value, "where")) {
+            where_index = i;
+            found_where = true;
+            break;
+        }
+    }
+
+    if (!found_where) {
+        throw BadQuery("Bad query: 'where' clause not found in select query");
+    }
+
+    std::vector<Token> condition_tokens(tokens.begin() + where_index + 1, tokens.end());
+
+    return condition_tokens;
+}
+
+bool memdb::variant_to_bool(const Table::column_value& variant) {
+    if (auto* value = std::get_if<int>(&variant)) {
+        return *value != 0;
+    }
+    if (auto* value = std::get_if<std::string>(&variant)) {
+        return value->empty();
+    }
+    if (auto* value = std::get_if<std::vector<uint8_t>>(&variant)) {
+        return value->empty();
+    }
+    if (auto* value = std::get_if<bool>(&variant)) {
+        return *value;
+    }
+    throw BadQuery("Bad query: something wrong with condition part");
+}
+
+namespace {
+
+    // Рекурсивный спуск: || связывает слабее, чем &&
+    class ConditionCompiler {
+    public:
+        ConditionCompiler(const std::vector<memdb::Token>& tokens,
+                          const std::vector<memdb::Table::column_info>& info_row,
+                          memdb::Predicate& predicate) :
+                tokens(tokens), info_row(info_row), predicate(predicate) {}
+
+        size_t compile() {
+            if (tokens.empty()) {
+                throw memdb::BadQuery("Bad query: empty condition");
+            }
+            size_t root = parse_or();
+            if (position != tokens.size()) {
+                throw memdb::BadQuery("Bad query: unexpected " + std::string(tokens[position].value) + " in condition");
+            }
+            return root;
+        }
+
+    private:
+        bool at(std::string_view value) const {
+            return position < tokens.size() && tokens[position].value == value;
+        }
+
+        size_t add_node(memdb::Predicate::Node node) {
+            predicate.nodes.push_back(std::move(node));
+            return predicate.nodes.size() - 1;
+        }
+
+        size_t add_logical(memdb::Predicate::node_type type, size_t left, size_t right) {
+            memdb::Predicate::Node node;
+            node.type = type;
+            node.left = left;
+            node.right = right;
+            return add_node(std::move(node));
+        }
+
+        size_t parse_or() {
+            size_t left = parse_and();
+            while (at("||")) {
+                ++position;
+                left = add_logical(memdb::Predicate::OR, left, parse_and());
+            }
+            return left;
+        }
+
+        size_t parse_and() {
+            size_t left = parse_primary();
+            while (at("&&")) {
+                ++position;
+                left = add_logical(memdb::Predicate::AND, left, parse_primary());
+            }
+            return left;
+        }
+
+        size_t parse_primary() {
+            if (position >= tokens.size()) {
+                throw memdb::BadQuery("Bad query: unexpected end of condition");
+            }
+
+            if (at("(")) {
+                ++position;
+                size_t inner = parse_or();
+                if (!at(")")) {
+                    throw memdb::BadQuery("Bad query: expected ) in condition");
+                }
+                ++position;
+                return inner;
+            }
+
+            const memdb::Token& left = tokens[position++];
+            if (left.type != memdb::Token::FIELD_NAME) {
+                throw memdb::BadQuery("Bad query: invalid condition format");
+            }
+
+            memdb::Predicate::Node node;
+            node.column = column_index(left.value);
+
+            if (position >= tokens.size() || tokens[position].type != memdb::Token::OPERATOR ||
+                at("&&") || at("||")) {
+                node.type = memdb::Predicate::COLUMN;
+                return add_node(std::move(node));
+            }
+
+            node.type = memdb::Predicate::COMPARE;
+            node.op = parse_operator(tokens[position++].value);
+
+            if (position >= tokens.size()) {
+                throw memdb::BadQuery("Bad query: invalid condition format");
+            }
+            const memdb::Token& right = tokens[position++];
+            if (right.type == memdb::Token::PLACEHOLDER) {
+                node.parameter = true;
+                node.slot = right.slot;
+                predicate.parameter_count = std::max(predicate.parameter_count, right.slot + 1);
+            } else if (right.type == memdb::Token::VALUE) {
+                node.constant = memdb::parse_value(right.value);
+                const auto& info = info_row[node.column];
+                if (!info.column_type.matches(node.constant)) {
+                    throw memdb::BadQuery("Bad query: can't compare column '" + info.name + "' of type " +
+                                          info.column_type.name() + " with " + std::string(right.value));
+                }
+            } else {
+                throw memdb::BadQuery("Bad query: invalid condition format");
+            }
+
+            return add_node(std::move(node));
+        }
+
+        size_t column_index(std::string_view name) const {
+            for (size_t i = 0; i < info_row.size(); ++i) {
+                if (info_row[i].name == name) {
+                    return i;
+                }
+            }
+            throw memdb::BadQuery("Bad query: column not found in condition");
+        }
+
+        static memdb::Predicate::compare_op parse_operator(std::string_view op) {
+            if (op == "==") {
+                return memdb::Predicate::EQ;
+            } else if (op == "!=") {
+                return memdb::Predicate::NE;
+            } else if (op == "<") {
+                return memdb::Predicate::LT;
+            } else if (op == ">") {
+                return memdb::Predicate::GT;
+            } else if (op == "<=") {
+                return memdb::Predicate::LE;
+            } else if (op == ">=") {
+                return memdb::Predicate::GE;
+            }
+            throw memdb::BadQuery("Bad query: unsupported operator in condition");
+        }
+
+        const std::vector<memdb::Token>& tokens;
+        const std::vector<memdb::Table::column_info>& info_row;
+        memdb::Predicate& predicate;
+        size_t position = 0;
+    };
+}
+
+bool memdb::compare_values(Predicate::compare_op op, const Table::column_value& lhs,
+                          const Table::column_value& rhs) {
+    switch (op) {
+        case Predicate::EQ:
+            return lhs == rhs;
+        case Predicate::NE:
+            return lhs != rhs;
+        case Predicate::LT:
+            return lhs < rhs;
+        case Predicate::GT:
+            return lhs > rhs;
+        case Predicate::LE:
+            return lhs <= rhs;
+        case Predicate::GE:
+            return lhs >= rhs;
+    }
+    return false;
+}
+
+namespace {
+
+    // Равенство по колонке с хеш-индексом среди конъюнктов верхнего уровня
+    const memdb::Predicate::Node* find_indexed_equality(const memdb::Predicate& predicate, size_t index,
+                                                        const memdb::Table& table) {
+        const memdb::Predicate::Node& node = predicate.nodes[index];
+        if (node.type == memdb::Predicate::AND) {
+            if (auto* found = find_indexed_equality(predicate, node.left, table)) {
+                return found;
+            }
+            return find_indexed_equality(predicate, node.right, table);
+        }
+        if (node.type == memdb::Predicate::COMPARE && node.op == memdb::Predicate::EQ &&
+            table.hash_index(node.column) != nullptr) {
+            return &node;
+        }
+        return nullptr;
+    }
+
+    // Диапазон значений одной колонки, выведенный из конъюнктов верхнего уровня
+    struct IndexRange {
+        const memdb::Table::OrderedIndex* index = nullptr;
+        const memdb::Table::column_value* lower = nullptr;
+        bool lower_inclusive = true;
+        const memdb::Table::column_value* upper = nullptr;
+        bool upper_inclusive = true;
+    };
+
+    void tighten_lower(IndexRange& range, const memdb::Table::column_value& value, bool inclusive) {
+        if (range.lower == nullptr || *range.lower < value || (*range.lower == value && !inclusive)) {
+            range.lower = &value;
+            range.lower_inclusive = inclusive;
+        }
+    }
+
+    void tighten_upper(IndexRange& range, const memdb::Table::column_value& value, bool inclusive) {
+        if (range.upper == nullptr || value < *range.upper || (*range.upper == value && !inclusive)) {
+            range.upper = &value;
+            range.upper_inclusive = inclusive;
+        }
+    }
+
+    void collect_range(const memdb::Predicate& predicate, size_t index, const memdb::Table& table,
+                       const memdb::Parameters& params, IndexRange& range) {
+        const memdb::Predicate::Node& node = predicate.nodes[index];
+        if (node.type == memdb::Predicate::AND) {
+            collect_range(predicate, node.left, table, params, range);
+            collect_range(predicate, node.right, table, params, range);
+            return;
+        }
+        if (node.type != memdb::Predicate::COMPARE || node.op == memdb::Predicate::NE) {
+            return;
+        }
+        if (range.index == nullptr) {
+            range.index = table.ordered_index(node.column);
+        }
+        if (range.index == nullptr || range.index->column != node.column) {
+            return;
+        }
+
+        const memdb::Table::column_value& value = node.parameter ? params[node.slot] : node.constant;
+        switch (node.op) {
+            case memdb::Predicate::EQ:
+                tighten_lower(range, value, true);
+                tighten_upper(range, value, true);
+                break;
+            case memdb::Predicate::GT:
+            case memdb::Predicate::GE:
+                tighten_lower(range, value, node.op == memdb::Predicate::GE);
+                break;
+            case memdb::Predicate::LT:
+            case memdb::Predicate::LE:
+                tighten_upper(range, value, node.op == memdb::Predicate::LE);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Кандидаты из упорядоченного индекса, затем полное условие на каждом из них
+    bool scan_index_range(const memdb::Predicate& predicate, const memdb::Table& table,
+                          const memdb::Parameters& params, memdb::Bitmap& results) {
+        IndexRange range;
+        collect_range(predicate, predicate.root, table, params, range);
+        if (range.index == nullptr || (range.lower == nullptr && range.upper == nullptr)) {
+            return false;
+        }
+
+        const auto& entries = range.index->entries;
+        auto it = entries.begin();
+        if (range.lower != nullptr) {
+            it = range.lower_inclusive ? entries.lower_bound(*range.lower) : entries.upper_bound(*range.lower);
+        }
+        for (; it != entries.end(); ++it) {
+            if (range.upper != nullptr &&
+                (range.upper_inclusive ? *range.upper < it->first : !(it->first < *range.upper))) {
+                break;
+            }
+            if (predicate.evaluate(table.get_row(it->second), params)) {
+                results.set(it->second, true);
+            }
+        }
+        return true;
+    }
+}
+
+memdb::Predicate memdb::compile_condition(const std::vector<Token>& condition,
+                                          const std::vector<Table::column_info>& info_row) {
+    Predicate predicate;
+    predicate.root = ConditionCompiler(condition, info_row, predicate).compile();
+    return predicate;
+}
+
+void memdb::Predicate::check_parameters(const Parameters& params) const {
+    if (params.size() < parameter_count) {
+        throw BadQuery("Bad query: parameter " + std::to_string(params.size()) + " is not bound");
+    }
+}
+
+bool memdb::Predicate::evaluate(const Table::row& row, const Parameters& params) const {
+    return evaluate_node(root, row, params);
+}
+
+bool memdb::Predicate::evaluate_node(size_t index, const Table::row& row, const Parameters& params) const {
+    const Node& node = nodes[index];
+    switch (node.type) {
+        case COLUMN:
+            return variant_to_bool(row.values[node.column]);
+        case COMPARE:
+            return compare_values(node.op, row.values[node.column], node.parameter ? params[node.slot] : node.constant);
+        case AND:
+            return evaluate_node(node.left, row, params) && evaluate_node(node.right, row, params);
+        case OR:
+            return evaluate_node(node.left, row, params) || evaluate_node(node.right, row, params);
+    }
+    throw BadQuery("Bad query: unsupported condition");
+}
+
+bool memdb::evaluate_condition(const std::vector<memdb::Token>& condition, const Table::row& row,
+                               const std::vector<Table::column_info>& info_row, const Parameters& params) {
+    Predicate predicate = compile_condition(condition, info_row);
+    predicate.check_parameters(params);
+    return predicate.evaluate(row, params);
+}
+
+namespace {
+    // Снимает с маски строк [begin, end) те, что не видны в версии version
+    void apply_visibility(const memdb::Table& table, uint64_t version, size_t begin, size_t end, uint64_t* out) {
+        size_t words = (end - begin + 63) / 64;
+        if (version < table.write_version) {
+            // Таблица менялась после снимка: надгробия уже про новое состояние, смотрим на версии строк
+            for (size_t word = 0; word < words; ++word) {
+                for (uint64_t bits = out[word]; bits != 0; bits &= bits - 1) {
+                    size_t bit = word * 64 + __builtin_ctzll(bits);
+                    if (!table.visible(begin + bit, version)) {
+                        out[word] &= ~(uint64_t(1) << (bit % 64));
+                    }
+                }
+            }
+        } else if (table.dead_rows != 0) {
+            size_t first = begin / 64;
+            for (size_t word = 0; word < words && first + word < table.deleted.words.size(); ++word) {
+                out[word] &= ~table.deleted.words[first + word];
+            }
+        }
+    }
+}
+
+bool memdb::lookup_indexed_row(const Predicate& predicate, const Table& table, const Parameters& params,
+                               uint64_t version, std::vector<size_t>& row_ids) {
+    // Индексы описывают текущее состояние таблицы, для старого снимка не годятся
+    if (version < table.write_version) {
+        return false;
+    }
+    const Predicate::Node* equality = find_indexed_equality(predicate, predicate.root, table);
+    if (equality == nullptr) {
+        return false;
+    }
+    const auto& positions = table.hash_index(equality->column)->positions;
+    auto it = positions.find(equality->parameter ? params[equality->slot] : equality->constant);
+    if (it != positions.end() && predicate.evaluate(table.get_row(it->second), params)) {
+        row_ids.push_back(it->second);
+    }
+    return true;
+}
+
+void memdb::collect_rows(const Predicate& predicate, const Table& table, const Parameters& params, uint64_t version,
+                         size_t begin, size_t end, std::vector<size_t>& row_ids) {
+    std::vector<uint64_t> words((end - begin + 63) / 64);
+    filter_rows(predicate, table, params, begin, end, words.data());
+    apply_visibility(table, version, begin, end, words.data());
+    for (size_t word = 0; word < words.size(); ++word) {
+        for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+            row_ids.push_back(begin + word * 64 + __builtin_ctzll(bits));
+        }
+    }
+}
+
+memdb::Bitmap memdb::check_condition(const Predicate& predicate, const Table& table, const Parameters& params,
+                                     const ScanOptions& options) {
+    predicate.check_parameters(params);
+
+    Bitmap results;
+    results.resize(table.size());
+
+    std::vector<size_t> found;
+    if (lookup_indexed_row(predicate, table, params, options.version, found)) {
+        for (size_t row_index: found) {
+            results.set(row_index, true);
+        }
+        return results;
+    }
+
+    bool at_snapshot = options.version < table.write_version;
+    if (!at_snapshot && !table.ordered_indexes.empty() && scan_index_range(predicate, table, params, results)) {
+        return results;
+    }
+
+    size_t rows = table.size();
+    if (options.pool != nullptr && options.pool->size() != 0 && rows >= options.threshold) {
+        // Каждый кусок пишет в свои слова маски, поэтому порядок строк сохраняется без слияния
+        size_t morsel = std::max<size_t>(64, options.morsel_size / 64 * 64);
+        options.pool->parallel_for((rows + morsel - 1) / morsel, [&](size_t task) {
+            size_t begin = task * morsel;
+            filter_rows(predicate, table, params, begin, std::min(rows, begin + morsel),
+                        results.words.data() + begin / 64);
+        });
+    } else {
+        filter_rows(predicate, table, params, 0, rows, results.words.data());
+    }
+    apply_visibility(table, options.version, 0, rows, results.words.data());
+    return results;
+}
+
+memdb::Bitmap memdb::check_condition(const std::vector<memdb::Token>& condition, Table& table,
+                                     const Parameters& params) {
+    return check_condition(compile_condition(condition, table.info_row), table, params);
+}
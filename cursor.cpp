@@ -0,0 +1,131 @@
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+std::shared_lock<std::shared_mutex> memdb::Cursor::lock() const {
+    if (read_view == nullptr) {
+        return {};
+    }
+    return read_view->database().read_lock();
+}
+
+size_t memdb::Cursor::column_count() const {
+    return projection.size();
+}
+
+const memdb::Table::column_info &memdb::Cursor::column(size_t column_index) const {
+    if (join != nullptr) {
+        return join_info[projection[column_index]];
+    }
+    return table->info_row[projection[column_index]];
+}
+
+size_t memdb::Cursor::rows_scanned() const {
+    return scanned;
+}
+
+bool memdb::Cursor::fill() {
+    pending.clear();
+    pending_index = 0;
+    uint64_t version = read_view->version();
+    if (!index_checked) {
+        index_checked = true;
+        if (lookup_indexed_row(predicate, *table, params, version, pending)) {
+            scanned += pending.size();
+            position = end;
+            return !pending.empty();
+        }
+    }
+    // Куски растут вдвое: короткий limit проверяет мало строк, длинный скан не платит за частые вызовы
+    while (pending.empty() && position < end) {
+        size_t stop = std::min(end, position + chunk);
+        collect_rows(predicate, *table, params, version, position, stop, pending);
+        scanned += stop - position;
+        position = stop;
+        chunk = std::min(chunk * 2, MAX_CHUNK);
+    }
+    return !pending.empty();
+}
+
+bool memdb::Cursor::advance(size_t &row_id) {
+    if (table == nullptr) {
+        return false;
+    }
+    while (remaining != 0) {
+        if (pending_index == pending.size() && !fill()) {
+            return false;
+        }
+        row_id = pending[pending_index++];
+        if (skip != 0) {
+            --skip;
+            continue;
+        }
+        --remaining;
+        return true;
+    }
+    return false;
+}
+
+bool memdb::Cursor::advance_pair(size_t &left_row, size_t &right_row) {
+    while (remaining != 0 && join->next(left_row, right_row)) {
+        if (filtered) {
+            Table::row pair = table->get_row(left_row);
+            Table::row right = right_table->get_row(right_row);
+            pair.values.insert(pair.values.end(), std::make_move_iterator(right.values.begin()),
+                               std::make_move_iterator(right.values.end()));
+            if (!join_filter.evaluate(pair, params)) {
+                continue;
+            }
+        }
+        if (skip != 0) {
+            --skip;
+            continue;
+        }
+        --remaining;
+        return true;
+    }
+    return false;
+}
+
+bool memdb::Cursor::read_next(Table::row &row) {
+    size_t row_id;
+    size_t right_row = 0;
+    if (join != nullptr ? !advance_pair(row_id, right_row) : !advance(row_id)) {
+        return false;
+    }
+    // В join номера колонок правой таблицы идут после колонок левой
+    size_t left_count = table->info_row.size();
+    row.values.clear();
+    row.values.reserve(projection.size());
+    for (size_t column_index: projection) {
+        row.values.push_back(column_index < left_count ? table->get(row_id, column_index) :
+                             right_table->get(right_row, column_index - left_count));
+    }
+    return true;
+}
+
+bool memdb::Cursor::next_row_id(size_t &row_id) {
+    if (join != nullptr) {
+        throw BadQuery("Bad query: rows of a join don't belong to one table");
+    }
+    auto guard = lock();
+    return advance(row_id);
+}
+
+bool memdb::Cursor::next(Table::row &row) {
+    auto guard = lock();
+    return read_next(row);
+}
+
+std::vector<memdb::Table::row> memdb::Cursor::next_batch(size_t count) {
+    auto guard = lock();
+    std::vector<Table::row> batch;
+    Table::row row;
+    while (batch.size() < count && read_next(row)) {
+        batch.push_back(std::move(row));
+    }
+    return batch;
+}
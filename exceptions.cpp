@@ -1,17 +1,20 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include "memdb.h"
 #include "exceptions.h"
 
 
-void memdb::check_syntax(std::vector<memdb::Token> tokens) {
+void memdb::check_syntax(const std::vector<memdb::Token> &tokens) {
 
     if (tokens[0].type != Token::KEYWORD) {
         throw BadQuery("Bad query: query have to start with keyword");
     }
 
-    if (to_lower(tokens[0].value) == "create" && to_lower(tokens[1].value) != "table") {
-        throw BadQuery("Bad query: maybe without " + tokens[1].value + " you wanted use \"table\"");
+    bool create_index = iequals(tokens[0].value, "create") && iequals(tokens[1].value, "index");
+
+    if (to_lower(tokens[0].value) == "create" && to_lower(tokens[1].value) != "table" && !create_index) {
+        throw BadQuery("Bad query: maybe without " + std::string(tokens[1].value) + " you wanted use \"table\"");
     }
 
     if (to_lower(tokens[0].value) == "create" && to_lower(tokens[1].value) == "table" &&
@@ -23,9 +26,9 @@ void memdb::check_syntax(std::vector<memdb::Token> tokens) {
     int brackets1 = 0;
     int brackets2 = 0;
 
-    for (auto &token: tokens) {
+    for (const auto &token: tokens) {
         if (token.type == Token::UNDEFINED) {
-            throw BadQuery("Bad query: undefined value " + token.value);
+            throw BadQuery("Bad query: undefined value " + std::string(token.value));
         }
         if (token.type == Token::KEYWORD) {
             keywords += 1;
@@ -47,32 +50,63 @@ void memdb::check_syntax(std::vector<memdb::Token> tokens) {
     }
 
     if (tokens[0].value == "insert" || tokens[0].value == "create" || tokens[0].value == "delete") {
-        if (keywords < 2) {
+        int expected = create_index ? 3 : 2; // create index <name> on <table>(<column>)
+        if (keywords < expected) {
             throw BadQuery("Bad query: too few keywords");
         }
-        if (keywords > 2) {
+        if (keywords > expected) {
             throw BadQuery("Bad query: too many keywords");
         }
     }
 
     if (tokens[0].value == "select" || tokens[0].value == "update") {
-        if (keywords < 3) {
+        bool join = std::any_of(tokens.begin(), tokens.end(), [](const Token &token) {
+            return token.type == Token::KEYWORD && iequals(token.value, "join");
+        });
+        int expected = join ? 5 : 3; // select ... from a join b on ... where
+        if (keywords < expected) {
             throw BadQuery("Bad query: too few keywords");
         }
-        if (keywords > 3) {
+        if (keywords > expected) {
             throw BadQuery("Bad query: too many keywords");
         }
     }
 
+    // group by, order by <колонка> [asc|desc], limit N и offset M стоят в конце select после условия;
+    // clauses — номер первого их слова. Оно идёт сразу за операндом, поэтому колонку с таким именем
+    // в самом условии за начало не примешь
+    size_t clauses = tokens.size();
+    if (iequals(tokens[0].value, "select")) {
+        bool condition = false;
+        for (size_t i = 1; i < tokens.size() && clauses == tokens.size(); ++i) {
+            const Token &previous = tokens[i - 1];
+            condition = condition || (previous.type == Token::KEYWORD && iequals(previous.value, "where"));
+            bool after_operand = previous.type == Token::FIELD_NAME || previous.type == Token::VALUE ||
+                                 previous.type == Token::PLACEHOLDER || previous.value == ")";
+            bool starts_clause = ((iequals(tokens[i].value, "order") || iequals(tokens[i].value, "group")) &&
+                                  i + 1 < tokens.size() && iequals(tokens[i + 1].value, "by")) ||
+                                 iequals(tokens[i].value, "limit") || iequals(tokens[i].value, "offset");
+            if (condition && after_operand && starts_clause && tokens[i].type == Token::FIELD_NAME) {
+                clauses = i;
+            }
+        }
+    }
+
     for (auto it = tokens.begin(); it != (tokens.end() - 1); it++) {
-        if ((it->type == Token::FIELD_NAME && (it + 1)->type == Token::FIELD_NAME) ||
+        // В этих частях select слова идут подряд без разделителя
+        bool clause = static_cast<size_t>(it - tokens.begin()) + 1 >= clauses &&
+                      (iequals(it->value, "order") || iequals(it->value, "group") || iequals(it->value, "by") ||
+                       iequals((it + 1)->value, "asc") || iequals((it + 1)->value, "desc") ||
+                       iequals((it + 1)->value, "order") || iequals((it + 1)->value, "limit") ||
+                       iequals((it + 1)->value, "offset"));
+        if ((it->type == Token::FIELD_NAME && (it + 1)->type == Token::FIELD_NAME && !clause) ||
         (it->type == Token::ATTRIBUTE && (it + 1)->type == Token::ATTRIBUTE) ||
         (it->type == Token::VALUE && (it + 1)->type == Token::VALUE)) {
-            throw BadQuery("Bad query: expected , or : between " + it->value + " and " + (it + 1)->value);
+            throw BadQuery("Bad query: expected , or : between " + std::string(it->value) + " and " + std::string((it + 1)->value));
         }
 
         if (it->value == "{" && (it + 1)->type != Token::ATTRIBUTE) {
-            throw BadQuery("Bad query: after { have to be attribute value, not " + (it + 1)->value);
+            throw BadQuery("Bad query: after { have to be attribute value, not " + std::string((it + 1)->value));
         }
     }
 }
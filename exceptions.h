@@ -16,6 +16,19 @@ namespace memdb{
         }
     };
 
+    // Ошибка чтения или записи журнала и снимков
+    class StorageError : public std::exception {
+    private:
+        std::string message;
+    public:
+
+        explicit StorageError(std::string msg) : message(std::move(msg)) {}
+
+        [[nodiscard]] const char *what() const noexcept override {
+            return message.c_str();
+        }
+    };
+
 
-    void check_syntax(std::vector<memdb::Token> tokens);
+    void check_syntax(const std::vector<memdb::Token> &tokens);
 }
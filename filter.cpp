@@ -0,0 +1,450 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "memdb.h"
+#include "exceptions.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMDB_X86_KERNELS 1
+#endif
+
+
+namespace {
+
+    using memdb::Predicate;
+
+    size_t word_count(size_t count) {
+        return (count + 63) / 64;
+    }
+
+    uint64_t tail_mask(size_t count) {
+        return count % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << (count % 64)) - 1;
+    }
+
+    template<Predicate::compare_op Op, typename T>
+    inline bool apply(const T& lhs, const T& rhs) {
+        if constexpr (Op == Predicate::EQ) {
+            return lhs == rhs;
+        } else if constexpr (Op == Predicate::NE) {
+            return lhs != rhs;
+        } else if constexpr (Op == Predicate::LT) {
+            return lhs < rhs;
+        } else if constexpr (Op == Predicate::GT) {
+            return lhs > rhs;
+        } else if constexpr (Op == Predicate::LE) {
+            return lhs <= rhs;
+        } else {
+            return lhs >= rhs;
+        }
+    }
+
+    template<Predicate::compare_op Op>
+    void compare_scalar(const int32_t* values, size_t count, int32_t constant, uint64_t* out) {
+        for (size_t word = 0; word < word_count(count); ++word) {
+            size_t base = word * 64;
+            size_t limit = std::min<size_t>(64, count - base);
+            uint64_t bits = 0;
+            for (size_t j = 0; j < limit; ++j) {
+                bits |= uint64_t(apply<Op>(values[base + j], constant)) << j;
+            }
+            out[word] = bits;
+        }
+    }
+
+#ifdef MEMDB_X86_KERNELS
+
+    // Для NE, GE и LE сравниваем противоположным образом и инвертируем маску
+    template<Predicate::compare_op Op>
+    inline int sse2_mask(__m128i values, __m128i constant) {
+        __m128i result;
+        if constexpr (Op == Predicate::EQ || Op == Predicate::NE) {
+            result = _mm_cmpeq_epi32(values, constant);
+        } else if constexpr (Op == Predicate::GT || Op == Predicate::LE) {
+            result = _mm_cmpgt_epi32(values, constant);
+        } else {
+            result = _mm_cmpgt_epi32(constant, values);
+        }
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(result));
+        constexpr bool invert = Op == Predicate::NE || Op == Predicate::LE || Op == Predicate::GE;
+        return invert ? mask ^ 0xF : mask;
+    }
+
+    template<Predicate::compare_op Op>
+    void compare_sse2(const int32_t* values, size_t count, int32_t constant, uint64_t* out) {
+        __m128i broadcast = _mm_set1_epi32(constant);
+        size_t full_words = count / 64;
+        for (size_t word = 0; word < full_words; ++word) {
+            const int32_t* block = values + word * 64;
+            uint64_t bits = 0;
+            for (size_t lane = 0; lane < 16; ++lane) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + lane * 4));
+                bits |= uint64_t(sse2_mask<Op>(chunk, broadcast)) << (lane * 4);
+            }
+            out[word] = bits;
+        }
+        if (count % 64 != 0) {
+            compare_scalar<Op>(values + full_words * 64, count % 64, constant, out + full_words);
+        }
+    }
+
+    template<Predicate::compare_op Op>
+    __attribute__((target("avx2"))) inline int avx2_mask(__m256i values, __m256i constant) {
+        __m256i result;
+        if constexpr (Op == Predicate::EQ || Op == Predicate::NE) {
+            result = _mm256_cmpeq_epi32(values, constant);
+        } else if constexpr (Op == Predicate::GT || Op == Predicate::LE) {
+            result = _mm256_cmpgt_epi32(values, constant);
+        } else {
+            result = _mm256_cmpgt_epi32(constant, values);
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(result));
+        constexpr bool invert = Op == Predicate::NE || Op == Predicate::LE || Op == Predicate::GE;
+        return invert ? mask ^ 0xFF : mask;
+    }
+
+    template<Predicate::compare_op Op>
+    __attribute__((target("avx2"))) void compare_avx2(const int32_t* values, size_t count, int32_t constant,
+                                                      uint64_t* out) {
+        __m256i broadcast = _mm256_set1_epi32(constant);
+        size_t full_words = count / 64;
+        for (size_t word = 0; word < full_words; ++word) {
+            const int32_t* block = values + word * 64;
+            uint64_t bits = 0;
+            for (size_t lane = 0; lane < 8; ++lane) {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + lane * 8));
+                bits |= uint64_t(avx2_mask<Op>(chunk, broadcast)) << (lane * 8);
+            }
+            out[word] = bits;
+        }
+        if (count % 64 != 0) {
+            compare_scalar<Op>(values + full_words * 64, count % 64, constant, out + full_words);
+        }
+    }
+
+#endif
+
+    template<Predicate::compare_op Op>
+    void dispatch(memdb::filter_isa isa, const int32_t* values, size_t count, int32_t constant, uint64_t* out) {
+#ifdef MEMDB_X86_KERNELS
+        if (isa == memdb::AVX2) {
+            compare_avx2<Op>(values, count, constant, out);
+            return;
+        }
+        if (isa == memdb::SSE2) {
+            compare_sse2<Op>(values, count, constant, out);
+            return;
+        }
+#endif
+        compare_scalar<Op>(values, count, constant, out);
+    }
+
+    // Сравнение 64 упакованных bool с константой целым словом
+    uint64_t compare_bool_word(uint64_t bits, Predicate::compare_op op, bool constant) {
+        switch (op) {
+            case Predicate::EQ:
+                return constant ? bits : ~bits;
+            case Predicate::NE:
+                return constant ? ~bits : bits;
+            case Predicate::LT:
+                return constant ? ~bits : 0;
+            case Predicate::GT:
+                return constant ? 0 : bits;
+            case Predicate::LE:
+                return constant ? ~uint64_t(0) : ~bits;
+            case Predicate::GE:
+                return constant ? bits : ~uint64_t(0);
+        }
+        return 0;
+    }
+
+    // memcmp сравнивает как unsigned char — так же, как std::string и std::vector<uint8_t>
+    int compare_bytes(std::string_view lhs, const char* rhs, size_t rhs_size) {
+        size_t common = std::min(lhs.size(), rhs_size);
+        int result = common == 0 ? 0 : std::memcmp(lhs.data(), rhs, common);
+        if (result != 0) {
+            return result;
+        }
+        return lhs.size() < rhs_size ? -1 : (lhs.size() > rhs_size ? 1 : 0);
+    }
+
+    bool order_matches(Predicate::compare_op op, int order) {
+        switch (op) {
+            case Predicate::EQ:
+                return order == 0;
+            case Predicate::NE:
+                return order != 0;
+            case Predicate::LT:
+                return order < 0;
+            case Predicate::GT:
+                return order > 0;
+            case Predicate::LE:
+                return order <= 0;
+            case Predicate::GE:
+                return order >= 0;
+        }
+        return false;
+    }
+
+    struct FilterContext {
+        const Predicate& predicate;
+        const memdb::Table& table;
+        const memdb::Parameters& params;
+        size_t begin;
+        size_t end;
+    };
+
+    template<typename RowTest>
+    void fill_bits(size_t begin, size_t end, uint64_t* out, RowTest&& test) {
+        for (size_t word = 0; word < word_count(end - begin); ++word) {
+            size_t base = begin + word * 64;
+            size_t limit = std::min<size_t>(64, end - base);
+            uint64_t bits = 0;
+            for (size_t j = 0; j < limit; ++j) {
+                bits |= uint64_t(test(base + j)) << j;
+            }
+            out[word] = bits;
+        }
+    }
+
+    template<typename Code>
+    void match_codes(const FilterContext& ctx, const memdb::Table::Column& column, uint32_t code, bool want_equal,
+                     uint64_t* out) {
+        const uint8_t* codes = column.codes.data();
+        auto wanted = static_cast<Code>(code);
+        fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+            Code value;
+            std::memcpy(&value, codes + row * sizeof(Code), sizeof(Code));
+            return (value == wanted) == want_equal;
+        });
+    }
+
+    void compare_column(const FilterContext& ctx, const memdb::Table::Column& column, Predicate::compare_op op,
+                        const memdb::Table::column_value& constant, uint64_t* out) {
+        using Column = memdb::Table::Column;
+        size_t count = ctx.end - ctx.begin;
+        const char* data = nullptr;
+        size_t length = 0;
+
+        if (auto* number = std::get_if<int>(&constant); number != nullptr && column.kind == Column::INT32) {
+            memdb::compare_int32(column.ints.data() + ctx.begin, count, op, *number, out);
+        } else if (auto* flag = std::get_if<bool>(&constant); flag != nullptr && column.kind == Column::BOOL) {
+            const uint64_t* words = column.bools.words.data() + ctx.begin / 64;
+            for (size_t word = 0; word < word_count(count); ++word) {
+                out[word] = compare_bool_word(words[word], op, *flag);
+            }
+            out[word_count(count) - 1] &= tail_mask(count);
+        } else if ((column.kind == Column::STRING && std::holds_alternative<std::string>(constant)) ||
+                   (column.kind == Column::BYTES && std::holds_alternative<std::vector<uint8_t>>(constant))) {
+            if (auto* str = std::get_if<std::string>(&constant)) {
+                data = str->data();
+                length = str->size();
+            } else {
+                const auto& bytes = std::get<std::vector<uint8_t>>(constant);
+                data = reinterpret_cast<const char*>(bytes.data());
+                length = bytes.size();
+            }
+            if (column.code_width != 0 && (op == Predicate::EQ || op == Predicate::NE)) {
+                // Константа переводится в код один раз, дальше сравниваются только целые коды
+                int64_t code = column.find_code(std::string_view(data, length));
+                bool want_equal = op == Predicate::EQ;
+                if (code < 0) {
+                    fill_bits(ctx.begin, ctx.end, out, [&](size_t) { return !want_equal; });
+                } else if (column.code_width == 1) {
+                    match_codes<uint8_t>(ctx, column, static_cast<uint32_t>(code), want_equal, out);
+                } else if (column.code_width == 2) {
+                    match_codes<uint16_t>(ctx, column, static_cast<uint32_t>(code), want_equal, out);
+                } else {
+                    match_codes<uint32_t>(ctx, column, static_cast<uint32_t>(code), want_equal, out);
+                }
+            } else if (column.slot_width != 0 && (op == Predicate::EQ || op == Predicate::NE)) {
+                // Слоты дополнены нулями: равенство — один memcmp слота с так же дополненным ключом
+                bool want_equal = op == Predicate::EQ;
+                size_t width = column.slot_width;
+                if (length >= width) {
+                    fill_bits(ctx.begin, ctx.end, out, [&](size_t) { return !want_equal; });
+                } else {
+                    std::vector<char> key(width, 0);
+                    key[0] = static_cast<char>(length);
+                    std::memcpy(key.data() + 1, data, length);
+                    const char* slots = column.slots.data();
+                    fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                        return (std::memcmp(slots + row * width, key.data(), width) == 0) == want_equal;
+                    });
+                }
+            } else {
+                fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                    return order_matches(op, compare_bytes(column.view(row), data, length));
+                });
+            }
+        } else {
+            // Константа другого типа: сравниваем варианты, как в строковом хранилище
+            fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                return memdb::compare_values(op, column.get(row), constant);
+            });
+            return;
+        }
+
+        if (column.null_count != 0) {
+            bool null_result = memdb::compare_values(op, std::monostate{}, constant);
+            for (size_t row = ctx.begin; row < ctx.end; ++row) {
+                if (!column.validity.get(row)) {
+                    size_t bit = row - ctx.begin;
+                    out[bit / 64] = (out[bit / 64] & ~(uint64_t(1) << (bit % 64))) |
+                                    (uint64_t(null_result) << (bit % 64));
+                }
+            }
+        }
+    }
+
+    void compare_rows(const FilterContext& ctx, size_t column, Predicate::compare_op op,
+                      const memdb::Table::column_value& constant, uint64_t* out) {
+        const auto& rows = ctx.table.rows;
+        const int* number = std::get_if<int>(&constant);
+        int32_t gathered[64];
+
+        for (size_t word = 0; word < word_count(ctx.end - ctx.begin); ++word) {
+            size_t base = ctx.begin + word * 64;
+            size_t limit = std::min<size_t>(64, ctx.end - base);
+
+            // Собираем блок int32 в непрерывный буфер и прогоняем через векторное ядро
+            bool all_ints = number != nullptr;
+            for (size_t j = 0; j < limit && all_ints; ++j) {
+                const int* value = std::get_if<int>(&rows[base + j].values[column]);
+                all_ints = value != nullptr;
+                gathered[j] = all_ints ? *value : 0;
+            }
+            if (all_ints) {
+                memdb::compare_int32(gathered, limit, op, *number, out + word);
+                continue;
+            }
+
+            uint64_t bits = 0;
+            for (size_t j = 0; j < limit; ++j) {
+                bits |= uint64_t(memdb::compare_values(op, rows[base + j].values[column], constant)) << j;
+            }
+            out[word] = bits;
+        }
+    }
+
+    void column_truth(const FilterContext& ctx, size_t column_index, uint64_t* out) {
+        using Column = memdb::Table::Column;
+        size_t count = ctx.end - ctx.begin;
+
+        if (ctx.table.layout == memdb::Table::ROW_LAYOUT) {
+            fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                return memdb::variant_to_bool(ctx.table.rows[row].values[column_index]);
+            });
+            return;
+        }
+
+        const Column& column = ctx.table.columns[column_index];
+        if (column.null_count != 0) {
+            fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                return memdb::variant_to_bool(column.get(row));
+            });
+        } else if (column.kind == Column::INT32) {
+            memdb::compare_int32(column.ints.data() + ctx.begin, count, Predicate::NE, 0, out);
+        } else if (column.kind == Column::BOOL) {
+            std::copy_n(column.bools.words.data() + ctx.begin / 64, word_count(count), out);
+            out[word_count(count) - 1] &= tail_mask(count);
+        } else {
+            // Как и variant_to_bool: строка или байты истинны, если пусты
+            fill_bits(ctx.begin, ctx.end, out, [&](size_t row) {
+                return column.view(row).empty();
+            });
+        }
+    }
+
+    void evaluate(const FilterContext& ctx, size_t index, uint64_t* out) {
+        const Predicate::Node& node = ctx.predicate.nodes[index];
+        size_t words = word_count(ctx.end - ctx.begin);
+
+        switch (node.type) {
+            case Predicate::COLUMN:
+                column_truth(ctx, node.column, out);
+                return;
+            case Predicate::COMPARE: {
+                const auto& constant = node.parameter ? ctx.params[node.slot] : node.constant;
+                if (ctx.table.layout == memdb::Table::COLUMN_LAYOUT) {
+                    compare_column(ctx, ctx.table.columns[node.column], node.op, constant, out);
+                } else {
+                    compare_rows(ctx, node.column, node.op, constant, out);
+                }
+                return;
+            }
+            case Predicate::AND:
+            case Predicate::OR: {
+                evaluate(ctx, node.left, out);
+                bool is_and = node.type == Predicate::AND;
+
+                // Правую часть не считаем, если левая уже всё решила для всего диапазона
+                bool decided = true;
+                for (size_t word = 0; word < words && decided; ++word) {
+                    uint64_t full = word + 1 == words ? tail_mask(ctx.end - ctx.begin) : ~uint64_t(0);
+                    decided = is_and ? out[word] == 0 : out[word] == full;
+                }
+                if (decided) {
+                    return;
+                }
+
+                std::vector<uint64_t> right(words);
+                evaluate(ctx, node.right, right.data());
+                for (size_t word = 0; word < words; ++word) {
+                    out[word] = is_and ? (out[word] & right[word]) : (out[word] | right[word]);
+                }
+                return;
+            }
+        }
+    }
+}
+
+memdb::filter_isa memdb::best_filter_isa() {
+    static const filter_isa best = [] {
+#ifdef MEMDB_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return AVX2;
+        }
+        return SSE2;
+#else
+        return SCALAR;
+#endif
+    }();
+    return best;
+}
+
+bool memdb::filter_isa_supported(filter_isa isa) {
+    return isa <= best_filter_isa();
+}
+
+void memdb::compare_int32(const int32_t* values, size_t count, Predicate::compare_op op, int32_t constant,
+                          uint64_t* out, filter_isa isa) {
+    switch (op) {
+        case Predicate::EQ:
+            return dispatch<Predicate::EQ>(isa, values, count, constant, out);
+        case Predicate::NE:
+            return dispatch<Predicate::NE>(isa, values, count, constant, out);
+        case Predicate::LT:
+            return dispatch<Predicate::LT>(isa, values, count, constant, out);
+        case Predicate::GT:
+            return dispatch<Predicate::GT>(isa, values, count, constant, out);
+        case Predicate::LE:
+            return dispatch<Predicate::LE>(isa, values, count, constant, out);
+        case Predicate::GE:
+            return dispatch<Predicate::GE>(isa, values, count, constant, out);
+    }
+}
+
+void memdb::filter_rows(const Predicate& predicate, const Table& table, const Parameters& params,
+                        size_t begin, size_t end, uint64_t* out) {
+    if (begin % 64 != 0) {
+        throw BadQuery("Bad query: filter range has to start at a multiple of 64");
+    }
+    if (begin >= end) {
+        return;
+    }
+    FilterContext ctx{predicate, table, params, begin, end};
+    evaluate(ctx, predicate.root, out);
+}
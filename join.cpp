@@ -0,0 +1,117 @@
+#include <vector>
+#include <string_view>
+#include <functional>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+namespace {
+    // Перемешивание из MurmurHash3: младшие биты хеша выбирают цепочку
+    uint64_t mix(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    bool is_integer(const memdb::Table &table, size_t column) {
+        memdb::Table::ColumnType::type_kind kind = table.info_row[column].column_type.kind;
+        return kind == memdb::Table::ColumnType::INT32 || kind == memdb::Table::ColumnType::BOOL;
+    }
+}
+
+memdb::HashJoin::HashJoin(const Table &left, std::vector<size_t> left_rows, size_t left_column,
+                          const Table &right, std::vector<size_t> right_rows, size_t right_column) :
+        build_left(left_rows.size() <= right_rows.size()) {
+    if (left.info_row[left_column].column_type.kind != right.info_row[right_column].column_type.kind) {
+        throw BadQuery("Bad query: can't join " + left.info_row[left_column].name + " with " +
+                       right.info_row[right_column].name + " of another type");
+    }
+    integer_keys = is_integer(left, left_column);
+    build_table = build_left ? &left : &right;
+    probe_table = build_left ? &right : &left;
+    build_column = build_left ? left_column : right_column;
+    probe_column = build_left ? right_column : left_column;
+    build_rows = std::move(build_left ? left_rows : right_rows);
+    probe_rows = std::move(build_left ? right_rows : left_rows);
+    if (build_rows.size() >= NONE) {
+        throw BadQuery("Bad query: too many rows to join");
+    }
+
+    size_t capacity = 16;
+    while (capacity < build_rows.size() * 2) {
+        capacity *= 2;
+    }
+    heads.assign(capacity, NONE);
+    chain.assign(build_rows.size(), NONE);
+    build_hashes.resize(build_rows.size());
+    // Вставка с конца: в цепочке строки идут по возрастанию, и пары с одной строкой второго входа тоже
+    for (size_t i = build_rows.size(); i-- > 0;) {
+        if (!hash_key(*build_table, build_rows[i], build_column, build_hashes[i])) {
+            continue;
+        }
+        uint32_t &head = heads[build_hashes[i] & (capacity - 1)];
+        chain[i] = head;
+        head = static_cast<uint32_t>(i);
+    }
+}
+
+bool memdb::HashJoin::hash_key(const Table &table, size_t row_index, size_t column, uint64_t &hash) const {
+    if (integer_keys) {
+        int32_t value;
+        if (!read_int(table, row_index, column, value)) {
+            return false;
+        }
+        hash = mix(static_cast<uint32_t>(value));
+        return true;
+    }
+    std::string_view data;
+    if (!read_bytes(table, row_index, column, data)) {
+        return false;
+    }
+    hash = mix(std::hash<std::string_view>{}(data));
+    return true;
+}
+
+bool memdb::HashJoin::keys_equal(size_t build_row, size_t probe_row) const {
+    if (integer_keys) {
+        int32_t lhs;
+        int32_t rhs;
+        return read_int(*build_table, build_row, build_column, lhs) &&
+               read_int(*probe_table, probe_row, probe_column, rhs) && lhs == rhs;
+    }
+    std::string_view lhs;
+    std::string_view rhs;
+    return read_bytes(*build_table, build_row, build_column, lhs) &&
+           read_bytes(*probe_table, probe_row, probe_column, rhs) && lhs == rhs;
+}
+
+bool memdb::HashJoin::next(size_t &left_row, size_t &right_row) {
+    size_t mask = heads.size() - 1;
+    while (true) {
+        // Продолжение цепочки текущей строки второго входа
+        for (; candidate != NONE; candidate = chain[candidate]) {
+            size_t probe_row = probe_rows[probe_position - 1];
+            if (build_hashes[candidate] == probe_hash && keys_equal(build_rows[candidate], probe_row)) {
+                size_t build_row = build_rows[candidate];
+                candidate = chain[candidate];
+                left_row = build_left ? build_row : probe_row;
+                right_row = build_left ? probe_row : build_row;
+                return true;
+            }
+        }
+        if (probe_position == probe_rows.size()) {
+            return false;
+        }
+        if (hash_key(*probe_table, probe_rows[probe_position], probe_column, probe_hash)) {
+            candidate = heads[probe_hash & mask];
+        }
+        ++probe_position;
+    }
+}
+
+size_t memdb::HashJoin::rows_probed() const {
+    return probe_position;
+}
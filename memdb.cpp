@@ -2,17 +2,13 @@
 #include <utility>
 #include <vector>
 #include <string>
-#include <regex>
+#include <cctype>
 #include <variant>
 #include <iomanip>
 #include "memdb.h"
 #include "exceptions.h"
 
 
-void memdb::Table::add_row(const row &row) {
-    rows.emplace_back(row);
-}
-
 void memdb::Table::ValuePrinter::operator()(const std::monostate &) const {
     std::cout << "NULL";
 }
@@ -39,13 +35,16 @@ void memdb::Table::ValuePrinter::operator()(const std::vector<uint8_t> &value) c
 void memdb::Table::print() const {
     std::cout << "------ Table name: " << name << " ------" << std::endl;
     for (const auto &row: info_row) {
-        std::cout << row.name << "(" << row.type << ")" << "{" << row.key << ' ' << row.autoincrement << ' ' << row.unique << "}";
+        std::cout << row.name << "(" << row.column_type.name() << ")" << "{" << row.key << ' ' << row.autoincrement << ' ' << row.unique << "}";
         std::visit(ValuePrinter{}, row.default_value);
         std::cout << "\t";
     }
     std::cout << std::endl;
-    for (const auto &row: rows) {
-        for (const auto &value: row.values) {
+    for (size_t i = 0; i < size(); ++i) {
+        if (!is_live(i)) {
+            continue;
+        }
+        for (const auto &value: get_row(i).values) {
             std::visit(ValuePrinter{}, value);
             std::cout << "\t";
         }
@@ -53,21 +52,28 @@ void memdb::Table::print() const {
     }
 }
 
-memdb::Table::column_value memdb::parse_value(const std::string &raw_value) {
-    if (std::regex_match(raw_value, std::regex(R"(^\d+$)"))) {
-        return std::stoi(raw_value);
-    } else if (std::regex_match(raw_value, std::regex(R"(^true$|^false$)", std::regex_constants::icase))) {
-        return (memdb::to_lower(raw_value) == "true");
-    } else if (raw_value[0] == '"') {
-        return raw_value;
-    } else if (std::regex_match(raw_value, std::regex(R"(^0x[0-9a-fA-F]+$)"))) {
+memdb::Table::column_value memdb::parse_value(std::string_view raw_value) {
+    // Разбирается на каждый литерал каждого запроса, поэтому без std::regex
+    auto all_of = [](std::string_view text, int (*predicate)(int)) {
+        return !text.empty() && std::all_of(text.begin(), text.end(), [predicate](char c) {
+            return predicate(static_cast<unsigned char>(c)) != 0;
+        });
+    };
+
+    if (all_of(raw_value, isdigit)) {
+        return std::stoi(std::string(raw_value));
+    } else if (iequals(raw_value, "true") || iequals(raw_value, "false")) {
+        return iequals(raw_value, "true");
+    } else if (!raw_value.empty() && raw_value[0] == '"') {
+        return std::string(raw_value);
+    } else if (raw_value.size() > 2 && raw_value.substr(0, 2) == "0x" && all_of(raw_value.substr(2), isxdigit)) {
         std::vector<uint8_t> bytes;
         for (size_t i = 2; i < raw_value.size(); i += 2) {
-            bytes.push_back(std::stoi(raw_value.substr(i, 2), nullptr, 16));
+            bytes.push_back(std::stoi(std::string(raw_value.substr(i, 2)), nullptr, 16));
         }
         return bytes;
     } else {
-        throw memdb::BadQuery("Bad query: Unsupported value: " + raw_value);
+        throw memdb::BadQuery("Bad query: Unsupported value: " + std::string(raw_value));
     }
 }
 
@@ -76,7 +82,7 @@ memdb::Table memdb::create_table(const std::vector<Token> &tokens) {
     Table result_table;
 
     if (tokens[2].type == Token::TABLE_NAME) {
-        result_table.name = tokens[2].value;
+        result_table.name = std::string(tokens[2].value);
     } else {
         throw BadQuery("Bad query: create table query without table name");
     }
@@ -84,10 +90,11 @@ memdb::Table memdb::create_table(const std::vector<Token> &tokens) {
     bool key = false;
     bool autoincrement = false;
     bool unique = false;
+    bool dictionary = false;
     std::string name;
     std::string type;
     Table::column_value default_value = std::monostate{};
-    int index = 4;
+    size_t index = 4;
 
     while (tokens[index].value != ")") {
         if (tokens[index].type == Token::ATTRIBUTE) {
@@ -100,19 +107,33 @@ memdb::Table memdb::create_table(const std::vector<Token> &tokens) {
             if (tokens[index].value == "unique") {
                 unique = true;
             }
+            if (tokens[index].value == "dict") {
+                dictionary = true;
+            }
+            if (tokens[index].value == "columnar") {
+                throw BadQuery("Bad query: columnar is a table attribute, not a column one");
+            }
         }
         if (tokens[index].type == Token::FIELD_NAME) {
-            name = tokens[index].value;
+            name = std::string(tokens[index].value);
         }
         if (tokens[index].type == Token::TYPE_NAME) {
-            type = tokens[index].value;
+            type = std::string(tokens[index].value);
             if (tokens[index + 1].value == "=") {
-                std::string raw_value = tokens[index + 2].value;
-                default_value = parse_value(raw_value);
+                default_value = parse_value(tokens[index + 2].value);
             }
             Table::column_info info(key, unique, autoincrement, name, type, default_value);
-            result_table.info_row.emplace_back(info);
+            if (!info.column_type.accepts(info.default_value)) {
+                throw BadQuery("Bad query: default value doesn't fit column '" + name + "' of type " + type);
+            }
+            info.dictionary = dictionary;
+            if (dictionary && info.column_type.kind != Table::ColumnType::STRING &&
+                info.column_type.kind != Table::ColumnType::BYTES) {
+                throw BadQuery("Bad query: dict needs a string or bytes column, '" + name + "' is " + type);
+            }
+            result_table.info_row.emplace_back(std::move(info));
             key = false;
+            dictionary = false;
             autoincrement = false;
             unique = false;
             name = "";
@@ -123,272 +144,356 @@ memdb::Table memdb::create_table(const std::vector<Token> &tokens) {
         index++;
     }
 
+    result_table.rebuild_catalog();
+    result_table.rebuild_indexes();
+
+    // Атрибуты таблицы после списка колонок: ... ) {columnar}
+    for (++index; index < tokens.size(); ++index) {
+        if (tokens[index].type == Token::ATTRIBUTE && tokens[index].value == "columnar") {
+            result_table.use_column_layout();
+        } else if (tokens[index].type == Token::ATTRIBUTE) {
+            throw BadQuery("Bad query: " + std::string(tokens[index].value) + " is not a table attribute");
+        }
+    }
+
     return result_table;
 }
 
-memdb::Table::row memdb::insert_row(const std::vector<Token>& tokens, Table& table) {
-    Table::row new_row;
-    std::vector<Table::column_value> row_values(table.info_row.size(), std::monostate{});
+std::vector<std::vector<memdb::ValueSource>> memdb::parse_insert_tuples(const std::vector<Token>& tokens,
+                                                                      const Table& table) {
+    std::vector<std::vector<ValueSource>> tuples;
+
+    auto parse_source = [&table](const Token& token, size_t column) {
+        ValueSource source;
+        if (token.type == Token::PLACEHOLDER) {
+            source.type = ValueSource::PARAMETER;
+            source.slot = token.slot;
+        } else {
+            source.type = ValueSource::LITERAL;
+            source.literal = parse_value(token.value);
+            const Table::column_info& info = table.info_row[column];
+            if (!info.column_type.accepts(source.literal)) {
+                throw BadQuery("Bad query: value " + std::string(token.value) + " doesn't fit column '" +
+                               info.name + "' of type " + info.column_type.name());
+            }
+        }
+        return source;
+    };
+
+    auto expect_more = [&tokens](size_t index) {
+        if (index >= tokens.size()) {
+            throw BadQuery("Bad query: unexpected end of insert");
+        }
+    };
 
     size_t index = 1;
-    if (tokens[index].value != "(") {
-        throw BadQuery("Bad query: expected '(' after insert");
-    }
-    ++index;
+    while (true) {
+        expect_more(index);
+        if (tokens[index].value != "(") {
+            throw BadQuery("Bad query: expected '(' after insert");
+        }
+        ++index;
 
-    size_t col_idx = 0;
-    bool named_mode = false;
+        std::vector<ValueSource> sources(table.info_row.size());
+        size_t col_idx = 0;
+        bool named_mode = false;
 
-    while (tokens[index].value != ")") {
-        if (tokens[index].type == Token::FIELD_NAME) {
-            named_mode = true;
-            std::string column_name = tokens[index].value;
-            ++index;
+        while (expect_more(index), tokens[index].value != ")") {
+            if (tokens[index].type == Token::FIELD_NAME) {
+                named_mode = true;
+                std::string_view column_name = tokens[index].value;
+                ++index;
 
-            if (tokens[index].value != "=") {
-                throw BadQuery("Bad query: expected '=' after column name");
-            }
-            ++index;
+                expect_more(index);
+                if (tokens[index].value != "=") {
+                    throw BadQuery("Bad query: expected '=' after column name");
+                }
+                ++index;
 
-            auto target_idx = static_cast<size_t>(-1);
-            for (size_t i = 0; i < table.info_row.size(); ++i) {
-                if (table.info_row[i].name == column_name) {
-                    target_idx = i;
-                    break;
+                size_t target_idx = table.column_position(column_name);
+                if (target_idx == static_cast<size_t>(-1)) {
+                    throw BadQuery("Bad query: column '" + std::string(column_name) + "' not found in table");
                 }
-            }
 
-            if (target_idx == static_cast<size_t>(-1)) {
-                throw BadQuery("Bad query: column '" + column_name + "' not found in table");
+                expect_more(index);
+                sources[target_idx] = parse_source(tokens[index], target_idx);
+                ++index;
+            } else if (!named_mode) {
+                if (tokens[index].value == ",") {
+                    ++col_idx;
+                } else {
+                    if (col_idx >= table.info_row.size()) {
+                        throw BadQuery("Bad query: too many values provided");
+                    }
+                    sources[col_idx] = parse_source(tokens[index], col_idx);
+                    ++col_idx;
+                }
+                ++index;
+            } else {
+                throw BadQuery("Bad query: mixed positional and named parameters in insert");
             }
 
-            row_values[target_idx] = parse_value(tokens[index].value);
-            ++index;
-        } else if (!named_mode) {
-            if (tokens[index].value == ",") {
-                ++col_idx;
-            } else {
-                if (col_idx >= table.info_row.size()) {
-                    throw BadQuery("Bad query: too many values provided");
-                }
-                row_values[col_idx] = parse_value(tokens[index].value);
-                ++col_idx;
+            if (index < tokens.size() && tokens[index].value == ",") {
+                ++index;
             }
-            ++index;
-        } else {
-            throw BadQuery("Bad query: mixed positional and named parameters in insert");
         }
+        ++index;
+        tuples.push_back(std::move(sources));
 
-        if (tokens[index].value == ",") {
+        // insert (...), (...) to <table>
+        if (index < tokens.size() && tokens[index].value == ",") {
             ++index;
+            continue;
         }
+        break;
     }
 
-    for (size_t i = 0; i < table.info_row.size(); ++i) {
-        if (std::holds_alternative<std::monostate>(row_values[i])) {
-            if (table.info_row[i].autoincrement) {
-                row_values[i] = table.info_row[i].auto_increment_counter++;
-            } else if (!std::holds_alternative<std::monostate>(table.info_row[i].default_value)) {
-                row_values[i] = table.info_row[i].default_value;
-            } else {
-                throw BadQuery("Bad query: missing value for column '" + table.info_row[i].name + "'");
-            }
-        }
+    return tuples;
+}
 
-        const std::regex type_regex(R"(^(string|bytes)\[(\d+)\]$)");
-        std::smatch match;
+std::vector<memdb::ValueSource> memdb::parse_insert(const std::vector<Token>& tokens, const Table& table) {
+    auto tuples = parse_insert_tuples(tokens, table);
+    if (tuples.size() != 1) {
+        throw BadQuery("Bad query: expected a single row in insert");
+    }
+    return std::move(tuples[0]);
+}
 
-        if (std::regex_match(table.info_row[i].type, match, type_regex)) {
-            size_t max_length = std::stoul(match[2]); // Извлекаем X из типа
-            if (match[1] == "string") {
-                if (auto str_val = std::get_if<std::string>(&row_values[i])) {
-                    if (str_val->size() > max_length) {
-                        throw BadQuery("Bad query: string value too long for column '" + table.info_row[i].name + "'");
-                    }
-                }
-            } else if (match[1] == "bytes") {
-                if (auto bytes_val = std::get_if<std::vector<uint8_t>>(&row_values[i])) {
-                    if (bytes_val->size() > max_length) {
-                        throw BadQuery("Bad query: byte sequence too long for column '" + table.info_row[i].name + "'");
-                    }
-                }
+memdb::Table::row memdb::build_row(const std::vector<ValueSource>& sources, const Parameters& params, Table& table) {
+    Table::row new_row;
+    new_row.values.assign(table.info_row.size(), std::monostate{});
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].type == ValueSource::LITERAL) {
+            new_row.values[i] = sources[i].literal;
+        } else if (sources[i].type == ValueSource::PARAMETER) {
+            if (sources[i].slot >= params.size()) {
+                throw BadQuery("Bad query: parameter " + std::to_string(sources[i].slot) + " is not bound");
             }
+            new_row.values[i] = params[sources[i].slot];
         }
+    }
+    return new_row;
+}
 
+memdb::Table::row memdb::insert_row(const std::vector<Token>& tokens, Table& table) {
+    std::vector<Table::row> batch{build_row(parse_insert(tokens, table), {}, table)};
+    table.prepare_rows(batch);
+    return std::move(batch[0]);
+}
 
-        if (table.info_row[i].key || table.info_row[i].unique) {
-            for (const auto& existing_row : table.rows) {
-                if (existing_row.values[i] == row_values[i]) {
-                    throw BadQuery("Bad query: duplicate value for unique or key column '" + table.info_row[i].name + "'");
-                }
+const memdb::Table::column_info& memdb::find_column_info(const Table& table, std::string_view field_name) {
+    return table.info_row[find_column_index(table, field_name)];
+}
+
+size_t memdb::find_column_index(const Table& table, std::string_view field_name) {
+    size_t index = table.column_position(field_name);
+    if (index == static_cast<size_t>(-1)) {
+        throw BadQuery("Bad query: Field '" + std::string(field_name) + "' not found in table '" + table.name + "'");
+    }
+    return index;
+}
+
+memdb::Table& memdb::Database::find_table(std::string_view table_name) {
+    // Таблицы, добавленные в tables в обход add_table, ищем перебором
+    if (catalog.size() != tables.size()) {
+        for (auto& table : tables) {
+            if (table.name == table_name) {
+                return table;
             }
         }
+    } else if (auto position = catalog.find(std::string(table_name)); position != catalog.end()) {
+        return *position->second;
     }
-
-    new_row.values = std::move(row_values);
-    return new_row;
+    throw BadQuery("Bad query: Table '" + std::string(table_name) + "' not found.");
 }
 
-std::vector<memdb::Token> memdb::prepare_condition(const std::vector<Token>& tokens) {
-    size_t where_index = 0;
-    bool found_where = false;
-
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        if (to_lower(tokens[i].value) == "where") {
-            where_index = i;
-            found_where = true;
-            break;
-        }
+memdb::Table& memdb::Database::add_table(Table table) {
+    if (catalog.count(table.name) != 0) {
+        throw BadQuery("Bad query: table " + table.name + " already exists");
     }
+    Table& added = tables.emplace_back(std::move(table));
+    catalog.emplace(added.name, &added);
+    plan_cache.clear();
+    return added;
+}
 
-    if (!found_where) {
-        throw BadQuery("Bad query: 'where' clause not found in select query");
+void memdb::Database::create_index(const std::vector<Token> &tokens) {
+    // create index <name> on <table> ( <column> )
+    if (tokens.size() != 8 || tokens[2].type != Token::FIELD_NAME || !iequals(tokens[3].value, "on") ||
+        tokens[4].type != Token::TABLE_NAME || tokens[5].value != "(" || tokens[6].type != Token::FIELD_NAME ||
+        tokens[7].value != ")") {
+        throw BadQuery("Bad query: expected create index <name> on <table>(<column>)");
     }
 
-    std::vector<Token> condition_tokens(tokens.begin() + where_index + 1, tokens.end());
+    for (const auto &table: tables) {
+        for (const auto &index: table.ordered_indexes) {
+            if (index.name == tokens[2].value) {
+                throw BadQuery("Bad query: index " + index.name + " already exists");
+            }
+        }
+    }
 
-    return condition_tokens;
+    Table &table = find_table(tokens[4].value);
+    table.add_ordered_index(std::string(tokens[2].value), find_column_index(table, tokens[6].value));
+    plan_cache.clear();
 }
 
-bool memdb::variant_to_bool(Table::column_value variant) {
-    if (auto* value = std::get_if<int>(&variant)) {
-        return *value != 0;
-    }
-    if (auto* value = std::get_if<std::string>(&variant)) {
-        return value->empty();
-    }
-    if (auto* value = std::get_if<std::vector<uint8_t>>(&variant)) {
-        return value->empty();
+void memdb::Database::bulk_insert(std::string_view table_name, std::vector<Table::row> batch) {
+    auto lock = write_lock();
+    Table &table = find_table(table_name);
+    std::string record;
+    if (wal != nullptr) {
+        // Пишем строки до подстановки autoincrement, чтобы при повторе счётчики сдвинулись так же
+        record = WriteAheadLog::encode_bulk_insert(table_name, batch);
     }
-    if (auto* value = std::get_if<bool>(&variant)) {
-        return *value;
+    begin_write(table);
+    table.bulk_load(std::move(batch));
+    if (wal != nullptr) {
+        wal->append(WriteAheadLog::BULK_INSERT, record);
     }
-    throw BadQuery("Bad query: something wrong with condition part");
 }
 
-bool memdb::evaluate_condition(const std::vector<memdb::Token>& condition,
-                               const Table::row& row, const std::vector<Table::column_info>& info_row) {
-
-    if (condition.empty()) {
-        throw BadQuery("Bad query: empty condition");
+void memdb::Database::open_wal(const std::string &path, WriteAheadLog::Options options) {
+    if (wal != nullptr) {
+        throw BadQuery("Bad query: log is already open");
     }
-
-    if (condition.size() == 1) {
-        if (condition[0].type == Token::FIELD_NAME) {
-            for (size_t i = 0; i < info_row.size(); ++i) {
-                if (info_row[i].name == condition[0].value) {
-                    return variant_to_bool(row.values[i]);
-                }
-            }
-            throw BadQuery("Bad query: field name not found in condition");
+    // После загрузки снимка или закрытия журнала его начало уже применено, повторяется только хвост
+    size_t valid_end = WriteAheadLog::replay(path, [this](const WriteAheadLog::Record &record) {
+        if (record.type == WriteAheadLog::BULK_INSERT) {
+            bulk_insert(record.text, record.rows);
+        } else if (record.params.empty()) {
+            execute(record.text);
         } else {
-            throw BadQuery("Bad query: invalid single-token condition");
+            PreparedStatement statement = prepare(record.text);
+            statement.params = record.params;
+            statement.execute();
         }
+    }, log_position);
+    if (valid_end < log_position) {
+        throw StorageError("Storage error: " + path + " ends before the position of the loaded snapshot");
     }
+    wal = std::make_unique<WriteAheadLog>(path, options, valid_end);
+}
 
-    if (condition.size() == 3) {
-        const Token& left = condition[0];
-        const Token& op = condition[1];
-        const Token& right = condition[2];
+void memdb::Database::close_wal() {
+    if (wal != nullptr) {
+        log_position = wal->position();
+    }
+    wal.reset();
+}
 
-        if (left.type != Token::FIELD_NAME || right.type != Token::VALUE) {
-            throw BadQuery("Bad query: invalid condition format");
-        }
+memdb::WriteAheadLog *memdb::Database::wal_log() const {
+    return wal.get();
+}
 
-        size_t column_index = -1;
-        for (size_t i = 0; i < info_row.size(); ++i) {
-            if (info_row[i].name == left.value) {
-                column_index = i;
-                break;
-            }
-        }
+void memdb::Database::log_statement(std::string_view text, const Parameters &params) {
+    if (wal != nullptr) {
+        wal->append(WriteAheadLog::STATEMENT, WriteAheadLog::encode_statement(text, params));
+    }
+}
 
-        if (column_index == static_cast<size_t>(-1)) {
-            throw BadQuery("Bad query: column not found in condition");
-        }
+void memdb::Database::set_parallelism(size_t threads) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    this->threads = std::max<size_t>(threads, 1);
+    if (pool != nullptr && pool->size() != this->threads - 1) {
+        pool = nullptr; // Старый пул остановится, когда его отпустит последнее сканирование
+    }
+}
 
-        const Table::column_value& column_value = row.values[column_index];
-        Table::column_value parsed_value = parse_value(right.value);
-
-        if (op.value == "==") {
-            return column_value == parsed_value;
-        } else if (op.value == "!=") {
-            return column_value != parsed_value;
-        } else if (op.value == "<") {
-            return column_value < parsed_value;
-        } else if (op.value == ">") {
-            return column_value > parsed_value;
-        } else if (op.value == "<=") {
-            return column_value <= parsed_value;
-        } else if (op.value == ">=") {
-            return column_value >= parsed_value;
-        } else {
-            throw BadQuery("Bad query: unsupported operator in condition");
-        }
+size_t memdb::Database::parallelism() const {
+    return threads.load();
+}
+
+std::shared_ptr<memdb::ThreadPool> memdb::Database::thread_pool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (pool == nullptr) {
+        pool = std::make_shared<ThreadPool>(threads - 1);
     }
+    return pool;
+}
 
-    // Сложные условия с логическими операторами
-    for (size_t i = 0; i < condition.size(); ++i) {
-        if (condition[i].type == Token::OPERATOR) {
-            if (condition[i].value == "&&") {
-                auto left_condition = std::vector<Token>(condition.begin(), condition.begin() + i);
-                auto right_condition = std::vector<Token>(condition.begin() + i + 1, condition.end());
-                return evaluate_condition(left_condition, row, info_row) &&
-                       evaluate_condition(right_condition, row, info_row);
-            } else if (condition[i].value == "||") {
-                auto left_condition = std::vector<Token>(condition.begin(), condition.begin() + i);
-                auto right_condition = std::vector<Token>(condition.begin() + i + 1, condition.end());
-                return evaluate_condition(left_condition, row, info_row) ||
-                       evaluate_condition(right_condition, row, info_row);
-            }
-        }
+memdb::ScanOptions memdb::Database::scan_options(const Table &table, uint64_t version) {
+    ScanOptions options;
+    options.threshold = parallel_threshold;
+    options.morsel_size = morsel_size;
+    options.version = version;
+    if (threads > 1 && table.size() >= parallel_threshold) {
+        options.pool = thread_pool();
     }
+    return options;
+}
 
-    throw BadQuery("Bad query: unsupported condition");
+memdb::ReadView::ReadView(Database &db) : db(&db) {
+    // Версия читается под тем же мьютексом, что и регистрация: иначе delete между ними
+    // мог бы не увидеть этот снимок и уплотнить строки, которые ему ещё нужны
+    std::lock_guard<std::mutex> lock(db.views_mutex);
+    at = db.current_version.load();
+    db.active_views.insert(at);
 }
 
+memdb::ReadView::~ReadView() {
+    std::lock_guard<std::mutex> lock(db->views_mutex);
+    db->active_views.erase(db->active_views.find(at));
+}
 
-std::vector<bool> memdb::check_condition(const std::vector<memdb::Token>& condition, Table& table) {
-    std::vector<bool> results;
-    for (size_t i = 0; i < table.rows.size(); ++i) {
-        bool matches = evaluate_condition(condition, table.rows[i], table.info_row);
-        results.push_back(matches);
-    }
+uint64_t memdb::ReadView::version() const {
+    return at;
+}
 
-    return results;
+memdb::Database &memdb::ReadView::database() const {
+    return *db;
 }
 
-memdb::Table::column_info memdb::find_column_info(const Table& table, const std::string& field_name) {
-    for (const auto& col : table.info_row) {
-        if (col.name == field_name) {
-            return col;
-        }
-    }
-    throw BadQuery("Bad query: Field '" + field_name + "' not found in table '" + table.name + "'");
+std::shared_ptr<const memdb::ReadView> memdb::Database::read_view() {
+    return std::make_shared<ReadView>(*this);
 }
 
-size_t memdb::find_column_index(const Table& table, const std::string& field_name) {
-    for (size_t i = 0; i < table.info_row.size(); ++i) {
-        if (table.info_row[i].name == field_name) {
-            return i;
-        }
+uint64_t memdb::Database::version() const {
+    return current_version.load();
+}
+
+bool memdb::Database::has_read_views() {
+    std::lock_guard<std::mutex> lock(views_mutex);
+    return !active_views.empty();
+}
+
+std::shared_lock<std::shared_mutex> memdb::Database::read_lock() const {
+    {
+        std::lock_guard<std::mutex> gate(turnstile);
     }
-    throw BadQuery("Bad query: Field '" + field_name + "' not found in table '" + table.name + "'");
+    return std::shared_lock<std::shared_mutex>(mutex);
 }
 
+std::unique_lock<std::shared_mutex> memdb::Database::write_lock() {
+    std::lock_guard<std::mutex> gate(turnstile);
+    return std::unique_lock<std::shared_mutex>(mutex);
+}
 
+void memdb::Database::begin_write(Table &table) {
+    table.write_version = ++current_version;
+}
 
-memdb::Table& memdb::Database::find_table(const std::string& table_name) {
-    for (auto& table : tables) {
-        if (table.name == table_name) {
-            return table;
-        }
+void memdb::Database::maybe_compact(Table &table) {
+    if (table.needs_compaction() && !has_read_views()) {
+        table.compact();
     }
-    throw BadQuery("Bad query: Table '" + table_name + "' not found.");
 }
 
-void memdb::Database::execute(const std::string &str) {
+size_t memdb::Database::collect_garbage() {
+    auto lock = write_lock();
+    if (has_read_views()) {
+        return 0;
+    }
+    size_t reclaimed = 0;
+    for (auto &table: tables) {
+        reclaimed += table.dead_rows;
+        table.compact();
+    }
+    return reclaimed;
+}
 
+memdb::PreparedStatement memdb::Database::prepare(const std::string &str) {
     std::vector<Token> tokens = tokenize(str);
     check_syntax(tokens);
 
@@ -396,106 +501,233 @@ void memdb::Database::execute(const std::string &str) {
         throw BadQuery("Bad query: too short query");
     }
 
-    if (to_lower(tokens[0].value) == "create") {
-        tables.emplace_back(create_table(tokens));
+    auto lock = read_lock();
+    PreparedStatement statement(*this, tokens);
+    statement.text = str;
+    return statement;
+}
+
+namespace {
+    // Отрезает следующее слово запроса, пропуская пробелы перед ним
+    std::string_view next_word(std::string_view &text) {
+        size_t begin = text.find_first_not_of(" \t\r\n");
+        if (begin == std::string_view::npos) {
+            text = {};
+            return {};
+        }
+        size_t end = text.find_first_of(" \t\r\n", begin);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        std::string_view word = text.substr(begin, end - begin);
+        text.remove_prefix(end);
+        return word;
+    }
+
+    // Если запрос начинается с explain analyze, возвращает true и оставляет в query сам запрос
+    bool strip_explain_analyze(std::string_view &query) {
+        std::string_view rest = query;
+        if (!memdb::iequals(next_word(rest), "explain") || !memdb::iequals(next_word(rest), "analyze")) {
+            return false;
+        }
+        query = rest;
+        return true;
     }
-    else if (to_lower(tokens[0].value) == "insert") {
 
-        if ((tokens.end() - 1)->type == Token::TABLE_NAME) {
-            bool flag = false;
-            for (auto &table: tables) {
-                if (table.name == (tokens.end() - 1)->value) {
-                    Table::row row = insert_row(tokens, table);
-                    table.rows.emplace_back(row);
-                    flag = true;
-                    break;
-                }
+    // Текст запроса, в котором литералы заменены на ?, и сами литералы по порядку.
+    // false, если запрос не из тех, что выполняются через план
+    bool normalize_query(const std::vector<memdb::Token> &tokens, std::string &shape,
+                         std::vector<std::string_view> &literals) {
+        if (tokens.size() < 2 || !(memdb::iequals(tokens[0].value, "select") ||
+                                   memdb::iequals(tokens[0].value, "insert") ||
+                                   memdb::iequals(tokens[0].value, "delete"))) {
+            return false;
+        }
+        for (const auto &token: tokens) {
+            if (token.type == memdb::Token::PLACEHOLDER) {
+                return false;
             }
-            if (!flag) {
-                throw BadQuery("Bad query: " + (tokens.end() - 1)->value + " name doesn't except");
+            if (!shape.empty()) {
+                shape += ' ';
             }
-        } else {
-            for (const auto &token: tokens) {
-                std::cout << "Value: " << token.value << ", Type: " << tokenTypeToString(token.type) << std::endl;
+            if (token.type == memdb::Token::VALUE) {
+                shape += '?';
+                literals.push_back(token.value);
+            } else {
+                shape += token.value;
             }
-            throw BadQuery("Bad query: insert query without table name");
         }
+        return true;
     }
-    else if (to_lower(tokens[0].value) == "select") {
-        std::string table_name;
-        bool flag = false;
 
-        for (const auto& token: tokens) {
-            if (token.type == Token::TABLE_NAME) {
-                table_name = token.value;
-                flag = true;
-                break;
-            }
+    memdb::Table explain_table(const std::vector<std::string> &lines) {
+        memdb::Table result;
+        result.name = "explain";
+        size_t width = 2;
+        for (const auto &line: lines) {
+            width = std::max(width, line.size() + 2);
         }
-        if (!flag) {
-            throw BadQuery("Bad query: select query without table name");
+        result.info_row.emplace_back(false, false, false, "plan", "string[" + std::to_string(width) + "]",
+                                     std::monostate{});
+        result.rebuild_catalog();
+        for (const auto &line: lines) {
+            result.rows.push_back({{'"' + line + '"'}});
         }
+        result.deleted.resize(result.rows.size());
+        return result;
+    }
+}
 
-        Table source_table = find_table(table_name);
+memdb::ResultSet memdb::Database::execute(const std::string &str) {
+    return execute(str, nullptr);
+}
 
-        std::vector<std::string> select_fields;
-        for (const auto& token: tokens) {
-            if (token.type == Token::FIELD_NAME) {
-                select_fields.emplace_back(token.value);
-            }
-            if (to_lower(token.value) == "from") {
-                break;
-            }
+std::shared_ptr<const memdb::PreparedStatement> memdb::Database::make_plan(const std::vector<Token> &tokens,
+                                                                           const std::string &shape,
+                                                                           size_t literal_count) {
+    std::vector<Token> parametrized = tokens;
+    size_t slot = 0;
+    for (auto &token: parametrized) {
+        if (token.type == Token::VALUE) {
+            token.type = Token::PLACEHOLDER;
+            token.value = "?";
+            token.slot = slot++;
         }
+    }
 
-        std::vector<bool> check_results = check_condition(prepare_condition(tokens), source_table);
+    std::shared_ptr<PreparedStatement> plan;
+    try {
+        plan.reset(new PreparedStatement(*this, parametrized));
+    }
+    catch (BadQuery &) {
+        // Литерал стоит там, где параметр не допускается: такую форму выполняем без плана
+        return nullptr;
+    }
+    // Каждый литерал должен стать значением колонки, иначе план изменил бы смысл запроса
+    if (plan->parameter_count() != literal_count) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < literal_count; ++i) {
+        if (plan->parameter_columns[i] == static_cast<size_t>(-1) && !plan->count_parameter(i)) {
+            return nullptr;
+        }
+    }
+    plan->text = shape;
+    return plan;
+}
 
-        Table new_table;
-        new_table.name = "select_table";
+memdb::Cursor memdb::Database::query(const std::string &str, const std::shared_ptr<const ReadView> &view) {
+    std::vector<Token> tokens = tokenize(str);
+    check_syntax(tokens);
+    if (!iequals(tokens[0].value, "select")) {
+        throw BadQuery("Bad query: only select can open a cursor");
+    }
+    auto lock = read_lock();
+    PreparedStatement statement(*this, tokens);
+    statement.text = str;
+    return statement.open_cursor({}, view);
+}
 
-        for (const auto & field_name : select_fields) {
-            Table::column_info col_info = find_column_info(source_table, field_name);
-            new_table.info_row.push_back(col_info);
-        }
+memdb::ResultSet memdb::Database::execute(const std::string &str, QueryStats &stats) {
+    return execute(str, nullptr, &stats);
+}
 
-        for (size_t i = 0; i < source_table.rows.size(); ++i) {
-            if (check_results[i]) {
-                Table::row new_row;
-                for (const auto & select_field : select_fields) {
-                    size_t col_idx = find_column_index(source_table, select_field);
-                    new_row.values.push_back(source_table.rows[i].values[col_idx]);
-                }
-                new_table.rows.push_back(new_row);
-            }
+memdb::ResultSet memdb::Database::execute(const std::string &str, const std::shared_ptr<const ReadView> &view,
+                                          QueryStats *stats) {
+    std::string_view query = str;
+    if (strip_explain_analyze(query)) {
+#ifndef MEMDB_PROFILING
+        throw BadQuery("Bad query: explain analyze needs a build with MEMDB_PROFILING");
+#endif
+        QueryStats analyzed;
+        ResultSet result = execute(std::string(query), view, &analyzed);
+        if (result.source() != nullptr) {
+            analyzed.start();
+            Table copy = result.materialize();
+            analyzed.lap(QueryStats::MATERIALIZE);
+            analyzed.values_copied += copy.rows.size() * copy.info_row.size();
+            analyzed.bytes_allocated += copy.rows.size() * copy.info_row.size() * sizeof(Table::column_value);
         }
-
-        tables.push_back(new_table);
+        if (stats != nullptr) {
+            *stats = analyzed;
+        }
+        return ResultSet(explain_table(analyzed.report()));
     }
-    else if (to_lower(tokens[0].value) == "delete") {
-        std::string table_name;
-        if (tokens[1].type == Token::TABLE_NAME) {
-            table_name = tokens[1].value;
+
+    MEMDB_PROFILE_START(stats);
+    std::vector<Token> tokens = tokenize(str);
+    MEMDB_PROFILE_LAP(stats, TOKENIZE);
+
+    std::string shape;
+    std::vector<std::string_view> literals;
+    if (plan_cache.capacity() != 0 && normalize_query(tokens, shape, literals)) {
+        bool read_only = iequals(tokens[0].value, "select");
+        if (!read_only && view != nullptr) {
+            throw BadQuery("Bad query: only select can run on a snapshot");
+        }
+        // План ищется под блокировкой: иначе загрузка снимка могла бы заменить таблицы между поиском и запуском
+        std::shared_lock<std::shared_mutex> shared;
+        std::unique_lock<std::shared_mutex> exclusive;
+        if (read_only) {
+            shared = read_lock();
         } else {
-            throw BadQuery("Bad query: query without table name");
+            exclusive = write_lock();
         }
 
-        Table& target_table = find_table(table_name);
+        bool known = false;
+        std::shared_ptr<const PreparedStatement> plan = plan_cache.find(shape, known);
+        if (!known) {
+            check_syntax(tokens);
+            plan = make_plan(tokens, shape, literals.size());
+            plan_cache.insert(shape, plan);
+        }
+        MEMDB_PROFILE_LAP(stats, PREPARE);
+        if (plan != nullptr) {
+            Parameters values;
+            values.reserve(literals.size());
+            for (size_t i = 0; i < literals.size(); ++i) {
+                values.push_back(parse_value(literals[i]));
+                plan->check_parameter(i, values.back(), literals[i]);
+            }
+            return plan->run(values, view, stats);
+        }
+        // Форму нельзя выполнить через план: обычный путь под уже взятой блокировкой
+        PreparedStatement statement(*this, tokens);
+        statement.text = str;
+        return statement.run({}, view, stats);
+    }
+
+    check_syntax(tokens);
+    MEMDB_PROFILE_LAP(stats, CHECK_SYNTAX);
 
-        auto condition = prepare_condition(tokens);
+    if (tokens.size() < 2) {
+        throw BadQuery("Bad query: too short query");
+    }
 
-        auto check_results = check_condition(condition, target_table);
+    if (iequals(tokens[0].value, "select")) {
+        auto lock = read_lock();
+        PreparedStatement statement(*this, tokens);
+        statement.text = str;
+        MEMDB_PROFILE_LAP(stats, PREPARE);
+        return statement.run({}, view, stats);
+    }
+    if (view != nullptr) {
+        throw BadQuery("Bad query: only select can run on a snapshot");
+    }
 
-        auto it = target_table.rows.begin();
-        size_t index = 0;
-        while (it != target_table.rows.end()) {
-            if (check_results[index]) {
-                it = target_table.rows.erase(it);
-            } else {
-                ++it;
-            }
-            ++index;
-        }
+    auto lock = write_lock();
+    if (iequals(tokens[0].value, "create") && iequals(tokens[1].value, "index")) {
+        create_index(tokens);
+        log_statement(str, {});
+    } else if (iequals(tokens[0].value, "create")) {
+        add_table(create_table(tokens));
+        log_statement(str, {});
     } else {
-        throw BadQuery("Bad query: unknown query");
+        PreparedStatement statement(*this, tokens);
+        statement.text = str;
+        MEMDB_PROFILE_LAP(stats, PREPARE);
+        return statement.run({}, nullptr, stats);
     }
+    MEMDB_PROFILE_LAP(stats, EXECUTE);
+    return {};
 }
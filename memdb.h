@@ -3,6 +3,24 @@
 #include <vector>
 #include <variant>
 #include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <set>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <chrono>
 
 namespace memdb {
 
@@ -17,52 +35,258 @@ namespace memdb {
             VALUE,
             SYMBOL,
             ATTRIBUTE,
+            PLACEHOLDER,
             UNDEFINED
         };
 
         token_type type = UNDEFINED;
-        std::string value;
+        std::string_view value; // Срез исходного текста запроса
+        size_t slot = 0; // Номер параметра для PLACEHOLDER
     };
 
     std::string tokenTypeToString(Token::token_type type);
 
-    std::string trim(const std::string &str);
+    std::string_view trim(std::string_view str);
 
-    std::vector<std::string> splitIntoTokens(const std::string &str);
+    std::vector<std::string_view> splitIntoTokens(std::string_view str);
 
-    std::string to_lower(const std::string &str);
+    std::string to_lower(std::string_view str);
 
-    std::vector<Token> tokenize(const std::string &str);
+    bool iequals(std::string_view lhs, std::string_view rhs);
+
+    // Токены ссылаются на str, поэтому строка запроса должна пережить результат
+    std::vector<Token> tokenize(std::string_view str);
+
+    // Упакованный битовый массив: bool-колонки, маски валидности и выборки строк
+    struct Bitmap {
+        std::vector<uint64_t> words;
+        size_t bits = 0;
+
+        void push_back(bool value) {
+            if (bits % 64 == 0) {
+                words.push_back(0);
+            }
+            set(bits++, value);
+        }
+
+        [[nodiscard]] bool get(size_t index) const {
+            return (words[index / 64] >> (index % 64)) & 1u;
+        }
+
+        void set(size_t index, bool value) {
+            if (value) {
+                words[index / 64] |= uint64_t(1) << (index % 64);
+            } else {
+                words[index / 64] &= ~(uint64_t(1) << (index % 64));
+            }
+        }
+
+        [[nodiscard]] size_t size() const {
+            return bits;
+        }
+
+        void resize(size_t size, bool value = false);
+
+        void clear();
+    };
 
     struct Table {
 
         using column_value = std::variant<std::monostate, int, std::string, bool, std::vector<uint8_t>>;
 
+        // Тип колонки, разобранный один раз при создании таблицы
+        struct ColumnType {
+            enum type_kind {
+                INT32,
+                BOOL,
+                STRING,
+                BYTES
+            };
+
+            type_kind kind = INT32;
+            uint32_t max_length = 0; // N из string[N] и bytes[N]; строка считается вместе с кавычками
+            uint32_t width = 4;      // Байт на значение при хранении фиксированной ширины
+
+            static ColumnType parse(std::string_view type);
+
+            // Подходит ли значение по типу; пустое значение подходит всегда
+            [[nodiscard]] bool matches(const column_value &value) const;
+
+            // Подходит ли значение по типу и длине
+            [[nodiscard]] bool accepts(const column_value &value) const;
+
+            [[nodiscard]] std::string name() const;
+        };
+
         struct column_info {
             bool autoincrement = false;
             bool unique = false;
             bool key = false;
+            bool dictionary = false; // {dict}: в колоночной таблице значения хранятся кодами словаря
             std::string name;
             std::string type;
+            ColumnType column_type;
             column_value default_value = std::monostate{};
             int auto_increment_counter = 0;
 
             column_info(bool key, bool unique, bool autoincrement, std::string name, std::string type,
                         column_value default_value) :
                     autoincrement(autoincrement), unique(unique), key(key),
-                    name(std::move(name)), type(std::move(type)), default_value(std::move(default_value)) {}
+                    name(std::move(name)), type(std::move(type)), column_type(ColumnType::parse(this->type)),
+                    default_value(std::move(default_value)) {}
         };
 
         struct row {
             std::vector<column_value> values;
         };
 
+        enum storage_layout {
+            ROW_LAYOUT,
+            COLUMN_LAYOUT
+        };
+
+        // Колонка в колоночном хранилище: типизированный непрерывный массив и маска валидности
+        struct Column {
+            using column_kind = ColumnType::type_kind;
+            static constexpr column_kind INT32 = ColumnType::INT32;
+            static constexpr column_kind BOOL = ColumnType::BOOL;
+            static constexpr column_kind STRING = ColumnType::STRING;
+            static constexpr column_kind BYTES = ColumnType::BYTES;
+
+            // string[N] и bytes[N] с N не больше этого хранятся прямо в слотах, остальные в arena
+            static constexpr uint32_t INLINE_LIMIT = 32;
+
+            column_kind kind = INT32;
+            std::vector<int32_t> ints;
+            Bitmap bools;
+            std::vector<char> arena; // Данные string/bytes подряд
+            std::vector<uint32_t> offsets{0}; // Значение i лежит в arena[offsets[i], offsets[i + 1])
+            uint32_t slot_width = 0; // 0, если данные в arena, иначе N + 1: байт длины и N байт с нулями в хвосте
+            std::vector<char> slots; // Слот i лежит в slots[i * slot_width, (i + 1) * slot_width)
+            uint32_t code_width = 0; // 0 без словаря, иначе 1, 2 или 4 байта на код
+            std::vector<uint8_t> codes; // Код строки i лежит в codes[i * code_width, (i + 1) * code_width)
+            std::vector<std::string> dictionary; // Значение по коду; код 0 — пустое значение, им же кодируется null
+            std::unordered_map<std::string, uint32_t> dictionary_codes;
+            Bitmap validity;
+            size_t null_count = 0;
+
+            explicit Column(column_kind kind) : kind(kind) {}
+
+            explicit Column(const column_info &info);
+
+            // Подходит ли значение колонке такого типа; пустое значение подходит всегда
+            static bool accepts(column_kind kind, const column_value &value);
+
+            void append(const column_value &value);
+
+            [[nodiscard]] column_value get(size_t index) const;
+
+            [[nodiscard]] std::string_view view(size_t index) const;
+
+            [[nodiscard]] uint32_t code(size_t index) const;
+
+            // Код значения в словаре или -1, если такого значения в колонке нет
+            [[nodiscard]] int64_t find_code(std::string_view value) const;
+
+            // Пересобирает dictionary_codes и ширину кода по загруженному словарю
+            void rebuild_dictionary();
+
+            [[nodiscard]] size_t size() const;
+
+            void reserve(size_t size);
+
+            void erase(const Bitmap &selection);
+        };
+
+        struct ValueHash {
+            size_t operator()(const column_value &value) const;
+        };
+
+        // Хеш-индекс колонки key/unique: значение -> номер строки
+        struct HashIndex {
+            size_t column = 0;
+            std::unordered_map<column_value, size_t, ValueHash> positions;
+        };
+
+        // Упорядоченный вторичный индекс из create index: значение -> номера строк
+        struct OrderedIndex {
+            std::string name;
+            size_t column = 0;
+            std::multimap<column_value, size_t> entries;
+        };
+
         std::string name;
         std::vector<column_info> info_row;
-        std::vector<row> rows;
+        std::vector<row> rows; // Строки при ROW_LAYOUT
+        storage_layout layout = ROW_LAYOUT;
+        std::vector<Column> columns; // Колонки при COLUMN_LAYOUT
+        std::unordered_map<std::string, size_t> column_positions; // Имя колонки -> номер в info_row
+        std::vector<HashIndex> hash_indexes;
+        std::vector<OrderedIndex> ordered_indexes;
+
+        Bitmap deleted; // Надгробия: строка удалена, но ещё физически лежит в хранилище
+        size_t dead_rows = 0;
+
+        // Версии строк для чтения по снимку: строка видна в версии v, если created <= v < deleted
+        static constexpr uint64_t LIVE_VERSION = std::numeric_limits<uint64_t>::max();
+        std::vector<uint64_t> created_versions;
+        std::vector<uint64_t> deleted_versions;
+        uint64_t write_version = 0; // Версия, которой помечаются следующие вставки и удаления
+        double compaction_threshold = 0.25; // Доля мёртвых строк, после которой delete запускает compact
+        size_t compactions = 0;
+
+        void use_column_layout();
+
+        // Пересобирает column_positions после изменения info_row
+        void rebuild_catalog();
+
+        // Номер колонки по имени (с учётом регистра) или -1
+        [[nodiscard]] size_t column_position(std::string_view column_name) const;
+
+        [[nodiscard]] const HashIndex *hash_index(size_t column_index) const;
+
+        [[nodiscard]] const OrderedIndex *ordered_index(size_t column_index) const;
+
+        void add_ordered_index(const std::string &index_name, size_t column_index);
+
+        // Пересобирает хеш-индексы колонок key/unique и содержимое упорядоченных индексов
+        void rebuild_indexes();
+
+        // Число строк в хранилище, включая ещё не вычищенные удалённые
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] size_t live_size() const;
+
+        [[nodiscard]] bool is_live(size_t row_index) const;
+
+        [[nodiscard]] column_value get(size_t row_index, size_t column_index) const;
+
+        [[nodiscard]] row get_row(size_t row_index) const;
 
         void add_row(const row &row);
 
+        // Подставляет autoincrement и значения по умолчанию, проверяет типы, длины и key/unique
+        // сразу для всей пачки. Если хоть одна строка не подходит, таблица и счётчики autoincrement не меняются
+        void prepare_rows(std::vector<row> &batch);
+
+        // Добавляет пачку строк с одной проверкой на пачку и заранее зарезервированной памятью
+        void bulk_load(std::vector<row> batch);
+
+        void append_columns(const row &row);
+
+        // Удаляет отмеченные строки за один линейный проход
+        void erase_rows(const Bitmap &selection);
+
+        // Помечает строки удалёнными в write_version; вычищает их compact, когда это разрешит Database
+        void delete_rows(const Bitmap &selection);
+
+        [[nodiscard]] bool needs_compaction() const;
+
+        [[nodiscard]] bool visible(size_t row_index, uint64_t version) const;
+
+        // Физически вычищает удалённые строки и перестраивает индексы
+        void compact();
+
         struct ValuePrinter {
             void operator()(const std::monostate &) const;
 
@@ -79,31 +303,804 @@ namespace memdb {
 
     };
 
-    Table::column_value parse_value(const std::string &raw_value);
+    Table::column_value parse_value(std::string_view raw_value);
 
     Table create_table(const std::vector<Token> &tokens);
 
+    using Parameters = std::vector<Table::column_value>;
+
+    // Откуда берётся значение колонки при вставке
+    struct ValueSource {
+        enum source_type {
+            MISSING,
+            LITERAL,
+            PARAMETER
+        };
+
+        source_type type = MISSING;
+        Table::column_value literal = std::monostate{};
+        size_t slot = 0;
+    };
+
+    std::vector<ValueSource> parse_insert(const std::vector<Token>& tokens, const Table& table);
+
+    // Подставляет литералы и параметры; пропущенные значения остаются пустыми до Table::prepare_rows
+    Table::row build_row(const std::vector<ValueSource>& sources, const Parameters& params, Table& table);
+
     Table::row insert_row(const std::vector<Token>& tokens, Table& table);
 
+    // Кортежи insert (...), (...), ... to <table>
+    std::vector<std::vector<ValueSource>> parse_insert_tuples(const std::vector<Token>& tokens, const Table& table);
+
     std::vector<Token> prepare_condition(const std::vector<Token>& tokens);
 
-    bool variant_to_bool(Table::column_value variant);
+    bool variant_to_bool(const Table::column_value& variant);
+
+    // Условие where, скомпилированное один раз на запрос: дерево в плоском массиве узлов
+    struct Predicate {
+        enum node_type {
+            COLUMN,
+            COMPARE,
+            AND,
+            OR
+        };
+
+        enum compare_op {
+            EQ,
+            NE,
+            LT,
+            GT,
+            LE,
+            GE
+        };
+
+        struct Node {
+            node_type type = COLUMN;
+            compare_op op = EQ;
+            size_t column = 0;
+            size_t left = 0;
+            size_t right = 0;
+            bool parameter = false;
+            size_t slot = 0;
+            Table::column_value constant = std::monostate{};
+        };
+
+        std::vector<Node> nodes;
+        size_t root = 0;
+        size_t parameter_count = 0;
+
+        void check_parameters(const Parameters& params) const;
+
+        [[nodiscard]] bool evaluate(const Table::row& row, const Parameters& params = {}) const;
+
+    private:
+        [[nodiscard]] bool evaluate_node(size_t index, const Table::row& row, const Parameters& params) const;
+    };
+
+    Predicate compile_condition(const std::vector<Token>& condition, const std::vector<Table::column_info>& info_row);
+
+    bool compare_values(Predicate::compare_op op, const Table::column_value& lhs, const Table::column_value& rhs);
+
+    // Набор инструкций для векторных фильтров; по умолчанию выбирается лучший доступный на машине
+    enum filter_isa {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    filter_isa best_filter_isa();
+
+    bool filter_isa_supported(filter_isa isa);
+
+    // Сравнивает count значений с константой; бит j слова out[j / 64] равен результату для values[j]
+    void compare_int32(const int32_t* values, size_t count, Predicate::compare_op op, int32_t constant,
+                       uint64_t* out, filter_isa isa = best_filter_isa());
+
+    // Если условие сводится к равенству по хеш-индексу, кладёт найденную строку в row_ids и возвращает true
+    bool lookup_indexed_row(const Predicate& predicate, const Table& table, const Parameters& params,
+                            uint64_t version, std::vector<size_t>& row_ids);
+
+    // Дописывает в row_ids подходящие и видимые в версии version строки из [begin, end); begin кратно 64
+    void collect_rows(const Predicate& predicate, const Table& table, const Parameters& params, uint64_t version,
+                      size_t begin, size_t end, std::vector<size_t>& row_ids);
+
+    // Вычисляет условие на строках [begin, end) в битовую маску out; begin кратно 64
+    void filter_rows(const Predicate& predicate, const Table& table, const Parameters& params,
+                     size_t begin, size_t end, uint64_t* out);
+
+    // Ключ order by
+    struct SortKey {
+        size_t column = 0;
+        bool descending = false;
+    };
+
+    // Упорядочивает row_ids по ключам и оставляет первые limit. null меньше любого значения,
+    // равные по ключам строки идут в порядке row_ids. Один ключ int32/bool сортируется поразрядно,
+    // остальные — по нормализованным ключам; при limit намного меньше числа строк — отбор через кучу
+    void sort_rows(const Table& table, std::vector<size_t>& row_ids, const std::vector<SortKey>& keys,
+                   size_t limit = std::numeric_limits<size_t>::max());
+
+    // Пул потоков для параллельного сканирования. Задачи раздаются по одной через атомарный счётчик,
+    // так что поток, закончивший лёгкий кусок, сразу берёт следующий
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads);
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        [[nodiscard]] size_t size() const;
+
+        // Вызывает job(i) для всех i из [0, count) на потоках пула и вызывающем потоке, ждёт завершения.
+        // Первое брошенное исключение пробрасывается вызывающему
+        void parallel_for(size_t count, const std::function<void(size_t)>& job);
+
+    private:
+        void worker_loop();
+
+        void run_tasks();
+
+        std::vector<std::thread> workers;
+        std::mutex run_mutex; // Одновременно выполняется только один parallel_for
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(size_t)>* job = nullptr;
+        size_t task_count = 0;
+        std::atomic<size_t> next_task{0};
+        size_t busy = 0;
+        uint64_t generation = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+    };
+
+    struct ScanOptions {
+        std::shared_ptr<ThreadPool> pool; // Сканирование держит пул, даже если set_parallelism заменит его
+        size_t threshold = 1 << 16;   // Таблицы меньше порога сканируются в одном потоке
+        size_t morsel_size = 1 << 14; // Строк в одной задаче, округляется до кратного 64
+        uint64_t version = Table::LIVE_VERSION; // Снимок, строки которого видны; по умолчанию — текущие
+    };
+
+    Bitmap check_condition(const Predicate& predicate, const Table& table, const Parameters& params = {},
+                           const ScanOptions& options = {});
+
+    Bitmap check_condition(const std::vector<Token>& condition, Table& table, const Parameters& params = {});
+
+    // Элемент списка select с агрегатами: колонка из group by или агрегатная функция
+    struct Aggregate {
+        enum function {
+            VALUE,
+            COUNT,
+            SUM,
+            MIN,
+            MAX,
+            AVG
+        };
+
+        function kind = VALUE;
+        size_t column = static_cast<size_t>(-1); // -1 у count(*)
+    };
+
+    // Группирует строки row_ids по group_columns и считает aggregates: строка результата на группу
+    // в порядке первого появления, без group by — ровно одна строка. null пропускаются; sum и avg
+    // считаются в int64 и дают int32 (avg с отбрасыванием дробной части), min и max сохраняют тип колонки.
+    // На больших входах с пулом в options группы разбиваются по хешу на независимые части
+    Table aggregate_rows(const Table& table, const std::vector<size_t>& row_ids,
+                         const std::vector<size_t>& group_columns, const std::vector<Aggregate>& aggregates,
+                         const ScanOptions& options = {});
+
+    const Table::column_info& find_column_info(const Table& table, std::string_view field_name);
+
+    size_t find_column_index(const Table& table, std::string_view field_name);
+
+    // Значение int32 или bool (как 0 и 1) без копирования variant; false для null
+    bool read_int(const Table& table, size_t row_index, size_t column_index, int32_t& out);
+
+    // Значение string или bytes без копирования, у строк без кавычек; false для null
+    bool read_bytes(const Table& table, size_t row_index, size_t column_index, std::string_view& out);
+
+    bool evaluate_condition(const std::vector<Token>& condition, const Table::row& row,
+                            const std::vector<Table::column_info>& info_row, const Parameters& params = {});
+
+    struct Database;
+
+    // Версия базы, которую видит читатель. Пока есть хоть один живой ReadView, удалённые строки
+    // не вычищаются, поэтому номера строк в ResultSet остаются верными
+    class ReadView {
+    public:
+        // Снимок текущей версии базы
+        explicit ReadView(Database &db);
+
+        ~ReadView();
+
+        ReadView(const ReadView&) = delete;
+
+        ReadView& operator=(const ReadView&) = delete;
+
+        [[nodiscard]] uint64_t version() const;
+
+        [[nodiscard]] Database &database() const;
+
+    private:
+        Database* db;
+        uint64_t at;
+    };
+
+    // Статистика одного запроса для explain analyze и execute(..., QueryStats&).
+    // Собирается только в сборке с MEMDB_PROFILING; без него макросы ниже ничего не делают
+    struct QueryStats {
+        enum stage {
+            TOKENIZE,
+            CHECK_SYNTAX,
+            PREPARE,     // prepare_condition, компиляция условия и разрешение имён
+            SCAN,        // check_condition
+            EXECUTE,     // Сбор номеров строк, вставка или удаление
+            MATERIALIZE, // Копирование значений результата, только в explain analyze
+            STAGE_COUNT
+        };
+
+        std::chrono::nanoseconds stage_time[STAGE_COUNT]{};
+        size_t rows_scanned = 0;
+        size_t rows_matched = 0;
+        size_t values_copied = 0;
+        size_t bytes_allocated = 0; // Оценка по буферам запроса: битмап, номера строк, скопированные значения
+
+        static const char *stage_name(stage value);
+
+        // Начинает отсчёт следующего этапа
+        void start();
+
+        // Записывает время с прошлой отметки в этап
+        void lap(stage value);
+
+        [[nodiscard]] std::chrono::nanoseconds total_time() const;
+
+        // Отчёт по строке на этап и счётчик, как в explain analyze
+        [[nodiscard]] std::vector<std::string> report() const;
+
+    private:
+        std::chrono::steady_clock::time_point mark;
+    };
+
+#ifdef MEMDB_PROFILING
+#define MEMDB_PROFILE_START(stats) do { if (stats) (stats)->start(); } while (false)
+#define MEMDB_PROFILE_LAP(stats, stage) do { if (stats) (stats)->lap(memdb::QueryStats::stage); } while (false)
+#define MEMDB_PROFILE_COUNT(stats, counter, amount) do { if (stats) (stats)->counter += (amount); } while (false)
+#else
+#define MEMDB_PROFILE_START(stats) do { (void) (stats); } while (false)
+#define MEMDB_PROFILE_LAP(stats, stage) do { (void) (stats); } while (false)
+#define MEMDB_PROFILE_COUNT(stats, counter, amount) do { (void) (stats); } while (false)
+#endif
+
+    // Результат select: номера строк исходной таблицы и список колонок, значения не копируются.
+    // При чтении значений берёт разделяемую блокировку базы, так что его можно читать параллельно
+    // с писателями. Действителен, пока жива база. Снимок держит только результат select на явном
+    // read_view(): такой не мешает читать удалённые после него строки, но и не даёт их вычистить.
+    // Остальные результаты уплотнение не задерживают; после уплотнения их таблицы чтение бросает BadQuery
+    class ResultSet {
+    public:
+        ResultSet() = default;
+
+        // Результат над собственной таблицей, например отчёт explain analyze: все строки и колонки
+        explicit ResultSet(Table owned);
+
+        ResultSet(Database &db, const Table &source, std::vector<size_t> row_ids, std::vector<size_t> projection,
+                  std::shared_ptr<const ReadView> view = nullptr);
+
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] bool empty() const;
+
+        [[nodiscard]] size_t column_count() const;
 
-    std::vector<bool> check_condition(const std::vector<Token>& condition, Table& table);
+        [[nodiscard]] const Table::column_info &column(size_t column_index) const;
 
-    Table::column_info find_column_info(const Table& table, const std::string& field_name);
+        [[nodiscard]] size_t row_id(size_t row_index) const;
 
-    size_t find_column_index(const Table& table, const std::string& field_name);
+        [[nodiscard]] const Table *source() const;
 
-    bool evaluate_condition(const std::vector<Token>& condition, const Table::row& row, const std::vector<Table::column_info>& info_row);
+        [[nodiscard]] const std::shared_ptr<const ReadView> &view() const;
+
+        // Копирует одно значение
+        [[nodiscard]] Table::column_value get(size_t row_index, size_t column_index) const;
+
+        // Копирует весь результат в отдельную таблицу "select_table"
+        [[nodiscard]] Table materialize() const;
+
+        void print() const;
+
+    private:
+        [[nodiscard]] std::shared_lock<std::shared_mutex> lock() const;
+
+        // Номера строк ещё верны: снимок держится или таблицу с тех пор не уплотняли
+        void check_rows() const;
+
+        Database *db = nullptr;
+        std::shared_ptr<const Table> owned_table;
+        const Table *table = nullptr;
+        std::vector<size_t> rows;
+        std::vector<size_t> columns;
+        std::shared_ptr<const ReadView> read_view;
+        size_t compactions = 0; // Table::compactions на момент select
+    };
+
+    // Хеш-соединение по равенству left_column == right_column среди строк left_rows и right_rows.
+    // Таблица строится по меньшему входу, второй просматривается по мере чтения пар, так что
+    // пары идут в порядке его строк. Строки с пустым ключом ни с чем не соединяются
+    class HashJoin {
+    public:
+        HashJoin(const Table &left, std::vector<size_t> left_rows, size_t left_column,
+                 const Table &right, std::vector<size_t> right_rows, size_t right_column);
+
+        // Следующая пара строк; false, когда пары кончились
+        bool next(size_t &left_row, size_t &right_row);
+
+        // Сколько строк второго входа уже просмотрено
+        [[nodiscard]] size_t rows_probed() const;
+
+    private:
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        // Хеш ключа; false, если ключ пустой
+        bool hash_key(const Table &table, size_t row_index, size_t column, uint64_t &hash) const;
+
+        [[nodiscard]] bool keys_equal(size_t build_row, size_t probe_row) const;
+
+        const Table *build_table;
+        const Table *probe_table;
+        size_t build_column;
+        size_t probe_column;
+        bool build_left;
+        bool integer_keys;
+        std::vector<size_t> build_rows;
+        std::vector<size_t> probe_rows;
+        std::vector<uint32_t> heads;       // Первая строка цепочки по младшим битам хеша
+        std::vector<uint32_t> chain;       // Следующая строка той же цепочки
+        std::vector<uint64_t> build_hashes; // Полный хеш, чтобы не сравнивать ключи зря
+        size_t probe_position = 0;
+        uint64_t probe_hash = 0;
+        uint32_t candidate = NONE;
+    };
+
+    // Потоковое чтение результата select. Условие проверяется кусками по мере чтения, поэтому limit
+    // или раннее завершение не сканируют остаток таблицы; с order by строки отбираются и сортируются
+    // при открытии. Держит ReadView всё время чтения и берёт разделяемую блокировку базы на каждый вызов
+    class Cursor {
+    public:
+        Cursor() = default;
+
+        [[nodiscard]] size_t column_count() const;
+
+        [[nodiscard]] const Table::column_info &column(size_t column_index) const;
+
+        // Значения колонок следующей строки; false, когда строки кончились
+        bool next(Table::row &row);
+
+        // До count следующих строк; меньше count — только в конце результата
+        std::vector<Table::row> next_batch(size_t count);
+
+        // Номер следующей строки исходной таблицы без копирования значений
+        bool next_row_id(size_t &row_id);
+
+        // Сколько строк таблицы уже проверено
+        [[nodiscard]] size_t rows_scanned() const;
+
+    private:
+        friend class PreparedStatement;
+
+        static constexpr size_t FIRST_CHUNK = 1024; // Первый кусок мал, чтобы limit 1 не платил за большой скан
+        static constexpr size_t MAX_CHUNK = 1 << 16;
+
+        [[nodiscard]] std::shared_lock<std::shared_mutex> lock() const;
+
+        // Следующая строка без блокировки: вызывающий уже держит её
+        bool advance(size_t &row_id);
+
+        // Следующая пара строк join без блокировки
+        bool advance_pair(size_t &left_row, size_t &right_row);
+
+        // Значения колонок следующей строки результата без блокировки
+        bool read_next(Table::row &row);
+
+        bool fill();
+
+        const Table *table = nullptr;
+        Predicate predicate;
+        Parameters params;
+        std::vector<size_t> projection;
+        std::shared_ptr<const ReadView> read_view;
+        size_t position = 0; // Следующая непроверенная строка таблицы
+        size_t end = 0;      // Строки, добавленные после открытия курсора, снимку всё равно не видны
+        size_t chunk = FIRST_CHUNK;
+        size_t skip = 0;     // Сколько подходящих строк ещё пропустить из-за offset
+        size_t remaining = std::numeric_limits<size_t>::max();
+        bool index_checked = false;
+        std::vector<size_t> pending;
+        size_t pending_index = 0;
+        size_t scanned = 0;
+        std::shared_ptr<const Table> owned_table; // Результат агрегации, который курсор держит сам
+        // select с join: номера в projection сквозные, сначала колонки table, затем right_table
+        const Table *right_table = nullptr;
+        std::shared_ptr<HashJoin> join;
+        std::vector<Table::column_info> join_info;
+        Predicate join_filter; // Часть условия, которая зависит от обеих таблиц
+        bool filtered = false;
+    };
+
+    // Двоичная сериализация для журнала и снимков: little-endian, строки и байты с длиной u32
+    class BinaryWriter {
+    public:
+        std::string buffer;
+
+        void u8(uint8_t value);
+
+        void u32(uint32_t value);
+
+        void u64(uint64_t value);
+
+        void raw(const void* data, size_t size);
+
+        void string(std::string_view value);
+
+        void value(const Table::column_value& value);
+    };
+
+    // Бросает StorageError, если данных не хватает
+    class BinaryReader {
+    public:
+        BinaryReader(const char* data, size_t size);
+
+        uint8_t u8();
+
+        uint32_t u32();
+
+        uint64_t u64();
+
+        const char* raw(size_t size);
+
+        std::string string();
+
+        Table::column_value value();
+
+        [[nodiscard]] bool at_end() const;
+
+    private:
+        const char* data;
+        size_t size;
+        size_t offset = 0;
+    };
+
+    uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+    // Журнал изменений: create/insert/delete пишутся после успешного выполнения и повторяются при восстановлении.
+    // Формат записи: длина u32, crc32 u32, тип u8, данные
+    class WriteAheadLog {
+    public:
+        enum sync_policy {
+            SYNC_ALWAYS, // fsync после каждой записи
+            SYNC_GROUP,  // fsync пачкой: раз в group_records записей или не позже group_interval после записи
+            SYNC_OFF     // Только write в ОС
+        };
+
+        struct Options {
+            sync_policy policy = SYNC_GROUP;
+            size_t group_records = 64;
+            std::chrono::milliseconds group_interval{10};
+        };
+
+        enum record_type : uint8_t {
+            STATEMENT = 1,  // Текст запроса и значения параметров
+            BULK_INSERT = 2 // Имя таблицы и строки до подстановки autoincrement
+        };
+
+        struct Record {
+            record_type type = STATEMENT;
+            std::string text; // Запрос или имя таблицы
+            Parameters params;
+            std::vector<Table::row> rows;
+        };
+
+        // Открывает файл на дозапись, отбрасывая всё после valid_end (недописанный хвост).
+        // При SYNC_GROUP запускает поток, который делает fsync, когда group_interval истёк без новых записей
+        WriteAheadLog(const std::string& path, Options options, size_t valid_end);
+
+        // Останавливает поток сброса и сбрасывает оставшиеся записи
+        ~WriteAheadLog();
+
+        WriteAheadLog(const WriteAheadLog&) = delete;
+
+        WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+        static std::string encode_statement(std::string_view text, const Parameters& params);
+
+        static std::string encode_bulk_insert(std::string_view table_name, const std::vector<Table::row>& rows);
+
+        void append(record_type type, const std::string& payload);
+
+        // Сбрасывает буфер в файл и делает fsync
+        void sync();
+
+        [[nodiscard]] size_t records() const;
+
+        [[nodiscard]] size_t syncs() const;
+
+        // Смещение в файле за последней добавленной записью, включая ещё не записанные из буфера
+        [[nodiscard]] size_t position() const;
+
+        // Вызывает apply для каждой целой записи, начинающейся не раньше from, и возвращает конец последней
+        // из них; 0, если файла нет. Записи до from только проверяются: их изменения уже есть в снимке
+        static size_t replay(const std::string& path, const std::function<void(const Record&)>& apply,
+                             size_t from = 0);
+
+    private:
+        void write_buffer();
+
+        void sync_locked();
+
+        void flush_loop();
+
+        int fd = -1;
+        Options options;
+        std::string buffer;
+        size_t pending = 0;
+        std::chrono::steady_clock::time_point last_sync;
+        size_t record_count = 0;
+        size_t sync_count = 0;
+        size_t end = 0;
+        mutable std::mutex mutex; // Поля выше делят append и поток сброса
+        std::condition_variable wakeup;
+        bool stopping = false;
+        std::thread flusher;
+    };
+
+    // Разобранный и проверенный запрос insert/select/delete с параметрами ?
+    class PreparedStatement {
+    public:
+        enum statement_type {
+            INSERT,
+            SELECT,
+            DELETE
+        };
+
+        // Параметры нумеруются с нуля в порядке появления ? в запросе
+        void bind(size_t index, int value);
+
+        void bind(size_t index, bool value);
+
+        // Строка хранится так же, как строковый литерал запроса, то есть в кавычках
+        void bind(size_t index, std::string_view value);
+
+        void bind(size_t index, const char* value);
+
+        void bind(size_t index, std::vector<uint8_t> value);
+
+        void bind_value(size_t index, Table::column_value value);
+
+        void clear_bindings();
+
+        [[nodiscard]] size_t parameter_count() const;
+
+        [[nodiscard]] statement_type type() const;
+
+        ResultSet execute();
+
+        // select по заданному снимку базы; stats, если задан, получает статистику выполнения
+        ResultSet execute(const std::shared_ptr<const ReadView> &view, QueryStats *stats = nullptr);
+
+        // Курсор по select; view задаёт снимок, по умолчанию — текущее состояние
+        Cursor query(const std::shared_ptr<const ReadView> &view = nullptr);
+
+    private:
+        friend struct Database;
+
+        PreparedStatement(Database& db, const std::vector<Token>& tokens);
+
+        ResultSet run(const Parameters& params, std::shared_ptr<const ReadView> view = nullptr,
+                      QueryStats *stats = nullptr) const;
+
+        // Бросает BadQuery, если значение не подходит колонке параметра. literal — текст литерала, из которого
+        // параметр сделал кеш планов: с ним сообщение то же, что при разборе запроса без кеша
+        void check_parameter(size_t index, const Table::column_value &value, std::string_view literal = {}) const;
+
+        // Параметр задаёт limit или offset, а не значение колонки
+        [[nodiscard]] bool count_parameter(size_t index) const;
+
+        // Разбирает limit N [offset M] или offset M в конце select и отрезает их от токенов
+        void parse_limit(std::vector<Token> &tokens);
+
+        // Разбирает order by <колонка> [asc|desc], ... после условия и отрезает его от токенов
+        void parse_order(std::vector<Token> &tokens);
+
+        // Разбирает список select с агрегатными функциями и group by <колонка>, ...
+        void parse_aggregates(std::vector<Token> &tokens);
+
+        // select с агрегатами: группы, затем order by, offset и limit над результатом
+        Table run_aggregate(const Parameters& values, uint64_t version, QueryStats *stats) const;
+
+        // Разбирает from a join b on a.x == b.y: проекцию, условие соединения и условие where,
+        // которое делится на части для каждой таблицы и часть над парами строк
+        void parse_join(const std::vector<Token> &tokens);
+
+        // Сквозной номер колонки a.x, b.y или уникального без таблицы имени в запросе с join
+        [[nodiscard]] size_t join_column(std::string_view name) const;
+
+        Cursor open_cursor(const Parameters& values, std::shared_ptr<const ReadView> view) const;
+
+        Database* db;
+        std::string text; // Для журнала
+        statement_type kind;
+        Table* table;
+        std::vector<std::vector<ValueSource>> tuples;
+        std::vector<size_t> projection;
+        ValueSource limit; // MISSING — без ограничения
+        ValueSource offset;
+        std::vector<SortKey> order;
+        std::vector<Aggregate> aggregates; // Непуст, если в select есть агрегаты или group by
+        std::vector<size_t> group_columns;
+        Table* join_table = nullptr; // Правая таблица join; condition тогда относится к левой
+        size_t join_left_column = 0;
+        size_t join_right_column = 0;
+        std::vector<Table::column_info> join_info; // Колонки обеих таблиц с именами <таблица>.<колонка>
+        Predicate right_condition;
+        Predicate join_condition;
+        bool left_filtered = false;
+        bool right_filtered = false;
+        bool join_filtered = false;
+        Predicate condition;
+        Parameters params;
+        std::vector<size_t> parameter_columns; // Колонка, с которой сравнивается или в которую пишется параметр
+    };
+
+    // LRU-кеш разобранных запросов. Ключ — нормализованный текст запроса, в котором литералы заменены на ?,
+    // поэтому запросы, отличающиеся только константами, разделяют один план
+    class PlanCache {
+    public:
+        explicit PlanCache(size_t capacity = 256);
+
+        // План формы запроса; nullptr, если форма не закеширована или её нельзя выполнить через план.
+        // known сообщает, встречалась ли форма раньше
+        std::shared_ptr<const PreparedStatement> find(const std::string &shape, bool &known);
+
+        // plan == nullptr запоминает, что форму кешировать нельзя, чтобы не пытаться снова
+        void insert(const std::string &shape, std::shared_ptr<const PreparedStatement> plan);
+
+        // Сбрасывается при изменении схемы: планы держат указатели на таблицы и номера колонок
+        void clear();
+
+        // 0 отключает кеш
+        void set_capacity(size_t capacity);
+
+        [[nodiscard]] size_t capacity() const;
+
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] size_t hits() const;
+
+        [[nodiscard]] size_t misses() const;
+
+    private:
+        using entry = std::pair<std::string, std::shared_ptr<const PreparedStatement>>;
+
+        void evict();
+
+        mutable std::mutex mutex;
+        size_t limit;
+        std::list<entry> entries; // Спереди — недавно использованные
+        std::unordered_map<std::string, std::list<entry>::iterator> positions;
+        std::atomic<size_t> hit_count{0};
+        std::atomic<size_t> miss_count{0};
+    };
 
     struct Database {
-        std::vector<Table> tables;
+        // deque, чтобы ссылки на таблицы в PreparedStatement не инвалидировались
+        std::deque<Table> tables;
+        PlanCache plan_cache; // Планы для execute; сбрасывается при create table/index и загрузке снимка
+        std::unordered_map<std::string, Table*> catalog; // Имя таблицы -> таблица в tables
+
+        size_t parallel_threshold = 1 << 16;
+        size_t morsel_size = 1 << 14;
+
+        // Число потоков для сканирования вместе с вызывающим; 1 отключает параллельность.
+        // Пул с новым числом потоков заменяет старый, идущие сканирования доработают на старом
+        void set_parallelism(size_t threads);
+
+        [[nodiscard]] size_t parallelism() const;
+
+        // Пул создаётся при первом параллельном сканировании
+        std::shared_ptr<ThreadPool> thread_pool();
+
+        [[nodiscard]] ScanOptions scan_options(const Table &table, uint64_t version = Table::LIVE_VERSION);
+
+        Table& find_table(std::string_view table_name);
+
+        // Добавляет таблицу в каталог, BadQuery при занятом имени; ссылки на уже созданные таблицы
+        // остаются действительными
+        Table& add_table(Table table);
+
+        void create_index(const std::vector<Token> &tokens);
+
+        PreparedStatement prepare(const std::string &str);
+
+        // Для select возвращает результат, для остальных запросов — пустой ResultSet.
+        // select выполняются параллельно друг с другом, изменения — по одному.
+        // explain analyze <запрос> выполняет запрос и возвращает отчёт по этапам в колонке plan
+        ResultSet execute(const std::string &str);
+
+        // select по снимку: видит базу такой, какой она была при создании view
+        ResultSet execute(const std::string &str, const std::shared_ptr<const ReadView> &view,
+                          QueryStats *stats = nullptr);
+
+        // То же, что execute(str), и статистика выполнения в stats
+        ResultSet execute(const std::string &str, QueryStats &stats);
+
+        // Курсор по select: строки читаются по одной или пачками, скан идёт по мере чтения.
+        // select поддерживает order by и limit N [offset M] и через execute, и через query
+        Cursor query(const std::string &str, const std::shared_ptr<const ReadView> &view = nullptr);
+
+        [[nodiscard]] std::shared_ptr<const ReadView> read_view();
+
+        [[nodiscard]] uint64_t version() const;
+
+        // Вычищает удалённые строки из всех таблиц, если их не видит ни один ReadView; возвращает число строк
+        size_t collect_garbage();
+
+        void bulk_insert(std::string_view table_name, std::vector<Table::row> batch);
+
+        // Повторяет существующий журнал в этой базе и дальше пишет в него все изменения
+        void open_wal(const std::string &path, WriteAheadLog::Options options = {});
+
+        void close_wal();
+
+        // Двоичный снимок всех таблиц; удалённые строки не сохраняются. С открытым журналом сбрасывает его
+        // и запоминает позицию в нём: open_wal после load_snapshot повторит только записи после неё
+        void save_snapshot(const std::string &path) const;
+
+        // Загружает таблицы снимка в пустую базу, до open_wal; в базу с таблицами не загружает.
+        // Колонки копируются из отображённого файла целыми массивами
+        void load_snapshot(const std::string &path, bool verify_checksums = true);
+
+        [[nodiscard]] WriteAheadLog *wal_log() const;
+
+    private:
+        friend class PreparedStatement;
+        friend class ReadView;
+        friend class ResultSet;
+        friend class Cursor;
+
+        void log_statement(std::string_view text, const Parameters &params);
+
+        // План для формы запроса из execute: литералы заменены параметрами; nullptr, если так нельзя
+        std::shared_ptr<const PreparedStatement> make_plan(const std::vector<Token> &tokens, const std::string &shape,
+                                                           size_t literal_count);
+
+        // Следующая версия для изменения таблицы; вызывается под исключительной блокировкой
+        void begin_write(Table &table);
+
+        // Уплотняет таблицу после delete, если это никому не помешает
+        void maybe_compact(Table &table);
+
+        [[nodiscard]] bool has_read_views();
 
-        Table& find_table(const std::string& table_name);
+        // Писатель, ждущий блокировку, держит турникет, и новые читатели встают за ним:
+        // иначе поток select'ов мог бы не пустить писателя никогда
+        [[nodiscard]] std::shared_lock<std::shared_mutex> read_lock() const;
 
-        void execute(const std::string &str);
+        [[nodiscard]] std::unique_lock<std::shared_mutex> write_lock();
 
+        mutable std::mutex turnstile;
+        mutable std::shared_mutex mutex;
+        std::atomic<uint64_t> current_version{0};
+        std::mutex views_mutex;
+        std::multiset<uint64_t> active_views;
+        std::mutex pool_mutex;
+        std::shared_ptr<ThreadPool> pool;
+        std::atomic<size_t> threads{std::max(1u, std::thread::hardware_concurrency())};
+        std::unique_ptr<WriteAheadLog> wal;
+        size_t log_position = 0; // Изменения журнала до этого смещения уже есть в таблицах
+        mutable std::mutex snapshot_mutex; // Снимки пишутся по одному: каждый сбрасывает журнал
     };
 }
 
@@ -0,0 +1,75 @@
+#include <utility>
+#include "memdb.h"
+
+
+memdb::PlanCache::PlanCache(size_t capacity) : limit(capacity) {}
+
+std::shared_ptr<const memdb::PreparedStatement> memdb::PlanCache::find(const std::string &shape, bool &known) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto position = positions.find(shape);
+    known = position != positions.end();
+    if (!known) {
+        ++miss_count;
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, position->second);
+    if (position->second->second != nullptr) {
+        ++hit_count;
+    } else {
+        ++miss_count;
+    }
+    return position->second->second;
+}
+
+void memdb::PlanCache::insert(const std::string &shape, std::shared_ptr<const PreparedStatement> plan) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (limit == 0) {
+        return;
+    }
+    auto position = positions.find(shape);
+    if (position != positions.end()) {
+        position->second->second = std::move(plan);
+        entries.splice(entries.begin(), entries, position->second);
+        return;
+    }
+    entries.emplace_front(shape, std::move(plan));
+    positions.emplace(shape, entries.begin());
+    evict();
+}
+
+void memdb::PlanCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    positions.clear();
+}
+
+void memdb::PlanCache::set_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = capacity;
+    evict();
+}
+
+size_t memdb::PlanCache::capacity() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return limit;
+}
+
+size_t memdb::PlanCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+size_t memdb::PlanCache::hits() const {
+    return hit_count;
+}
+
+size_t memdb::PlanCache::misses() const {
+    return miss_count;
+}
+
+void memdb::PlanCache::evict() {
+    while (entries.size() > limit) {
+        positions.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
@@ -0,0 +1,147 @@
+#include <array>
+#include <cstring>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+namespace {
+    // Таблицы для crc32 по 8 байт за шаг (slicing-by-8)
+    using crc_tables = std::array<std::array<uint32_t, 256>, 8>;
+
+    constexpr crc_tables make_crc_tables() {
+        crc_tables tables{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            tables[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t t = 1; t < 8; ++t) {
+                tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+            }
+        }
+        return tables;
+    }
+
+    constexpr crc_tables crc_table = make_crc_tables();
+}
+
+uint32_t memdb::crc32(const void *data, size_t size, uint32_t crc) {
+    auto* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t low = crc ^ (uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 |
+                              uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24);
+        crc = crc_table[7][low & 0xff] ^ crc_table[6][(low >> 8) & 0xff] ^
+              crc_table[5][(low >> 16) & 0xff] ^ crc_table[4][low >> 24] ^
+              crc_table[3][bytes[4]] ^ crc_table[2][bytes[5]] ^ crc_table[1][bytes[6]] ^ crc_table[0][bytes[7]];
+    }
+    for (size_t i = 0; i < size; ++i) {
+        crc = crc_table[0][(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void memdb::BinaryWriter::u8(uint8_t value) {
+    buffer.push_back(static_cast<char>(value));
+}
+
+void memdb::BinaryWriter::u32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void memdb::BinaryWriter::u64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        buffer.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void memdb::BinaryWriter::raw(const void *data, size_t size) {
+    buffer.append(static_cast<const char*>(data), size);
+}
+
+void memdb::BinaryWriter::string(std::string_view value) {
+    u32(static_cast<uint32_t>(value.size()));
+    raw(value.data(), value.size());
+}
+
+void memdb::BinaryWriter::value(const Table::column_value &value) {
+    // Тег — номер альтернативы в variant
+    u8(static_cast<uint8_t>(value.index()));
+    if (auto* number = std::get_if<int>(&value)) {
+        u32(static_cast<uint32_t>(*number));
+    } else if (auto* str = std::get_if<std::string>(&value)) {
+        string(*str);
+    } else if (auto* flag = std::get_if<bool>(&value)) {
+        u8(*flag ? 1 : 0);
+    } else if (auto* bytes = std::get_if<std::vector<uint8_t>>(&value)) {
+        u32(static_cast<uint32_t>(bytes->size()));
+        raw(bytes->data(), bytes->size());
+    }
+}
+
+memdb::BinaryReader::BinaryReader(const char *data, size_t size) : data(data), size(size) {}
+
+const char *memdb::BinaryReader::raw(size_t length) {
+    if (length > size - offset) {
+        throw StorageError("Storage error: unexpected end of data");
+    }
+    const char* result = data + offset;
+    offset += length;
+    return result;
+}
+
+uint8_t memdb::BinaryReader::u8() {
+    return static_cast<uint8_t>(*raw(1));
+}
+
+uint32_t memdb::BinaryReader::u32() {
+    auto* bytes = reinterpret_cast<const uint8_t*>(raw(4));
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+uint64_t memdb::BinaryReader::u64() {
+    auto* bytes = reinterpret_cast<const uint8_t*>(raw(8));
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+std::string memdb::BinaryReader::string() {
+    uint32_t length = u32();
+    return {raw(length), length};
+}
+
+memdb::Table::column_value memdb::BinaryReader::value() {
+    switch (u8()) {
+        case 0:
+            return std::monostate{};
+        case 1:
+            return static_cast<int>(u32());
+        case 2:
+            return string();
+        case 3:
+            return u8() != 0;
+        case 4: {
+            uint32_t length = u32();
+            auto* bytes = reinterpret_cast<const uint8_t*>(raw(length));
+            return std::vector<uint8_t>(bytes, bytes + length);
+        }
+        default:
+            throw StorageError("Storage error: unknown value tag");
+    }
+}
+
+bool memdb::BinaryReader::at_end() const {
+    return offset == size;
+}
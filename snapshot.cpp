@@ -0,0 +1,482 @@
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+// Снимок: заголовок, затем для каждой таблицы схема и данные по колонкам.
+// Каждый блок — длина u64, crc32 u32, выравнивание, данные с адреса, кратного 8,
+// чтобы массивы колонок копировались из отображённого файла целиком
+namespace {
+    constexpr char snapshot_magic[8] = {'M', 'E', 'M', 'D', 'B', 'S', 'N', 'P'};
+    // Версия 2: короткие string[N]/bytes[N] пишутся слотами фиксированной ширины.
+    // Версия 3: флаг dict в схеме, колонки со словарём пишутся кодами и словарём.
+    // Версия 4: в заголовке позиция журнала, до которой изменения вошли в снимок. Старые версии ещё читаем
+    constexpr uint32_t snapshot_version = 4;
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    memdb::StorageError io_error(const std::string &what) {
+        return memdb::StorageError("Storage error: " + what + ": " + std::strerror(errno));
+    }
+
+    // Пишет во временный файл рядом с целевым и подменяет целевой rename после fsync:
+    // сбой посреди записи не портит предыдущий снимок
+    class SnapshotWriter {
+    public:
+        explicit SnapshotWriter(const std::string &path) : path(path), temporary(path + ".tmp") {
+            fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw io_error("can't create " + temporary);
+            }
+        }
+
+        ~SnapshotWriter() {
+            if (fd >= 0) {
+                ::close(fd);
+                ::unlink(temporary.c_str());
+            }
+        }
+
+        SnapshotWriter(const SnapshotWriter&) = delete;
+
+        SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+        void block(const void* data, size_t size) {
+            static const char zeros[8] = {};
+            memdb::BinaryWriter header;
+            header.u64(size);
+            header.u32(memdb::crc32(data, size));
+            header.u32(0);
+            write(header.buffer.data(), header.buffer.size());
+            write(data, size);
+            write(zeros, (8 - size % 8) % 8);
+        }
+
+        template<typename T>
+        void block(const std::vector<T> &values) {
+            block(values.data(), values.size() * sizeof(T));
+        }
+
+        void finish() {
+            flush();
+            if (::fsync(fd) != 0) {
+                throw io_error("can't sync " + temporary);
+            }
+            int result = ::close(fd);
+            fd = -1;
+            if (result != 0 || ::rename(temporary.c_str(), path.c_str()) != 0) {
+                int saved = errno;
+                ::unlink(temporary.c_str());
+                errno = saved;
+                throw io_error("can't replace " + path);
+            }
+            // Переименование становится постоянным только после fsync каталога
+            std::string directory = std::filesystem::path(path).parent_path().string();
+            int directory_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+            if (directory_fd < 0) {
+                throw io_error("can't open directory of " + path);
+            }
+            result = ::fsync(directory_fd);
+            ::close(directory_fd);
+            if (result != 0) {
+                throw io_error("can't sync directory of " + path);
+            }
+        }
+
+    private:
+        static constexpr size_t buffer_limit = 1 << 20;
+
+        // Мелкие куски копятся в буфере, большие массивы колонок пишутся напрямую
+        void write(const void* data, size_t size) {
+            if (buffer.size() + size > buffer_limit) {
+                flush();
+            }
+            if (size >= buffer_limit) {
+                write_all(static_cast<const char*>(data), size);
+            } else {
+                buffer.append(static_cast<const char*>(data), size);
+            }
+        }
+
+        void flush() {
+            write_all(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+
+        void write_all(const char* data, size_t size) {
+            while (size != 0) {
+                ssize_t result = ::write(fd, data, size);
+                if (result < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw io_error("can't write " + temporary);
+                }
+                data += result;
+                size -= static_cast<size_t>(result);
+            }
+        }
+
+        std::string path;
+        std::string temporary;
+        int fd = -1;
+        std::string buffer;
+    };
+
+    class SnapshotReader {
+    public:
+        SnapshotReader(const char* data, size_t size, bool verify) : data(data), size(size), verify(verify) {}
+
+        std::string_view block() {
+            if (size - offset < 16) {
+                throw memdb::StorageError("Storage error: snapshot is truncated");
+            }
+            memdb::BinaryReader header(data + offset, 16);
+            uint64_t length = header.u64();
+            uint32_t checksum = header.u32();
+            offset += 16;
+            if (length > size - offset) {
+                throw memdb::StorageError("Storage error: snapshot is truncated");
+            }
+            std::string_view result(data + offset, length);
+            if (verify && memdb::crc32(result.data(), result.size()) != checksum) {
+                throw memdb::StorageError("Storage error: snapshot checksum mismatch");
+            }
+            offset += length + (8 - length % 8) % 8;
+            return result;
+        }
+
+        template<typename T>
+        void block(std::vector<T> &values) {
+            std::string_view bytes = block();
+            if (bytes.size() % sizeof(T) != 0) {
+                throw memdb::StorageError("Storage error: snapshot block has a wrong size");
+            }
+            auto* begin = reinterpret_cast<const T*>(bytes.data());
+            values.assign(begin, begin + bytes.size() / sizeof(T));
+        }
+
+    private:
+        const char* data;
+        size_t size;
+        size_t offset = 0;
+        bool verify;
+    };
+
+    // Живые строки таблицы в колоночном виде
+    std::vector<memdb::Table::Column> live_columns(const memdb::Table &table) {
+        std::vector<memdb::Table::Column> result;
+        if (table.layout == memdb::Table::COLUMN_LAYOUT) {
+            result = table.columns;
+            if (table.dead_rows != 0) {
+                memdb::Bitmap dead = table.deleted;
+                dead.resize(table.size());
+                for (auto &column: result) {
+                    column.erase(dead);
+                }
+            }
+            return result;
+        }
+        for (const auto &info: table.info_row) {
+            result.emplace_back(info);
+            result.back().reserve(table.live_size());
+        }
+        for (size_t i = 0; i < table.size(); ++i) {
+            if (table.is_live(i)) {
+                for (size_t j = 0; j < result.size(); ++j) {
+                    result[j].append(table.rows[i].values[j]);
+                }
+            }
+        }
+        return result;
+    }
+
+    void read_bitmap(SnapshotReader &reader, memdb::Bitmap &bitmap, size_t bits) {
+        reader.block(bitmap.words);
+        if (bitmap.words.size() != (bits + 63) / 64) {
+            throw memdb::StorageError("Storage error: snapshot bitmap has a wrong size");
+        }
+        bitmap.bits = bits;
+    }
+}
+
+void memdb::Database::save_snapshot(const std::string &path) const {
+    auto lock = read_lock();
+    std::lock_guard<std::mutex> saving(snapshot_mutex);
+    // Журнал сбрасывается на диск, чтобы позиция в снимке не указывала за его сохранённый конец
+    uint64_t position = 0;
+    if (wal != nullptr) {
+        wal->sync();
+        position = wal->position();
+    }
+    SnapshotWriter writer(path);
+
+    BinaryWriter header;
+    header.raw(snapshot_magic, sizeof(snapshot_magic));
+    header.u32(snapshot_version);
+    header.raw(&byte_order_mark, sizeof(byte_order_mark)); // Массивы пишутся в порядке байт машины
+    header.u32(static_cast<uint32_t>(tables.size()));
+    header.u64(position);
+    writer.block(header.buffer.data(), header.buffer.size());
+
+    for (const auto &table: tables) {
+        BinaryWriter schema;
+        schema.string(table.name);
+        schema.u8(table.layout);
+        schema.u64(table.live_size());
+        schema.u32(static_cast<uint32_t>(table.info_row.size()));
+        for (const auto &info: table.info_row) {
+            schema.u8(info.key);
+            schema.u8(info.unique);
+            schema.u8(info.autoincrement);
+            schema.u8(info.dictionary);
+            schema.string(info.name);
+            schema.string(info.type);
+            schema.value(info.default_value);
+            schema.u32(static_cast<uint32_t>(info.auto_increment_counter));
+        }
+        schema.u32(static_cast<uint32_t>(table.ordered_indexes.size()));
+        for (const auto &index: table.ordered_indexes) {
+            schema.string(index.name);
+            schema.u32(static_cast<uint32_t>(index.column));
+        }
+        writer.block(schema.buffer.data(), schema.buffer.size());
+
+        for (const auto &column: live_columns(table)) {
+            writer.block(column.validity.words);
+            switch (column.kind) {
+                case Table::Column::INT32:
+                    writer.block(column.ints);
+                    break;
+                case Table::Column::BOOL:
+                    writer.block(column.bools.words);
+                    break;
+                case Table::Column::STRING:
+                case Table::Column::BYTES:
+                    if (column.code_width != 0) {
+                        std::vector<uint32_t> offsets{0};
+                        std::vector<char> arena;
+                        for (const auto &value: column.dictionary) {
+                            arena.insert(arena.end(), value.begin(), value.end());
+                            offsets.push_back(static_cast<uint32_t>(arena.size()));
+                        }
+                        writer.block(column.codes);
+                        writer.block(offsets);
+                        writer.block(arena);
+                        break;
+                    }
+                    if (column.slot_width != 0) {
+                        writer.block(column.slots);
+                        break;
+                    }
+                    writer.block(column.offsets);
+                    writer.block(column.arena);
+                    break;
+            }
+        }
+    }
+    writer.finish();
+}
+
+void memdb::Database::load_snapshot(const std::string &path, bool verify_checksums) {
+    {
+        // На таблицы могут ссылаться подготовленные запросы, результаты и курсоры, поэтому их не заменяем
+        auto lock = read_lock();
+        if (!tables.empty() || wal != nullptr) {
+            throw BadQuery("Bad query: snapshot can only be loaded into an empty database before opening the log");
+        }
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw StorageError("Storage error: can't open " + path + ": " + std::strerror(errno));
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw StorageError("Storage error: can't read " + path);
+    }
+    auto size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw StorageError("Storage error: can't map " + path + ": " + std::strerror(errno));
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    std::deque<Table> loaded;
+    size_t position;
+    try {
+        SnapshotReader reader(static_cast<const char*>(mapping), size, verify_checksums);
+
+        std::string_view header_block = reader.block();
+        BinaryReader header(header_block.data(), header_block.size());
+        if (std::memcmp(header.raw(sizeof(snapshot_magic)), snapshot_magic, sizeof(snapshot_magic)) != 0) {
+            throw StorageError("Storage error: " + path + " is not a memdb snapshot");
+        }
+        uint32_t version = header.u32();
+        if (version == 0 || version > snapshot_version) {
+            throw StorageError("Storage error: unsupported snapshot version in " + path);
+        }
+        if (std::memcmp(header.raw(sizeof(byte_order_mark)), &byte_order_mark, sizeof(byte_order_mark)) != 0) {
+            throw StorageError("Storage error: snapshot was written with another byte order");
+        }
+        uint32_t table_count = header.u32();
+        position = version >= 4 ? header.u64() : 0;
+
+        for (uint32_t t = 0; t < table_count; ++t) {
+            std::string_view schema_block = reader.block();
+            BinaryReader schema(schema_block.data(), schema_block.size());
+
+            Table& table = loaded.emplace_back();
+            table.name = schema.string();
+            if (std::any_of(loaded.begin(), loaded.end() - 1, [&table](const Table &other) {
+                return other.name == table.name;
+            })) {
+                throw StorageError("Storage error: snapshot has two tables named " + table.name);
+            }
+            auto layout = static_cast<Table::storage_layout>(schema.u8());
+            size_t rows = schema.u64();
+            uint32_t column_count = schema.u32();
+            for (uint32_t i = 0; i < column_count; ++i) {
+                bool key = schema.u8() != 0;
+                bool unique = schema.u8() != 0;
+                bool autoincrement = schema.u8() != 0;
+                bool dictionary = version >= 3 && schema.u8() != 0;
+                std::string name = schema.string();
+                std::string type = schema.string();
+                Table::column_value default_value = schema.value();
+                table.info_row.emplace_back(key, unique, autoincrement, std::move(name), std::move(type),
+                                            std::move(default_value));
+                table.info_row.back().dictionary = dictionary;
+                table.info_row.back().auto_increment_counter = static_cast<int>(schema.u32());
+            }
+            std::vector<std::pair<std::string, size_t>> ordered;
+            uint32_t index_count = schema.u32();
+            for (uint32_t i = 0; i < index_count; ++i) {
+                std::string name = schema.string();
+                ordered.emplace_back(std::move(name), schema.u32());
+            }
+
+            std::vector<Table::Column> columns;
+            for (const auto &column_info: table.info_row) {
+                Table::Column &column = version == 1 ? columns.emplace_back(column_info.column_type.kind)
+                                                     : columns.emplace_back(column_info);
+                read_bitmap(reader, column.validity, rows);
+                switch (column.kind) {
+                    case Table::Column::INT32:
+                        reader.block(column.ints);
+                        break;
+                    case Table::Column::BOOL:
+                        read_bitmap(reader, column.bools, rows);
+                        break;
+                    case Table::Column::STRING:
+                    case Table::Column::BYTES:
+                        if (column.code_width != 0) {
+                            std::vector<uint32_t> offsets;
+                            std::vector<char> arena;
+                            reader.block(column.codes);
+                            reader.block(offsets);
+                            reader.block(arena);
+                            if (offsets.empty() || offsets.back() != arena.size()) {
+                                throw StorageError("Storage error: snapshot dictionary is inconsistent");
+                            }
+                            column.dictionary.clear();
+                            for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+                                if (offsets[i] > offsets[i + 1]) {
+                                    throw StorageError("Storage error: snapshot dictionary is inconsistent");
+                                }
+                                column.dictionary.emplace_back(arena.data() + offsets[i], offsets[i + 1] - offsets[i]);
+                            }
+                            column.rebuild_dictionary();
+                            if (column.dictionary.empty() || column.codes.size() != rows * column.code_width) {
+                                throw StorageError("Storage error: snapshot string column is inconsistent");
+                            }
+                            for (size_t row = 0; row < rows; ++row) {
+                                if (column.code(row) >= column.dictionary.size()) {
+                                    throw StorageError("Storage error: snapshot dictionary code is out of range");
+                                }
+                            }
+                            break;
+                        }
+                        if (column.slot_width != 0) {
+                            reader.block(column.slots);
+                            if (column.slots.size() != rows * column.slot_width) {
+                                throw StorageError("Storage error: snapshot string column is inconsistent");
+                            }
+                            // Байт длины не должен выводить за слот, даже если контрольные суммы не проверяются
+                            for (size_t row = 0; row < rows; ++row) {
+                                if (static_cast<uint8_t>(column.slots[row * column.slot_width]) >= column.slot_width) {
+                                    throw StorageError("Storage error: snapshot string slot is too long");
+                                }
+                            }
+                            break;
+                        }
+                        reader.block(column.offsets);
+                        reader.block(column.arena);
+                        // Проверки не зависят от контрольных сумм: без них испорченный файл читал бы мимо arena
+                        if (column.offsets.size() != rows + 1 || column.offsets[0] != 0 ||
+                            column.offsets.back() != column.arena.size() ||
+                            !std::is_sorted(column.offsets.begin(), column.offsets.end())) {
+                            throw StorageError("Storage error: snapshot string column is inconsistent");
+                        }
+                        break;
+                }
+                if (column.kind == Table::Column::INT32 && column.ints.size() != rows) {
+                    throw StorageError("Storage error: snapshot column has a wrong size");
+                }
+                column.null_count = rows;
+                for (uint64_t word: column.validity.words) {
+                    column.null_count -= __builtin_popcountll(word);
+                }
+            }
+
+            if (layout == Table::COLUMN_LAYOUT) {
+                table.layout = Table::COLUMN_LAYOUT;
+                table.columns = std::move(columns);
+            } else {
+                // Строковое хранилище держит variant на каждое значение, без поштучного разбора не обойтись
+                table.rows.resize(rows);
+                for (size_t i = 0; i < rows; ++i) {
+                    table.rows[i].values.reserve(columns.size());
+                    for (const auto &column: columns) {
+                        table.rows[i].values.push_back(column.get(i));
+                    }
+                }
+            }
+            table.deleted.resize(rows);
+            table.created_versions.assign(rows, 0);
+            table.deleted_versions.assign(rows, Table::LIVE_VERSION);
+            table.rebuild_catalog();
+            table.rebuild_indexes();
+            for (const auto &[name, column]: ordered) {
+                if (column >= table.info_row.size()) {
+                    throw StorageError("Storage error: snapshot index " + name + " refers to a missing column");
+                }
+                table.add_ordered_index(name, column);
+            }
+        }
+    }
+    catch (...) {
+        ::munmap(mapping, size);
+        throw;
+    }
+    ::munmap(mapping, size);
+
+    auto lock = write_lock();
+    if (!tables.empty() || wal != nullptr) {
+        throw BadQuery("Bad query: snapshot can only be loaded into an empty database before opening the log");
+    }
+    tables = std::move(loaded);
+    log_position = position;
+    catalog.clear();
+    for (auto &table: tables) {
+        catalog.emplace(table.name, &table);
+    }
+    plan_cache.clear();
+}
@@ -0,0 +1,212 @@
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
+#include "memdb.h"
+
+
+namespace {
+    // Вместо полной сортировки — отбор k первых через кучу, если k заметно меньше числа строк
+    constexpr size_t TOP_K_RATIO = 8;
+
+    bool use_top_k(size_t count, size_t total) {
+        return count < total / TOP_K_RATIO;
+    }
+
+    // int32 со сдвигом знака: беззнаковое сравнение даёт тот же порядок, что и знаковое
+    uint32_t order_bits(int32_t value) {
+        return static_cast<uint32_t>(value) ^ 0x80000000u;
+    }
+
+    // Ключ int32 или bool как беззнаковое число того же порядка
+    bool read_order_bits(const memdb::Table& table, size_t row_index, size_t column_index, uint32_t& out) {
+        int32_t value;
+        if (!memdb::read_int(table, row_index, column_index, value)) {
+            return false;
+        }
+        bool flag = table.info_row[column_index].column_type.kind == memdb::Table::ColumnType::BOOL;
+        out = flag ? static_cast<uint32_t>(value) : order_bits(value);
+        return true;
+    }
+
+    // LSD-сортировка по старшим 32 битам: по байту за проход, проход пропускается, если байт у всех одинаков.
+    // Сортировка устойчива, поэтому равные ключи остаются в порядке младших 32 бит
+    void radix_sort_high(std::vector<uint64_t>& items) {
+        size_t histogram[4][256] = {};
+        for (uint64_t item: items) {
+            for (size_t pass = 0; pass < 4; ++pass) {
+                ++histogram[pass][(item >> (32 + pass * 8)) & 0xff];
+            }
+        }
+        std::vector<uint64_t> buffer(items.size());
+        for (size_t pass = 0; pass < 4; ++pass) {
+            size_t* counts = histogram[pass];
+            if (counts[(items[0] >> (32 + pass * 8)) & 0xff] == items.size()) {
+                continue;
+            }
+            size_t offset = 0;
+            for (size_t digit = 0; digit < 256; ++digit) {
+                size_t count = counts[digit];
+                counts[digit] = offset;
+                offset += count;
+            }
+            for (uint64_t item: items) {
+                buffer[counts[(item >> (32 + pass * 8)) & 0xff]++] = item;
+            }
+            items.swap(buffer);
+        }
+    }
+
+    // Один ключ int32 или bool без null: ключ и позиция упаковываются в uint64
+    bool sort_integer_key(const memdb::Table& table, std::vector<size_t>& row_ids, const memdb::SortKey& key,
+                          size_t count) {
+        if (row_ids.size() > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        std::vector<uint64_t> items(row_ids.size());
+        for (size_t i = 0; i < row_ids.size(); ++i) {
+            uint32_t bits;
+            if (!read_order_bits(table, row_ids[i], key.column, bits)) {
+                return false;
+            }
+            items[i] = static_cast<uint64_t>(key.descending ? ~bits : bits) << 32 | i;
+        }
+        if (use_top_k(count, items.size())) {
+            std::partial_sort(items.begin(), items.begin() + static_cast<std::ptrdiff_t>(count), items.end());
+        } else {
+            radix_sort_high(items);
+        }
+        std::vector<size_t> sorted(count);
+        for (size_t i = 0; i < count; ++i) {
+            sorted[i] = row_ids[items[i] & 0xffffffffu];
+        }
+        row_ids.swap(sorted);
+        return true;
+    }
+
+    // Нормализованный ключ: побайтовое сравнение memcmp даёт нужный порядок по всем ключам сразу.
+    // Перед значением байт 0 для null и 1 иначе; int32 — 4 байта big-endian со сдвигом знака;
+    // строки и байты — содержимое, где 0x00 заменён на 0x00 0xFF, и терминатор 0x00 0x00,
+    // так что префикс меньше продолжения. Для desc все байты ключа инвертируются
+    void append_normalized(const memdb::Table& table, size_t row_index, const memdb::SortKey& key,
+                           std::vector<uint8_t>& out) {
+        size_t begin = out.size();
+        memdb::Table::ColumnType::type_kind kind = table.info_row[key.column].column_type.kind;
+        if (kind == memdb::Table::ColumnType::INT32 || kind == memdb::Table::ColumnType::BOOL) {
+            uint32_t bits;
+            if (!read_order_bits(table, row_index, key.column, bits)) {
+                out.push_back(0);
+            } else if (kind == memdb::Table::ColumnType::BOOL) {
+                out.push_back(1);
+                out.push_back(static_cast<uint8_t>(bits));
+            } else {
+                out.push_back(1);
+                for (int shift = 24; shift >= 0; shift -= 8) {
+                    out.push_back(static_cast<uint8_t>(bits >> shift));
+                }
+            }
+        } else {
+            std::string_view data;
+            if (!memdb::read_bytes(table, row_index, key.column, data)) {
+                out.push_back(0);
+            } else {
+                out.push_back(1);
+                for (char ch: data) {
+                    out.push_back(static_cast<uint8_t>(ch));
+                    if (ch == 0) {
+                        out.push_back(0xff);
+                    }
+                }
+                out.push_back(0);
+                out.push_back(0);
+            }
+        }
+        if (key.descending) {
+            for (size_t i = begin; i < out.size(); ++i) {
+                out[i] = ~out[i];
+            }
+        }
+    }
+
+    // 8 байт нормализованного ключа с позиции from как big-endian число, хвост дополняется нулями
+    uint64_t key_prefix(const uint8_t* data, size_t size, size_t from) {
+        uint64_t prefix = 0;
+        for (size_t i = from; i < from + 8; ++i) {
+            prefix = prefix << 8 | (i < size ? data[i] : 0);
+        }
+        return prefix;
+    }
+
+    void sort_normalized(const memdb::Table& table, std::vector<size_t>& row_ids,
+                         const std::vector<memdb::SortKey>& keys, size_t count) {
+        std::vector<uint8_t> buffer;
+        buffer.reserve(row_ids.size() * keys.size() * 8);
+        std::vector<size_t> offsets;
+        offsets.reserve(row_ids.size() + 1);
+        offsets.push_back(0);
+        for (size_t row_index: row_ids) {
+            for (const auto& key: keys) {
+                append_normalized(table, row_index, key, buffer);
+            }
+            offsets.push_back(buffer.size());
+        }
+
+        // Первые 16 байт ключа лежат в самом элементе: короткие ключи сравниваются целиком без обращения
+        // к буферу, длинные — только при совпадении префикса. Номер и длина в 32 битах, чтобы элемент был меньше
+        struct Item {
+            uint64_t high;
+            uint64_t low;
+            uint32_t index;
+            uint32_t size;
+        };
+        std::vector<Item> items(row_ids.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            const uint8_t* data = buffer.data() + offsets[i];
+            size_t size = offsets[i + 1] - offsets[i];
+            items[i] = {key_prefix(data, size, 0), key_prefix(data, size, 8), static_cast<uint32_t>(i),
+                        static_cast<uint32_t>(size)};
+        }
+        // При равных ключах порядок строк таблицы, как у устойчивой сортировки
+        auto less = [&](const Item& lhs, const Item& rhs) {
+            if (lhs.high != rhs.high) {
+                return lhs.high < rhs.high;
+            }
+            if (lhs.low != rhs.low) {
+                return lhs.low < rhs.low;
+            }
+            if (lhs.size > 16 && rhs.size > 16) {
+                int result = std::memcmp(buffer.data() + offsets[lhs.index] + 16,
+                                         buffer.data() + offsets[rhs.index] + 16, std::min(lhs.size, rhs.size) - 16);
+                if (result != 0) {
+                    return result < 0;
+                }
+            }
+            return lhs.size != rhs.size ? lhs.size < rhs.size : lhs.index < rhs.index;
+        };
+        if (use_top_k(count, items.size())) {
+            std::partial_sort(items.begin(), items.begin() + static_cast<std::ptrdiff_t>(count), items.end(), less);
+        } else {
+            std::sort(items.begin(), items.end(), less);
+        }
+        std::vector<size_t> sorted(count);
+        for (size_t i = 0; i < count; ++i) {
+            sorted[i] = row_ids[items[i].index];
+        }
+        row_ids.swap(sorted);
+    }
+}
+
+void memdb::sort_rows(const Table& table, std::vector<size_t>& row_ids, const std::vector<SortKey>& keys,
+                      size_t limit) {
+    size_t count = std::min(limit, row_ids.size());
+    if (keys.empty() || row_ids.size() <= 1) {
+        row_ids.resize(count);
+        return;
+    }
+    Table::ColumnType::type_kind kind = table.info_row[keys[0].column].column_type.kind;
+    if (keys.size() == 1 && (kind == Table::ColumnType::INT32 || kind == Table::ColumnType::BOOL) &&
+        sort_integer_key(table, row_ids, keys[0], count)) {
+        return;
+    }
+    sort_normalized(table, row_ids, keys, count);
+}
@@ -0,0 +1,925 @@
+#include <iostream>
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+memdb::PreparedStatement::PreparedStatement(Database& db, const std::vector<Token>& tokens) :
+        db(&db), kind(INSERT), table(nullptr) {
+
+    size_t parameters = 0;
+    for (const auto& token: tokens) {
+        if (token.type == Token::PLACEHOLDER) {
+            parameters = std::max(parameters, token.slot + 1);
+        }
+    }
+    params.assign(parameters, std::monostate{});
+    parameter_columns.assign(parameters, static_cast<size_t>(-1));
+
+    if (iequals(tokens[0].value, "insert")) {
+        kind = INSERT;
+        if ((tokens.end() - 1)->type != Token::TABLE_NAME) {
+            throw BadQuery("Bad query: insert query without table name");
+        }
+
+        table = &db.find_table((tokens.end() - 1)->value);
+
+        tuples = parse_insert_tuples(tokens, *table);
+        for (const auto& tuple: tuples) {
+            for (size_t i = 0; i < tuple.size(); ++i) {
+                if (tuple[i].type == ValueSource::PARAMETER) {
+                    parameter_columns[tuple[i].slot] = i;
+                }
+            }
+        }
+    }
+    else if (iequals(tokens[0].value, "select")) {
+        kind = SELECT;
+        std::string_view table_name;
+        bool flag = false;
+
+        for (const auto& token: tokens) {
+            if (token.type == Token::TABLE_NAME) {
+                table_name = token.value;
+                flag = true;
+                break;
+            }
+        }
+        if (!flag) {
+            throw BadQuery("Bad query: select query without table name");
+        }
+
+        table = &db.find_table(table_name);
+
+        std::vector<Token> select_tokens = tokens;
+        parse_limit(select_tokens);
+        if (std::any_of(tokens.begin(), tokens.end(), [](const Token& token) {
+            return token.type == Token::KEYWORD && iequals(token.value, "join");
+        })) {
+            parse_join(select_tokens);
+            return;
+        }
+        parse_order(select_tokens);
+        parse_aggregates(select_tokens);
+        for (const auto& token: tokens) {
+            if (!aggregates.empty() || iequals(token.value, "from")) {
+                break;
+            }
+            if (token.type == Token::FIELD_NAME) {
+                projection.push_back(find_column_index(*table, token.value));
+            }
+        }
+        condition = compile_condition(prepare_condition(select_tokens), table->info_row);
+        for (const auto& node: condition.nodes) {
+            if (node.type == Predicate::COMPARE && node.parameter) {
+                parameter_columns[node.slot] = node.column;
+            }
+        }
+    }
+    else if (iequals(tokens[0].value, "delete")) {
+        kind = DELETE;
+        if (tokens[1].type != Token::TABLE_NAME) {
+            throw BadQuery("Bad query: query without table name");
+        }
+
+        table = &db.find_table(tokens[1].value);
+        condition = compile_condition(prepare_condition(tokens), table->info_row);
+        for (const auto& node: condition.nodes) {
+            if (node.type == Predicate::COMPARE && node.parameter) {
+                parameter_columns[node.slot] = node.column;
+            }
+        }
+    } else {
+        throw BadQuery("Bad query: unknown query");
+    }
+}
+
+void memdb::PreparedStatement::parse_limit(std::vector<Token>& tokens) {
+    // Разбор с конца: limit N offset M или offset M, последним токеном обязательно идёт число или ?
+    while (tokens.size() >= 2) {
+        const Token& word = tokens[tokens.size() - 2];
+        const Token& value = tokens.back();
+        if (word.type != Token::FIELD_NAME || (value.type != Token::VALUE && value.type != Token::PLACEHOLDER)) {
+            break;
+        }
+        ValueSource* target;
+        if (iequals(word.value, "offset") && limit.type == ValueSource::MISSING &&
+            offset.type == ValueSource::MISSING) {
+            target = &offset;
+        } else if (iequals(word.value, "limit") && limit.type == ValueSource::MISSING) {
+            target = &limit;
+        } else {
+            break;
+        }
+        if (value.type == Token::PLACEHOLDER) {
+            target->type = ValueSource::PARAMETER;
+            target->slot = value.slot;
+        } else {
+            Table::column_value count = parse_value(value.value);
+            if (!std::holds_alternative<int>(count) || std::get<int>(count) < 0) {
+                throw BadQuery("Bad query: " + std::string(word.value) + " expects a non-negative integer, not " +
+                               std::string(value.value));
+            }
+            target->type = ValueSource::LITERAL;
+            target->literal = std::move(count);
+        }
+        tokens.resize(tokens.size() - 2);
+    }
+}
+
+void memdb::PreparedStatement::parse_order(std::vector<Token>& tokens) {
+    size_t start = tokens.size();
+    for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+        if (tokens[i].type == Token::FIELD_NAME && iequals(tokens[i].value, "order") &&
+            tokens[i + 1].type == Token::FIELD_NAME && iequals(tokens[i + 1].value, "by")) {
+            start = i;
+            break;
+        }
+    }
+    if (start == tokens.size()) {
+        return;
+    }
+    size_t i = start + 2;
+    while (true) {
+        if (i >= tokens.size() || tokens[i].type != Token::FIELD_NAME) {
+            throw BadQuery("Bad query: expected column name in order by");
+        }
+        SortKey key;
+        key.column = find_column_index(*table, tokens[i].value);
+        ++i;
+        if (i < tokens.size() && tokens[i].type == Token::FIELD_NAME &&
+            (iequals(tokens[i].value, "asc") || iequals(tokens[i].value, "desc"))) {
+            key.descending = iequals(tokens[i].value, "desc");
+            ++i;
+        }
+        order.push_back(key);
+        if (i == tokens.size()) {
+            break;
+        }
+        if (tokens[i].value != ",") {
+            throw BadQuery("Bad query: unexpected " + std::string(tokens[i].value) + " in order by");
+        }
+        ++i;
+    }
+    tokens.resize(start);
+}
+
+void memdb::PreparedStatement::parse_aggregates(std::vector<Token>& tokens) {
+    for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+        if (tokens[i].type == Token::FIELD_NAME && iequals(tokens[i].value, "group") &&
+            tokens[i + 1].type == Token::FIELD_NAME && iequals(tokens[i + 1].value, "by")) {
+            for (size_t j = i + 2; j < tokens.size(); j += 2) {
+                if (tokens[j].type != Token::FIELD_NAME) {
+                    throw BadQuery("Bad query: expected column name in group by");
+                }
+                group_columns.push_back(find_column_index(*table, tokens[j].value));
+                if (j + 1 < tokens.size() && tokens[j + 1].value != ",") {
+                    throw BadQuery("Bad query: unexpected " + std::string(tokens[j + 1].value) + " in group by");
+                }
+            }
+            if (tokens.back().value == "," || i + 2 == tokens.size()) {
+                throw BadQuery("Bad query: expected column name in group by");
+            }
+            tokens.resize(i);
+            break;
+        }
+    }
+
+    size_t from = 1;
+    bool functions = false;
+    while (from < tokens.size() && !iequals(tokens[from].value, "from")) {
+        functions = functions || (tokens[from].value == "(" && tokens[from - 1].type == Token::FIELD_NAME);
+        ++from;
+    }
+    if (!functions && group_columns.empty()) {
+        return;
+    }
+
+    // Элементы списка: колонка из group by или функция(колонка), count(*), через запятую
+    for (size_t i = 1; i < from; ++i) {
+        if (tokens[i].type != Token::FIELD_NAME) {
+            throw BadQuery("Bad query: unexpected " + std::string(tokens[i].value) + " in select list");
+        }
+        Aggregate item;
+        if (i + 1 < from && tokens[i + 1].value == "(") {
+            std::string_view name = tokens[i].value;
+            if (iequals(name, "count")) {
+                item.kind = Aggregate::COUNT;
+            } else if (iequals(name, "sum")) {
+                item.kind = Aggregate::SUM;
+            } else if (iequals(name, "min")) {
+                item.kind = Aggregate::MIN;
+            } else if (iequals(name, "max")) {
+                item.kind = Aggregate::MAX;
+            } else if (iequals(name, "avg")) {
+                item.kind = Aggregate::AVG;
+            } else {
+                throw BadQuery("Bad query: unknown function " + std::string(name));
+            }
+            if (i + 3 >= from || tokens[i + 3].value != ")") {
+                throw BadQuery("Bad query: expected " + std::string(name) + "(<column>)");
+            }
+            const Token& argument = tokens[i + 2];
+            if (argument.value == "*" && item.kind == Aggregate::COUNT) {
+                item.column = static_cast<size_t>(-1);
+            } else if (argument.type == Token::FIELD_NAME) {
+                item.column = find_column_index(*table, argument.value);
+            } else {
+                throw BadQuery("Bad query: unexpected " + std::string(argument.value) + " in " + std::string(name));
+            }
+            if ((item.kind == Aggregate::SUM || item.kind == Aggregate::AVG) &&
+                table->info_row[item.column].column_type.kind != Table::ColumnType::INT32 &&
+                table->info_row[item.column].column_type.kind != Table::ColumnType::BOOL) {
+                throw BadQuery("Bad query: " + std::string(name) + " needs an int32 or bool column");
+            }
+            i += 3;
+        } else {
+            item.column = find_column_index(*table, tokens[i].value);
+            if (std::find(group_columns.begin(), group_columns.end(), item.column) == group_columns.end()) {
+                throw BadQuery("Bad query: column " + std::string(tokens[i].value) +
+                               " has to be in group by or inside an aggregate function");
+            }
+        }
+        aggregates.push_back(item);
+        if (i + 1 < from && tokens[++i].value != ",") {
+            throw BadQuery("Bad query: unexpected " + std::string(tokens[i].value) + " in select list");
+        }
+    }
+
+    // order by над результатом: ключи — колонки group by из списка select
+    for (auto& key: order) {
+        auto it = std::find_if(aggregates.begin(), aggregates.end(), [&](const Aggregate& item) {
+            return item.kind == Aggregate::VALUE && item.column == key.column;
+        });
+        if (it == aggregates.end()) {
+            throw BadQuery("Bad query: order by column " + table->info_row[key.column].name +
+                           " has to be in the select list");
+        }
+        key.column = static_cast<size_t>(it - aggregates.begin());
+    }
+}
+
+void memdb::PreparedStatement::parse_join(const std::vector<Token>& tokens) {
+    size_t join_index = 0;
+    while (tokens[join_index].type != Token::KEYWORD || !iequals(tokens[join_index].value, "join")) {
+        ++join_index;
+    }
+    if (join_index + 2 >= tokens.size() || tokens[join_index + 1].type != Token::TABLE_NAME ||
+        !iequals(tokens[join_index + 2].value, "on")) {
+        throw BadQuery("Bad query: expected join <table> on <column> == <column>");
+    }
+    for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+        if (tokens[i].type == Token::FIELD_NAME && iequals(tokens[i + 1].value, "by") &&
+            (iequals(tokens[i].value, "order") || iequals(tokens[i].value, "group"))) {
+            throw BadQuery("Bad query: " + std::string(tokens[i].value) + " by is not supported with join");
+        }
+    }
+    join_table = &db->find_table(tokens[join_index + 1].value);
+    if (join_table == table) {
+        throw BadQuery("Bad query: can't join table " + table->name + " with itself");
+    }
+    for (const Table* source: {static_cast<const Table*>(table), static_cast<const Table*>(join_table)}) {
+        for (const auto& column: source->info_row) {
+            Table::column_info info = column;
+            info.name = source->name + "." + column.name;
+            info.key = info.unique = info.autoincrement = info.dictionary = false;
+            join_info.push_back(std::move(info));
+        }
+    }
+    size_t left_count = table->info_row.size();
+
+    // on: ровно одно равенство колонки левой таблицы с колонкой правой
+    size_t where_index = join_index + 3;
+    while (where_index < tokens.size() && !iequals(tokens[where_index].value, "where")) {
+        ++where_index;
+    }
+    if (where_index != join_index + 6 || tokens[join_index + 3].type != Token::FIELD_NAME ||
+        tokens[join_index + 4].value != "==" || tokens[join_index + 5].type != Token::FIELD_NAME) {
+        throw BadQuery("Bad query: join condition has to be <column> == <column>");
+    }
+    size_t lhs = join_column(tokens[join_index + 3].value);
+    size_t rhs = join_column(tokens[join_index + 5].value);
+    if (lhs > rhs) {
+        std::swap(lhs, rhs);
+    }
+    if (lhs >= left_count || rhs < left_count) {
+        throw BadQuery("Bad query: join condition has to compare columns of both tables");
+    }
+    join_left_column = lhs;
+    join_right_column = rhs - left_count;
+    const Table::column_info& left_key = join_info[lhs];
+    const Table::column_info& right_key = join_info[rhs];
+    if (left_key.column_type.kind != right_key.column_type.kind) {
+        throw BadQuery("Bad query: can't join " + left_key.name + " of type " + left_key.column_type.name() +
+                       " with " + right_key.name + " of type " + right_key.column_type.name());
+    }
+
+    for (size_t i = 1; i < tokens.size() && !iequals(tokens[i].value, "from"); ++i) {
+        if (tokens[i].type == Token::FIELD_NAME) {
+            projection.push_back(join_column(tokens[i].value));
+        } else if (tokens[i].value != ",") {
+            throw BadQuery("Bad query: unexpected " + std::string(tokens[i].value) + " in select list with join");
+        }
+    }
+
+    // Части where, соединённые && на верхнем уровне, проверяются до соединения на своей таблице;
+    // остальное — на парах строк. Имена колонок заменяются на те, под которыми их знает условие
+    std::vector<Token> where = prepare_condition(tokens);
+    std::vector<std::vector<Token>> parts(1);
+    int depth = 0;
+    bool splittable = true;
+    for (const auto& token: where) {
+        depth += token.value == "(" ? 1 : token.value == ")" ? -1 : 0;
+        if (depth == 0 && token.value == "||") {
+            splittable = false;
+        }
+        if (depth == 0 && token.value == "&&") {
+            parts.emplace_back();
+        } else {
+            parts.back().push_back(token);
+        }
+    }
+    if (!splittable) {
+        parts.assign(1, where);
+    }
+    std::vector<Token> sides[3]; // Левая таблица, правая, обе
+    for (auto& part: parts) {
+        if (part.empty()) {
+            throw BadQuery("Bad query: empty condition");
+        }
+        bool uses_left = false;
+        bool uses_right = false;
+        for (const auto& token: part) {
+            if (token.type == Token::FIELD_NAME) {
+                (join_column(token.value) < left_count ? uses_left : uses_right) = true;
+            }
+        }
+        size_t side = uses_left && uses_right ? 2 : uses_right ? 1 : 0;
+        for (auto& token: part) {
+            if (token.type != Token::FIELD_NAME) {
+                continue;
+            }
+            size_t column = join_column(token.value);
+            if (side == 2) {
+                token.value = join_info[column].name;
+            } else {
+                token.value = column < left_count ? table->info_row[column].name :
+                              join_table->info_row[column - left_count].name;
+            }
+        }
+        if (!sides[side].empty()) {
+            sides[side].push_back(Token{Token::OPERATOR, "&&"});
+        }
+        sides[side].insert(sides[side].end(), part.begin(), part.end());
+    }
+    left_filtered = !sides[0].empty();
+    right_filtered = !sides[1].empty();
+    join_filtered = !sides[2].empty();
+    if (left_filtered) {
+        condition = compile_condition(sides[0], table->info_row);
+    }
+    if (right_filtered) {
+        right_condition = compile_condition(sides[1], join_table->info_row);
+    }
+    if (join_filtered) {
+        join_condition = compile_condition(sides[2], join_info);
+    }
+}
+
+size_t memdb::PreparedStatement::join_column(std::string_view name) const {
+    size_t left_count = table->info_row.size();
+    size_t dot = name.find('.');
+    if (dot != std::string_view::npos) {
+        std::string_view table_name = name.substr(0, dot);
+        if (table_name == table->name) {
+            return find_column_index(*table, name.substr(dot + 1));
+        }
+        if (table_name == join_table->name) {
+            return left_count + find_column_index(*join_table, name.substr(dot + 1));
+        }
+        throw BadQuery("Bad query: table '" + std::string(table_name) + "' is not in the query");
+    }
+    size_t left = table->column_position(name);
+    size_t right = join_table->column_position(name);
+    if (left != static_cast<size_t>(-1) && right != static_cast<size_t>(-1)) {
+        throw BadQuery("Bad query: column '" + std::string(name) + "' is ambiguous, qualify it with a table name");
+    }
+    if (left != static_cast<size_t>(-1)) {
+        return left;
+    }
+    return left_count + find_column_index(*join_table, name);
+}
+
+bool memdb::PreparedStatement::count_parameter(size_t index) const {
+    return (limit.type == ValueSource::PARAMETER && limit.slot == index) ||
+           (offset.type == ValueSource::PARAMETER && offset.slot == index);
+}
+
+void memdb::PreparedStatement::bind(size_t index, int value) {
+    bind_value(index, value);
+}
+
+void memdb::PreparedStatement::bind(size_t index, bool value) {
+    bind_value(index, value);
+}
+
+void memdb::PreparedStatement::bind(size_t index, std::string_view value) {
+    std::string literal;
+    literal.reserve(value.size() + 2);
+    literal += '"';
+    literal += value;
+    literal += '"';
+    bind_value(index, std::move(literal));
+}
+
+void memdb::PreparedStatement::bind(size_t index, const char* value) {
+    bind(index, std::string_view(value));
+}
+
+void memdb::PreparedStatement::bind(size_t index, std::vector<uint8_t> value) {
+    bind_value(index, std::move(value));
+}
+
+void memdb::PreparedStatement::bind_value(size_t index, Table::column_value value) {
+    check_parameter(index, value);
+    params[index] = std::move(value);
+}
+
+void memdb::PreparedStatement::check_parameter(size_t index, const Table::column_value &value,
+                                               std::string_view literal) const {
+    if (index >= params.size()) {
+        throw BadQuery("Bad query: parameter index " + std::to_string(index) + " out of range");
+    }
+    if (count_parameter(index)) {
+        if (!std::holds_alternative<int>(value) || std::get<int>(value) < 0) {
+            if (!literal.empty()) {
+                bool is_limit = limit.type == ValueSource::PARAMETER && limit.slot == index;
+                throw BadQuery("Bad query: " + std::string(is_limit ? "limit" : "offset") +
+                               " expects a non-negative integer, not " + std::string(literal));
+            }
+            throw BadQuery("Bad query: parameter " + std::to_string(index) + " of limit or offset has to be "
+                           "a non-negative integer");
+        }
+        return;
+    }
+    if (parameter_columns[index] != static_cast<size_t>(-1)) {
+        // В insert значение должно поместиться в колонку, в условии достаточно совпадения типа
+        const Table::column_info& info = table->info_row[parameter_columns[index]];
+        bool fits = kind == INSERT ? info.column_type.accepts(value) : info.column_type.matches(value);
+        if (fits) {
+            return;
+        }
+        if (literal.empty()) {
+            throw BadQuery("Bad query: parameter " + std::to_string(index) + " doesn't fit column '" +
+                           info.name + "' of type " + info.column_type.name());
+        }
+        if (kind == INSERT) {
+            throw BadQuery("Bad query: value " + std::string(literal) + " doesn't fit column '" + info.name +
+                           "' of type " + info.column_type.name());
+        }
+        throw BadQuery("Bad query: can't compare column '" + info.name + "' of type " + info.column_type.name() +
+                       " with " + std::string(literal));
+    }
+}
+
+void memdb::PreparedStatement::clear_bindings() {
+    for (auto& param: params) {
+        param = std::monostate{};
+    }
+}
+
+size_t memdb::PreparedStatement::parameter_count() const {
+    return params.size();
+}
+
+memdb::PreparedStatement::statement_type memdb::PreparedStatement::type() const {
+    return kind;
+}
+
+memdb::ResultSet memdb::PreparedStatement::execute() {
+    return execute(nullptr);
+}
+
+memdb::ResultSet memdb::PreparedStatement::execute(const std::shared_ptr<const ReadView> &view, QueryStats *stats) {
+    MEMDB_PROFILE_START(stats);
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (std::holds_alternative<std::monostate>(params[i])) {
+            throw BadQuery("Bad query: parameter " + std::to_string(i) + " is not bound");
+        }
+    }
+    if (kind == SELECT) {
+        auto lock = db->read_lock();
+        return run(params, view, stats);
+    }
+    if (view != nullptr) {
+        throw BadQuery("Bad query: only select can run on a snapshot");
+    }
+    auto lock = db->write_lock();
+    return run(params, nullptr, stats);
+}
+
+memdb::Cursor memdb::PreparedStatement::query(const std::shared_ptr<const ReadView> &view) {
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (std::holds_alternative<std::monostate>(params[i])) {
+            throw BadQuery("Bad query: parameter " + std::to_string(i) + " is not bound");
+        }
+    }
+    if (kind != SELECT) {
+        throw BadQuery("Bad query: only select can open a cursor");
+    }
+    auto lock = db->read_lock();
+    return open_cursor(params, view);
+}
+
+namespace {
+    size_t count_value(const memdb::ValueSource& source, const memdb::Parameters& values, size_t fallback) {
+        if (source.type == memdb::ValueSource::LITERAL) {
+            return std::get<int>(source.literal);
+        }
+        if (source.type == memdb::ValueSource::PARAMETER) {
+            if (source.slot >= values.size() || !std::holds_alternative<int>(values[source.slot])) {
+                throw memdb::BadQuery("Bad query: parameter " + std::to_string(source.slot) + " is not bound");
+            }
+            return std::get<int>(values[source.slot]);
+        }
+        return fallback;
+    }
+}
+
+memdb::Cursor memdb::PreparedStatement::open_cursor(const Parameters& values,
+                                                    std::shared_ptr<const ReadView> view) const {
+    condition.check_parameters(values);
+    Cursor cursor;
+    cursor.skip = count_value(offset, values, 0);
+    cursor.remaining = count_value(limit, values, std::numeric_limits<size_t>::max());
+    cursor.table = table;
+    cursor.predicate = condition;
+    cursor.params = values;
+    cursor.projection = projection;
+    cursor.read_view = view == nullptr ? db->read_view() : std::move(view);
+    cursor.end = table->size();
+    if (join_table != nullptr) {
+        right_condition.check_parameters(values);
+        join_condition.check_parameters(values);
+        uint64_t version = cursor.read_view->version();
+        auto input_rows = [&](const Table& source, const Predicate& predicate, bool filtered) {
+            std::vector<size_t> row_ids;
+            if (!filtered) {
+                for (size_t i = 0; i < source.size(); ++i) {
+                    if (source.visible(i, version)) {
+                        row_ids.push_back(i);
+                    }
+                }
+                return row_ids;
+            }
+            Bitmap matches = check_condition(predicate, source, values, db->scan_options(source, version));
+            for (size_t word = 0; word < matches.words.size(); ++word) {
+                for (uint64_t bits = matches.words[word]; bits != 0; bits &= bits - 1) {
+                    row_ids.push_back(word * 64 + __builtin_ctzll(bits));
+                }
+            }
+            return row_ids;
+        };
+        // Хеш-таблица строится здесь по меньшему входу, пары находятся по мере чтения курсора
+        cursor.join = std::make_shared<HashJoin>(*table, input_rows(*table, condition, left_filtered), join_left_column,
+                                                 *join_table, input_rows(*join_table, right_condition, right_filtered),
+                                                 join_right_column);
+        cursor.right_table = join_table;
+        cursor.join_info = join_info;
+        cursor.join_filter = join_condition;
+        cursor.filtered = join_filtered;
+        cursor.index_checked = true;
+        cursor.position = cursor.end;
+        cursor.scanned = table->size() + join_table->size();
+        return cursor;
+    }
+    if (!aggregates.empty()) {
+        // Результат агрегации мал и уже упорядочен и обрезан, курсор просто отдаёт его строки
+        auto output = std::make_shared<const Table>(run_aggregate(values, cursor.read_view->version(), nullptr));
+        cursor.scanned = table->size();
+        cursor.table = output.get();
+        cursor.owned_table = std::move(output);
+        cursor.projection.clear();
+        for (size_t i = 0; i < cursor.table->info_row.size(); ++i) {
+            cursor.projection.push_back(i);
+        }
+        for (size_t i = 0; i < cursor.table->size(); ++i) {
+            cursor.pending.push_back(i);
+        }
+        cursor.skip = 0;
+        cursor.remaining = std::numeric_limits<size_t>::max();
+        cursor.index_checked = true;
+        cursor.position = cursor.end = 0;
+        return cursor;
+    }
+    if (!order.empty()) {
+        // Сортировке нужны все подходящие строки, поэтому они отбираются сразу обычным сканом
+        Bitmap matches = check_condition(condition, *table, values,
+                                         db->scan_options(*table, cursor.read_view->version()));
+        for (size_t word = 0; word < matches.words.size(); ++word) {
+            for (uint64_t bits = matches.words[word]; bits != 0; bits &= bits - 1) {
+                cursor.pending.push_back(word * 64 + __builtin_ctzll(bits));
+            }
+        }
+        size_t needed = cursor.remaining > std::numeric_limits<size_t>::max() - cursor.skip ?
+                        std::numeric_limits<size_t>::max() : cursor.skip + cursor.remaining;
+        sort_rows(*table, cursor.pending, order, needed);
+        cursor.index_checked = true;
+        cursor.position = cursor.end;
+        cursor.scanned = cursor.end;
+    }
+    return cursor;
+}
+
+memdb::Table memdb::PreparedStatement::run_aggregate(const Parameters& values, uint64_t version,
+                                                    QueryStats *stats) const {
+    ScanOptions options = db->scan_options(*table, version);
+    Bitmap matches = check_condition(condition, *table, values, options);
+    std::vector<size_t> row_ids;
+    for (size_t word = 0; word < matches.words.size(); ++word) {
+        for (uint64_t bits = matches.words[word]; bits != 0; bits &= bits - 1) {
+            row_ids.push_back(word * 64 + __builtin_ctzll(bits));
+        }
+    }
+    MEMDB_PROFILE_LAP(stats, SCAN);
+    MEMDB_PROFILE_COUNT(stats, rows_scanned, table->size());
+    MEMDB_PROFILE_COUNT(stats, rows_matched, row_ids.size());
+
+    Table result = aggregate_rows(*table, row_ids, group_columns, aggregates, options);
+    size_t skip = count_value(offset, values, 0);
+    size_t remaining = count_value(limit, values, std::numeric_limits<size_t>::max());
+    if (!order.empty() || skip != 0 || remaining < result.size()) {
+        std::vector<size_t> ids(result.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = i;
+        }
+        size_t needed = remaining > std::numeric_limits<size_t>::max() - skip ?
+                        std::numeric_limits<size_t>::max() : skip + remaining;
+        sort_rows(result, ids, order, needed);
+        std::vector<Table::row> rows;
+        for (size_t i = skip; i < ids.size(); ++i) {
+            rows.push_back(std::move(result.rows[ids[i]]));
+        }
+        result.rows = std::move(rows);
+        result.deleted = {};
+        result.deleted.resize(result.rows.size());
+    }
+    MEMDB_PROFILE_LAP(stats, EXECUTE);
+    return result;
+}
+
+memdb::ResultSet memdb::PreparedStatement::run(const Parameters& values, std::shared_ptr<const ReadView> view,
+                                               QueryStats *stats) const {
+    if (kind == INSERT) {
+        std::vector<Table::row> batch;
+        batch.reserve(tuples.size());
+        for (const auto& tuple: tuples) {
+            batch.push_back(build_row(tuple, values, *table));
+        }
+        MEMDB_PROFILE_COUNT(stats, values_copied, batch.size() * table->info_row.size());
+        MEMDB_PROFILE_COUNT(stats, bytes_allocated,
+                            batch.size() * table->info_row.size() * sizeof(Table::column_value));
+        db->begin_write(*table);
+        table->bulk_load(std::move(batch));
+        db->log_statement(text, values);
+        MEMDB_PROFILE_LAP(stats, EXECUTE);
+    }
+    else if (kind == SELECT) {
+        if (join_table != nullptr) {
+            // Строки результата собраны из двух таблиц, поэтому ResultSet владеет своей таблицей
+            Cursor cursor = open_cursor(values, std::move(view));
+            Table result;
+            result.name = "select_table";
+            for (size_t column_index: projection) {
+                result.info_row.push_back(join_info[column_index]);
+            }
+            result.rebuild_catalog();
+            Table::row row;
+            while (cursor.read_next(row)) {
+                result.rows.push_back(std::move(row));
+            }
+            result.deleted.resize(result.rows.size());
+            MEMDB_PROFILE_LAP(stats, SCAN);
+            MEMDB_PROFILE_COUNT(stats, rows_scanned, cursor.rows_scanned());
+            MEMDB_PROFILE_COUNT(stats, rows_matched, result.rows.size());
+            MEMDB_PROFILE_COUNT(stats, values_copied, result.rows.size() * projection.size());
+            MEMDB_PROFILE_LAP(stats, EXECUTE);
+            return ResultSet(std::move(result));
+        }
+        if (!aggregates.empty()) {
+            return ResultSet(run_aggregate(values, view == nullptr ? Table::LIVE_VERSION : view->version(), stats));
+        }
+        if (limit.type != ValueSource::MISSING || offset.type != ValueSource::MISSING || !order.empty()) {
+            // С limit скан останавливается, как только набрано нужное число строк
+            Cursor cursor = open_cursor(values, view);
+            std::vector<size_t> row_ids;
+            size_t row_id;
+            while (cursor.advance(row_id)) {
+                row_ids.push_back(row_id);
+            }
+            MEMDB_PROFILE_LAP(stats, SCAN);
+            MEMDB_PROFILE_COUNT(stats, rows_scanned, cursor.rows_scanned());
+            MEMDB_PROFILE_COUNT(stats, rows_matched, row_ids.size());
+            MEMDB_PROFILE_COUNT(stats, bytes_allocated, row_ids.capacity() * sizeof(size_t));
+            return {*db, *table, std::move(row_ids), projection, std::move(view)};
+        }
+        uint64_t version = view == nullptr ? Table::LIVE_VERSION : view->version();
+        Bitmap check_results = check_condition(condition, *table, values, db->scan_options(*table, version));
+        MEMDB_PROFILE_LAP(stats, SCAN);
+        MEMDB_PROFILE_COUNT(stats, rows_scanned, table->size());
+        MEMDB_PROFILE_COUNT(stats, bytes_allocated, check_results.words.size() * sizeof(uint64_t));
+
+        std::vector<size_t> row_ids;
+        for (size_t word = 0; word < check_results.words.size(); ++word) {
+            for (uint64_t bits = check_results.words[word]; bits != 0; bits &= bits - 1) {
+                row_ids.push_back(word * 64 + __builtin_ctzll(bits));
+            }
+        }
+        MEMDB_PROFILE_COUNT(stats, rows_matched, row_ids.size());
+        MEMDB_PROFILE_COUNT(stats, bytes_allocated, row_ids.capacity() * sizeof(size_t));
+        MEMDB_PROFILE_LAP(stats, EXECUTE);
+
+        return {*db, *table, std::move(row_ids), projection, std::move(view)};
+    }
+    else if (kind == DELETE) {
+        Bitmap selection = check_condition(condition, *table, values, db->scan_options(*table));
+        MEMDB_PROFILE_LAP(stats, SCAN);
+        MEMDB_PROFILE_COUNT(stats, rows_scanned, table->size());
+        MEMDB_PROFILE_COUNT(stats, bytes_allocated, selection.words.size() * sizeof(uint64_t));
+#ifdef MEMDB_PROFILING
+        if (stats != nullptr) {
+            for (uint64_t word: selection.words) {
+                stats->rows_matched += __builtin_popcountll(word);
+            }
+        }
+#endif
+        db->begin_write(*table);
+        table->delete_rows(selection);
+        db->log_statement(text, values);
+        db->maybe_compact(*table);
+        MEMDB_PROFILE_LAP(stats, EXECUTE);
+    }
+    return {};
+}
+
+memdb::ResultSet::ResultSet(Database &db, const Table &source, std::vector<size_t> row_ids,
+                            std::vector<size_t> projection, std::shared_ptr<const ReadView> view) :
+        db(&db), table(&source), rows(std::move(row_ids)), columns(std::move(projection)),
+        read_view(std::move(view)), compactions(source.compactions) {}
+
+std::shared_lock<std::shared_mutex> memdb::ResultSet::lock() const {
+    if (db == nullptr) {
+        return {};
+    }
+    return db->read_lock();
+}
+
+void memdb::ResultSet::check_rows() const {
+    if (read_view == nullptr && table->compactions != compactions) {
+        throw BadQuery("Bad query: result is stale, table " + table->name + " was compacted after the select; "
+                       "run it on a read_view() to keep its rows");
+    }
+}
+
+memdb::ResultSet::ResultSet(Table owned) : owned_table(std::make_shared<const Table>(std::move(owned))) {
+    table = owned_table.get();
+    for (size_t i = 0; i < table->size(); ++i) {
+        rows.push_back(i);
+    }
+    for (size_t i = 0; i < table->info_row.size(); ++i) {
+        columns.push_back(i);
+    }
+}
+
+const std::shared_ptr<const memdb::ReadView> &memdb::ResultSet::view() const {
+    return read_view;
+}
+
+size_t memdb::ResultSet::size() const {
+    return rows.size();
+}
+
+bool memdb::ResultSet::empty() const {
+    return rows.empty();
+}
+
+size_t memdb::ResultSet::column_count() const {
+    return columns.size();
+}
+
+const memdb::Table::column_info &memdb::ResultSet::column(size_t column_index) const {
+    return table->info_row[columns[column_index]];
+}
+
+size_t memdb::ResultSet::row_id(size_t row_index) const {
+    return rows[row_index];
+}
+
+const memdb::Table *memdb::ResultSet::source() const {
+    return table;
+}
+
+memdb::Table::column_value memdb::ResultSet::get(size_t row_index, size_t column_index) const {
+    auto guard = lock();
+    check_rows();
+    return table->get(rows[row_index], columns[column_index]);
+}
+
+memdb::Table memdb::ResultSet::materialize() const {
+    Table result;
+    result.name = "select_table";
+    for (size_t i = 0; i < column_count(); ++i) {
+        result.info_row.push_back(column(i));
+    }
+    result.rebuild_catalog();
+
+    auto guard = lock();
+    check_rows();
+    result.rows.reserve(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        Table::row new_row;
+        new_row.values.reserve(columns.size());
+        for (size_t j = 0; j < columns.size(); ++j) {
+            new_row.values.push_back(table->get(rows[i], columns[j]));
+        }
+        result.rows.push_back(std::move(new_row));
+    }
+    result.deleted.resize(result.rows.size());
+    return result;
+}
+
+void memdb::ResultSet::print() const {
+    for (size_t i = 0; i < column_count(); ++i) {
+        std::cout << column(i).name << "\t";
+    }
+    std::cout << std::endl;
+    for (size_t i = 0; i < size(); ++i) {
+        for (size_t j = 0; j < column_count(); ++j) {
+            std::visit(Table::ValuePrinter{}, get(i, j));
+            std::cout << "\t";
+        }
+        std::cout << std::endl;
+    }
+}
+
+const char *memdb::QueryStats::stage_name(stage value) {
+    switch (value) {
+        case TOKENIZE:
+            return "tokenize";
+        case CHECK_SYNTAX:
+            return "check_syntax";
+        case PREPARE:
+            return "prepare";
+        case SCAN:
+            return "scan";
+        case EXECUTE:
+            return "execute";
+        case MATERIALIZE:
+            return "materialize";
+        case STAGE_COUNT:
+            break;
+    }
+    return "";
+}
+
+void memdb::QueryStats::start() {
+    mark = std::chrono::steady_clock::now();
+}
+
+void memdb::QueryStats::lap(stage value) {
+    auto now = std::chrono::steady_clock::now();
+    stage_time[value] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark);
+    mark = now;
+}
+
+std::chrono::nanoseconds memdb::QueryStats::total_time() const {
+    std::chrono::nanoseconds total{0};
+    for (auto time: stage_time) {
+        total += time;
+    }
+    return total;
+}
+
+std::vector<std::string> memdb::QueryStats::report() const {
+    auto microseconds = [](std::chrono::nanoseconds time) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1) << static_cast<double>(time.count()) / 1000 << " us";
+        return out.str();
+    };
+
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        lines.push_back(std::string(stage_name(static_cast<stage>(i))) + ": " + microseconds(stage_time[i]));
+    }
+    lines.push_back("total: " + microseconds(total_time()));
+    lines.push_back("rows scanned: " + std::to_string(rows_scanned));
+    lines.push_back("rows matched: " + std::to_string(rows_matched));
+    lines.push_back("values copied: " + std::to_string(values_copied));
+    lines.push_back("bytes allocated: " + std::to_string(bytes_allocated));
+    return lines;
+}
@@ -0,0 +1,788 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <charconv>
+#include <unordered_set>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+void memdb::Bitmap::resize(size_t size, bool value) {
+    size_t old_bits = bits;
+    words.resize((size + 63) / 64, 0);
+    bits = size;
+    for (size_t i = old_bits; value && i < size; ++i) {
+        set(i, true);
+    }
+    if (bits % 64 != 0) {
+        words.back() &= (uint64_t(1) << (bits % 64)) - 1; // Хвост последнего слова всегда нулевой
+    }
+}
+
+void memdb::Bitmap::clear() {
+    words.clear();
+    bits = 0;
+}
+
+memdb::Table::ColumnType memdb::Table::ColumnType::parse(std::string_view type) {
+    ColumnType result;
+    if (type == "int32") {
+        return result;
+    }
+    if (type == "bool") {
+        result.kind = BOOL;
+        result.width = 1;
+        return result;
+    }
+
+    std::string_view prefix = type.substr(0, type.find('['));
+    std::string_view length = type.substr(std::min(type.size(), prefix.size() + 1));
+    if ((prefix == "string" || prefix == "bytes") && length.size() > 1 && length.back() == ']') {
+        length.remove_suffix(1);
+        auto [end, error] = std::from_chars(length.data(), length.data() + length.size(), result.max_length);
+        if (error == std::errc() && end == length.data() + length.size()) {
+            result.kind = prefix == "string" ? STRING : BYTES;
+            result.width = result.max_length;
+            return result;
+        }
+    }
+    throw BadQuery("Bad query: unknown column type " + std::string(type));
+}
+
+bool memdb::Table::ColumnType::matches(const column_value &value) const {
+    return Column::accepts(kind, value);
+}
+
+bool memdb::Table::ColumnType::accepts(const column_value &value) const {
+    if (!matches(value)) {
+        return false;
+    }
+    if (auto* str = std::get_if<std::string>(&value)) {
+        return str->size() <= max_length;
+    }
+    if (auto* bytes = std::get_if<std::vector<uint8_t>>(&value)) {
+        return bytes->size() <= max_length;
+    }
+    return true;
+}
+
+std::string memdb::Table::ColumnType::name() const {
+    switch (kind) {
+        case INT32:
+            return "int32";
+        case BOOL:
+            return "bool";
+        case STRING:
+            return "string[" + std::to_string(max_length) + "]";
+        case BYTES:
+            return "bytes[" + std::to_string(max_length) + "]";
+    }
+    return {};
+}
+
+namespace {
+    // Ширина кода, в которую помещается словарь такого размера
+    uint32_t code_width_for(size_t dictionary_size) {
+        if (dictionary_size <= (size_t(1) << 8)) {
+            return 1;
+        }
+        return dictionary_size <= (size_t(1) << 16) ? 2 : 4;
+    }
+
+    void store_code(uint8_t *target, uint32_t code, uint32_t width) {
+        if (width == 1) {
+            *target = static_cast<uint8_t>(code);
+        } else if (width == 2) {
+            auto narrow = static_cast<uint16_t>(code);
+            std::memcpy(target, &narrow, sizeof(narrow));
+        } else {
+            std::memcpy(target, &code, sizeof(code));
+        }
+    }
+}
+
+memdb::Table::Column::Column(const column_info &info) : kind(info.column_type.kind) {
+    if ((kind == STRING || kind == BYTES) && info.dictionary) {
+        dictionary.emplace_back();
+        rebuild_dictionary();
+    } else if ((kind == STRING || kind == BYTES) && info.column_type.max_length <= INLINE_LIMIT) {
+        slot_width = info.column_type.max_length + 1;
+    }
+}
+
+void memdb::Table::Column::append(const column_value &value) {
+    bool valid = !std::holds_alternative<std::monostate>(value);
+
+    switch (kind) {
+        case INT32: {
+            auto* number = std::get_if<int>(&value);
+            if (valid && number == nullptr) {
+                throw BadQuery("Bad query: int32 column got a value of another type");
+            }
+            ints.push_back(valid ? *number : 0);
+            break;
+        }
+        case BOOL: {
+            auto* flag = std::get_if<bool>(&value);
+            if (valid && flag == nullptr) {
+                throw BadQuery("Bad query: bool column got a value of another type");
+            }
+            bools.push_back(valid && *flag);
+            break;
+        }
+        case STRING:
+        case BYTES: {
+            const char* data = nullptr;
+            size_t length = 0;
+            if (auto* str = std::get_if<std::string>(&value); str != nullptr && kind == STRING) {
+                data = str->data();
+                length = str->size();
+            } else if (auto* bytes = std::get_if<std::vector<uint8_t>>(&value); bytes != nullptr && kind == BYTES) {
+                data = reinterpret_cast<const char*>(bytes->data());
+                length = bytes->size();
+            } else if (valid) {
+                throw BadQuery(std::string("Bad query: ") + (kind == STRING ? "string" : "bytes") +
+                               " column got a value of another type");
+            }
+            if (code_width != 0) {
+                auto [position, inserted] = dictionary_codes.try_emplace(std::string(data, length),
+                                                                         static_cast<uint32_t>(dictionary.size()));
+                if (inserted) {
+                    if (dictionary.size() == std::numeric_limits<uint32_t>::max()) {
+                        dictionary_codes.erase(position);
+                        throw BadQuery("Bad query: column dictionary is full");
+                    }
+                    dictionary.push_back(position->first);
+                    uint32_t width = code_width_for(dictionary.size());
+                    if (width != code_width) {
+                        // Словарь перерос ширину кода: перекодируем колонку в более широкие коды
+                        std::vector<uint8_t> widened(codes.size() / code_width * width);
+                        for (size_t row = 0; row < codes.size() / code_width; ++row) {
+                            store_code(widened.data() + row * width, code(row), width);
+                        }
+                        codes = std::move(widened);
+                        code_width = width;
+                    }
+                }
+                codes.resize(codes.size() + code_width);
+                store_code(codes.data() + codes.size() - code_width, position->second, code_width);
+                break;
+            }
+            if (slot_width != 0) {
+                if (length >= slot_width) {
+                    throw BadQuery("Bad query: value is longer than the column width");
+                }
+                size_t slot = slots.size();
+                slots.resize(slot + slot_width, 0);
+                slots[slot] = static_cast<char>(length);
+                if (length != 0) {
+                    std::memcpy(slots.data() + slot + 1, data, length);
+                }
+                break;
+            }
+            if (arena.size() + length > std::numeric_limits<uint32_t>::max()) {
+                throw BadQuery("Bad query: column storage is full");
+            }
+            arena.insert(arena.end(), data, data + length);
+            offsets.push_back(static_cast<uint32_t>(arena.size()));
+            break;
+        }
+    }
+
+    validity.push_back(valid);
+    if (!valid) {
+        ++null_count;
+    }
+}
+
+bool memdb::Table::Column::accepts(column_kind kind, const column_value &value) {
+    switch (kind) {
+        case INT32:
+            return std::holds_alternative<int>(value) || std::holds_alternative<std::monostate>(value);
+        case BOOL:
+            return std::holds_alternative<bool>(value) || std::holds_alternative<std::monostate>(value);
+        case STRING:
+            return std::holds_alternative<std::string>(value) || std::holds_alternative<std::monostate>(value);
+        case BYTES:
+            return std::holds_alternative<std::vector<uint8_t>>(value) ||
+                   std::holds_alternative<std::monostate>(value);
+    }
+    return false;
+}
+
+memdb::Table::column_value memdb::Table::Column::get(size_t index) const {
+    if (null_count != 0 && !validity.get(index)) {
+        return std::monostate{};
+    }
+    switch (kind) {
+        case INT32:
+            return ints[index];
+        case BOOL:
+            return bools.get(index);
+        case STRING:
+            return std::string(view(index));
+        case BYTES: {
+            std::string_view data = view(index);
+            return std::vector<uint8_t>(data.begin(), data.end());
+        }
+    }
+    return std::monostate{};
+}
+
+std::string_view memdb::Table::Column::view(size_t index) const {
+    if (code_width != 0) {
+        return dictionary[code(index)];
+    }
+    if (slot_width != 0) {
+        const char* slot = slots.data() + index * slot_width;
+        return {slot + 1, static_cast<uint8_t>(slot[0])};
+    }
+    return {arena.data() + offsets[index], offsets[index + 1] - offsets[index]};
+}
+
+uint32_t memdb::Table::Column::code(size_t index) const {
+    const uint8_t* source = codes.data() + index * code_width;
+    if (code_width == 1) {
+        return *source;
+    }
+    if (code_width == 2) {
+        uint16_t narrow;
+        std::memcpy(&narrow, source, sizeof(narrow));
+        return narrow;
+    }
+    uint32_t wide;
+    std::memcpy(&wide, source, sizeof(wide));
+    return wide;
+}
+
+int64_t memdb::Table::Column::find_code(std::string_view value) const {
+    auto position = dictionary_codes.find(std::string(value));
+    return position == dictionary_codes.end() ? -1 : position->second;
+}
+
+void memdb::Table::Column::rebuild_dictionary() {
+    dictionary_codes.clear();
+    dictionary_codes.reserve(dictionary.size());
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        dictionary_codes.emplace(dictionary[i], static_cast<uint32_t>(i));
+    }
+    code_width = code_width_for(dictionary.size());
+}
+
+size_t memdb::Table::Column::size() const {
+    return validity.size();
+}
+
+namespace {
+    // Растим хотя бы вдвое: точный reserve на каждую маленькую пачку сделал бы вставку квадратичной
+    template<typename Container>
+    void grow(Container &container, size_t needed) {
+        if (container.capacity() < needed) {
+            container.reserve(std::max(needed, 2 * container.capacity()));
+        }
+    }
+}
+
+void memdb::Table::Column::reserve(size_t size) {
+    if (kind == INT32) {
+        grow(ints, size);
+    } else if (code_width != 0) {
+        grow(codes, size * code_width);
+    } else if (slot_width != 0) {
+        grow(slots, size * slot_width);
+    } else if (kind == STRING || kind == BYTES) {
+        grow(offsets, size + 1);
+    }
+    grow(validity.words, (size + 63) / 64);
+}
+
+void memdb::Table::Column::erase(const Bitmap &selection) {
+    size_t count = size();
+    size_t write = 0;
+    size_t arena_write = 0;
+    Bitmap new_validity;
+    Bitmap new_bools;
+    null_count = 0;
+
+    for (size_t read = 0; read < count; ++read) {
+        if (selection.get(read)) {
+            continue;
+        }
+        bool valid = validity.get(read);
+        new_validity.push_back(valid);
+        if (!valid) {
+            ++null_count;
+        }
+
+        switch (kind) {
+            case INT32:
+                ints[write] = ints[read];
+                break;
+            case BOOL:
+                new_bools.push_back(bools.get(read));
+                break;
+            case STRING:
+            case BYTES: {
+                if (code_width != 0) {
+                    std::memmove(codes.data() + write * code_width, codes.data() + read * code_width, code_width);
+                    break;
+                }
+                if (slot_width != 0) {
+                    if (write != read) {
+                        std::memcpy(slots.data() + write * slot_width, slots.data() + read * slot_width, slot_width);
+                    }
+                    break;
+                }
+                uint32_t begin = offsets[read];
+                uint32_t length = offsets[read + 1] - begin;
+                // Сдвигаем данные влево: позиция записи никогда не правее позиции чтения
+                std::memmove(arena.data() + arena_write, arena.data() + begin, length);
+                offsets[write] = static_cast<uint32_t>(arena_write);
+                arena_write += length;
+                break;
+            }
+        }
+        ++write;
+    }
+
+    if (kind == INT32) {
+        ints.resize(write);
+    } else if (kind == BOOL) {
+        bools = std::move(new_bools);
+    } else if (code_width != 0) {
+        codes.resize(write * code_width);
+    } else if (slot_width != 0) {
+        slots.resize(write * slot_width);
+    } else {
+        arena.resize(arena_write);
+        offsets.resize(write + 1);
+        offsets[write] = static_cast<uint32_t>(arena_write);
+    }
+    validity = std::move(new_validity);
+}
+
+size_t memdb::Table::ValueHash::operator()(const column_value &value) const {
+    size_t hash = 0;
+    if (auto* number = std::get_if<int>(&value)) {
+        hash = std::hash<int>()(*number);
+    } else if (auto* str = std::get_if<std::string>(&value)) {
+        hash = std::hash<std::string>()(*str);
+    } else if (auto* flag = std::get_if<bool>(&value)) {
+        hash = std::hash<bool>()(*flag);
+    } else if (auto* bytes = std::get_if<std::vector<uint8_t>>(&value)) {
+        hash = std::hash<std::string_view>()(
+                std::string_view(reinterpret_cast<const char*>(bytes->data()), bytes->size()));
+    }
+    return hash ^ (value.index() * 0x9e3779b97f4a7c15ULL);
+}
+
+const memdb::Table::HashIndex *memdb::Table::hash_index(size_t column_index) const {
+    for (const auto &index: hash_indexes) {
+        if (index.column == column_index) {
+            return &index;
+        }
+    }
+    return nullptr;
+}
+
+const memdb::Table::OrderedIndex *memdb::Table::ordered_index(size_t column_index) const {
+    for (const auto &index: ordered_indexes) {
+        if (index.column == column_index) {
+            return &index;
+        }
+    }
+    return nullptr;
+}
+
+void memdb::Table::add_ordered_index(const std::string &index_name, size_t column_index) {
+    if (info_row[column_index].column_type.kind == ColumnType::BOOL) {
+        throw BadQuery("Bad query: ordered index on bool column '" + info_row[column_index].name + "'");
+    }
+    if (ordered_index(column_index) != nullptr) {
+        throw BadQuery("Bad query: column '" + info_row[column_index].name + "' is already indexed");
+    }
+
+    OrderedIndex index;
+    index.name = index_name;
+    index.column = column_index;
+    for (size_t i = 0; i < size(); ++i) {
+        if (is_live(i)) {
+            index.entries.emplace_hint(index.entries.end(), get(i, column_index), i);
+        }
+    }
+    ordered_indexes.push_back(std::move(index));
+}
+
+void memdb::Table::rebuild_catalog() {
+    column_positions.clear();
+    column_positions.reserve(info_row.size());
+    for (size_t i = 0; i < info_row.size(); ++i) {
+        column_positions.emplace(info_row[i].name, i);
+    }
+}
+
+size_t memdb::Table::column_position(std::string_view column_name) const {
+    // Схему, собранную без rebuild_catalog, или с повторяющимися именами просматриваем целиком
+    if (column_positions.size() != info_row.size()) {
+        for (size_t i = 0; i < info_row.size(); ++i) {
+            if (info_row[i].name == column_name) {
+                return i;
+            }
+        }
+        return static_cast<size_t>(-1);
+    }
+    auto position = column_positions.find(std::string(column_name));
+    return position == column_positions.end() ? static_cast<size_t>(-1) : position->second;
+}
+
+void memdb::Table::rebuild_indexes() {
+    hash_indexes.clear();
+    for (size_t i = 0; i < info_row.size(); ++i) {
+        if (!info_row[i].key && !info_row[i].unique) {
+            continue;
+        }
+        HashIndex index;
+        index.column = i;
+        index.positions.reserve(live_size());
+        for (size_t j = 0; j < size(); ++j) {
+            if (is_live(j)) {
+                index.positions.emplace(get(j, i), j);
+            }
+        }
+        hash_indexes.push_back(std::move(index));
+    }
+
+    for (auto &index: ordered_indexes) {
+        index.entries.clear();
+        for (size_t i = 0; i < size(); ++i) {
+            if (is_live(i)) {
+                index.entries.emplace_hint(index.entries.end(), get(i, index.column), i);
+            }
+        }
+    }
+}
+
+void memdb::Table::use_column_layout() {
+    if (size() != 0) {
+        throw BadQuery("Bad query: layout of a non-empty table can't be changed");
+    }
+    layout = COLUMN_LAYOUT;
+    columns.clear();
+    for (const auto &info: info_row) {
+        columns.emplace_back(info);
+    }
+}
+
+size_t memdb::Table::size() const {
+    if (layout == COLUMN_LAYOUT) {
+        return columns.empty() ? 0 : columns[0].size();
+    }
+    return rows.size();
+}
+
+size_t memdb::Table::live_size() const {
+    return size() - dead_rows;
+}
+
+bool memdb::Table::is_live(size_t row_index) const {
+    return row_index >= deleted.size() || !deleted.get(row_index);
+}
+
+memdb::Table::column_value memdb::Table::get(size_t row_index, size_t column_index) const {
+    if (layout == COLUMN_LAYOUT) {
+        return columns[column_index].get(row_index);
+    }
+    return rows[row_index].values[column_index];
+}
+
+memdb::Table::row memdb::Table::get_row(size_t row_index) const {
+    if (layout == ROW_LAYOUT) {
+        return rows[row_index];
+    }
+    row result;
+    result.values.reserve(columns.size());
+    for (const auto &column: columns) {
+        result.values.push_back(column.get(row_index));
+    }
+    return result;
+}
+
+void memdb::Table::add_row(const row &row) {
+    size_t row_index = size();
+    if (layout == ROW_LAYOUT) {
+        rows.emplace_back(row);
+    } else {
+        append_columns(row);
+    }
+    for (auto &index: hash_indexes) {
+        index.positions.emplace(row.values[index.column], row_index);
+    }
+    for (auto &index: ordered_indexes) {
+        index.entries.emplace(row.values[index.column], row_index);
+    }
+    deleted.resize(row_index + 1);
+    created_versions.resize(row_index + 1, write_version);
+    deleted_versions.resize(row_index + 1, LIVE_VERSION);
+}
+
+void memdb::Table::append_columns(const row &row) {
+    // Сначала проверяем типы, чтобы не оставить колонки разной длины
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (!Column::accepts(columns[i].kind, row.values[i])) {
+            throw BadQuery("Bad query: value type doesn't match column '" + info_row[i].name + "'");
+        }
+    }
+    for (size_t i = 0; i < columns.size(); ++i) {
+        columns[i].append(row.values[i]);
+    }
+}
+
+void memdb::Table::prepare_rows(std::vector<row> &batch) {
+    for (const auto &new_row: batch) {
+        if (new_row.values.size() != info_row.size()) {
+            throw BadQuery("Bad query: row has " + std::to_string(new_row.values.size()) + " values, table '" +
+                           name + "' has " + std::to_string(info_row.size()) + " columns");
+        }
+    }
+
+    std::vector<int> counters;
+    counters.reserve(info_row.size());
+    for (const auto &info: info_row) {
+        counters.push_back(info.auto_increment_counter);
+    }
+
+    // Проверяем по колонкам: разбор типа и поиск индекса делаются один раз на пачку
+    for (size_t i = 0; i < info_row.size(); ++i) {
+        const column_info &info = info_row[i];
+        const ColumnType &type = info.column_type;
+
+        bool check_unique = info.key || info.unique;
+        const HashIndex *index = check_unique ? hash_index(i) : nullptr;
+        std::unordered_set<column_value, ValueHash> existing; // Только если индекса почему-то нет
+        if (check_unique && index == nullptr) {
+            for (size_t j = 0; j < size(); ++j) {
+                if (is_live(j)) {
+                    existing.insert(get(j, i));
+                }
+            }
+        }
+        std::unordered_set<column_value, ValueHash> in_batch;
+        if (check_unique && batch.size() > 1) {
+            in_batch.reserve(batch.size());
+        }
+
+        for (auto &new_row: batch) {
+            column_value &value = new_row.values[i];
+            if (std::holds_alternative<std::monostate>(value)) {
+                if (info.autoincrement) {
+                    value = counters[i]++;
+                } else if (!std::holds_alternative<std::monostate>(info.default_value)) {
+                    value = info.default_value;
+                } else {
+                    throw BadQuery("Bad query: missing value for column '" + info.name + "'");
+                }
+            }
+
+            if (!type.matches(value)) {
+                throw BadQuery("Bad query: value type doesn't match column '" + info.name + "'");
+            }
+            if (!type.accepts(value)) {
+                throw BadQuery(std::string("Bad query: ") +
+                               (type.kind == ColumnType::STRING ? "string value" : "byte sequence") +
+                               " too long for column '" + info.name + "'");
+            }
+
+            if (check_unique) {
+                bool duplicate = index != nullptr ? index->positions.count(value) != 0 : existing.count(value) != 0;
+                if (!duplicate && batch.size() > 1) {
+                    duplicate = !in_batch.insert(value).second;
+                }
+                if (duplicate) {
+                    throw BadQuery("Bad query: duplicate value for unique or key column '" + info.name + "'");
+                }
+            }
+        }
+    }
+
+    // Диапазоны autoincrement выдаём только после успешной проверки всей пачки
+    for (size_t i = 0; i < info_row.size(); ++i) {
+        info_row[i].auto_increment_counter = counters[i];
+    }
+}
+
+void memdb::Table::bulk_load(std::vector<row> batch) {
+    prepare_rows(batch);
+
+    size_t first = size();
+    for (auto &index: hash_indexes) {
+        size_t needed = index.positions.size() + batch.size();
+        if (static_cast<double>(needed) >
+            static_cast<double>(index.positions.bucket_count()) * index.positions.max_load_factor()) {
+            index.positions.reserve(std::max(needed, 2 * index.positions.size()));
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            index.positions.emplace(batch[i].values[index.column], first + i);
+        }
+    }
+    for (auto &index: ordered_indexes) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            index.entries.emplace(batch[i].values[index.column], first + i);
+        }
+    }
+
+    if (layout == ROW_LAYOUT) {
+        grow(rows, first + batch.size());
+        for (auto &new_row: batch) {
+            rows.push_back(std::move(new_row));
+        }
+    } else {
+        for (auto &column: columns) {
+            column.reserve(first + batch.size());
+        }
+        for (const auto &new_row: batch) {
+            for (size_t i = 0; i < columns.size(); ++i) {
+                columns[i].append(new_row.values[i]);
+            }
+        }
+    }
+    deleted.resize(size());
+    created_versions.resize(size(), write_version);
+    deleted_versions.resize(size(), LIVE_VERSION);
+}
+
+void memdb::Table::erase_rows(const Bitmap &selection) {
+    Bitmap remaining_deleted;
+    dead_rows = 0;
+    created_versions.resize(size(), 0);
+    deleted_versions.resize(size(), LIVE_VERSION);
+    size_t kept = 0;
+    for (size_t i = 0; i < size(); ++i) {
+        if (!selection.get(i)) {
+            remaining_deleted.push_back(!is_live(i));
+            dead_rows += is_live(i) ? 0 : 1;
+            created_versions[kept] = created_versions[i];
+            deleted_versions[kept] = deleted_versions[i];
+            ++kept;
+        }
+    }
+    created_versions.resize(kept);
+    deleted_versions.resize(kept);
+
+    if (layout == COLUMN_LAYOUT) {
+        for (auto &column: columns) {
+            column.erase(selection);
+        }
+    } else {
+        size_t write = 0;
+        for (size_t read = 0; read < rows.size(); ++read) {
+            if (!selection.get(read)) {
+                if (write != read) {
+                    rows[write] = std::move(rows[read]);
+                }
+                ++write;
+            }
+        }
+        rows.resize(write);
+    }
+    deleted = std::move(remaining_deleted);
+
+    if (!hash_indexes.empty() || !ordered_indexes.empty()) {
+        rebuild_indexes(); // Номера строк сдвинулись
+    }
+}
+
+void memdb::Table::delete_rows(const Bitmap &selection) {
+    deleted.resize(size());
+    deleted_versions.resize(size(), LIVE_VERSION);
+    for (size_t word = 0; word < selection.words.size(); ++word) {
+        uint64_t fresh = selection.words[word] & ~deleted.words[word];
+        deleted.words[word] |= fresh;
+        for (; fresh != 0; fresh &= fresh - 1) {
+            size_t row_index = word * 64 + __builtin_ctzll(fresh);
+            ++dead_rows;
+            deleted_versions[row_index] = write_version;
+
+            for (auto &index: hash_indexes) {
+                index.positions.erase(get(row_index, index.column));
+            }
+            for (auto &index: ordered_indexes) {
+                auto range = index.entries.equal_range(get(row_index, index.column));
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (it->second == row_index) {
+                        index.entries.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+}
+
+bool memdb::Table::needs_compaction() const {
+    return dead_rows != 0 && static_cast<double>(dead_rows) > compaction_threshold * static_cast<double>(size());
+}
+
+bool memdb::Table::visible(size_t row_index, uint64_t version) const {
+    if (row_index >= created_versions.size()) {
+        return is_live(row_index);
+    }
+    return created_versions[row_index] <= version && version < deleted_versions[row_index];
+}
+
+void memdb::Table::compact() {
+    if (dead_rows == 0) {
+        return;
+    }
+    Bitmap dead = deleted;
+    dead.resize(size());
+    erase_rows(dead);
+    ++compactions;
+}
+
+bool memdb::read_int(const Table& table, size_t row_index, size_t column_index, int32_t& out) {
+    if (table.layout == Table::COLUMN_LAYOUT) {
+        const Table::Column& column = table.columns[column_index];
+        if (column.null_count != 0 && !column.validity.get(row_index)) {
+            return false;
+        }
+        out = column.kind == Table::Column::BOOL ? column.bools.get(row_index) : column.ints[row_index];
+        return true;
+    }
+    const Table::column_value& value = table.rows[row_index].values[column_index];
+    if (const int* number = std::get_if<int>(&value)) {
+        out = *number;
+        return true;
+    }
+    if (const bool* flag = std::get_if<bool>(&value)) {
+        out = *flag;
+        return true;
+    }
+    return false;
+}
+
+bool memdb::read_bytes(const Table& table, size_t row_index, size_t column_index, std::string_view& out) {
+    bool quoted = table.info_row[column_index].column_type.kind == Table::ColumnType::STRING;
+    if (table.layout == Table::COLUMN_LAYOUT) {
+        const Table::Column& column = table.columns[column_index];
+        if (column.null_count != 0 && !column.validity.get(row_index)) {
+            return false;
+        }
+        out = column.view(row_index);
+    } else {
+        const Table::column_value& value = table.rows[row_index].values[column_index];
+        if (const std::string* text = std::get_if<std::string>(&value)) {
+            out = *text;
+        } else if (const auto* data = std::get_if<std::vector<uint8_t>>(&value)) {
+            out = {reinterpret_cast<const char*>(data->data()), data->size()};
+        } else {
+            return false;
+        }
+    }
+    if (quoted && out.size() >= 2) {
+        out = out.substr(1, out.size() - 2);
+    }
+    return true;
+}
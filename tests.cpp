@@ -1,5 +1,10 @@
 #include <iostream>
 #include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <tuple>
+#include <algorithm>
 #include "memdb.h"
 #include "exceptions.h"
 
@@ -130,14 +135,21 @@ void Test4() {
     for (int i = 0; i < 10; i++) {
         db.execute("insert (,\"number" + std::to_string(i) + "\") to users");
     }
-    db.execute("select id from users where id < 3");
+    memdb::ResultSet result = db.execute("select id from users where id < 3");
 
-    assert(db.tables[1].name == "select_table");
-    assert(db.tables[1].info_row[0].autoincrement == true);
-    assert(db.tables[1].info_row[0].unique == false);
-    assert(db.tables[1].info_row[0].key == false);
-    assert(std::get_if<std::monostate>(&db.tables[1].info_row[0].default_value));
-    assert(db.tables[1].info_row[0].type == "int32");
+    assert(db.tables.size() == 1);
+    assert(result.size() == 3);
+    assert(result.column_count() == 1);
+    assert(result.column(0).autoincrement == true);
+    assert(std::get_if<std::monostate>(&result.column(0).default_value));
+    assert(result.column(0).type == "int32");
+    assert(std::get<int>(result.get(2, 0)) == 2);
+
+    memdb::Table select_table = result.materialize();
+    assert(select_table.name == "select_table");
+    assert(select_table.info_row[0].unique == false);
+    assert(select_table.info_row[0].key == false);
+    assert(select_table.rows.size() == 3);
     if (auto* value = std::get_if<int>(&db.tables[0].rows[0].values[0])) {
         assert(*value == 0);
     }
@@ -326,13 +338,1699 @@ void Test9() {
     db.execute("insert (,\"admin2\", 40, true) to users");
     db.execute("insert (,\"user2\", 35, false) to users");
 
-    db.execute("select id, login from users where is_admin && age <= 35 && id > 0");
+    auto result = db.execute("select id, login from users where is_admin && age <= 35 && id > 0");
 
-    assert(db.tables[1].rows.empty());
+    assert(result.empty());
 
     std::cout << "Test9 passed!" << std::endl;
 }
 
+void Test10() {
+    /*
+     * Подготовленные запросы с параметрами
+     */
+    std::cout << "================ TEST 10 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, {unique} login: string[16], age: int32)");
+
+    memdb::PreparedStatement insert = db.prepare("insert (login = ?, age = ?) to users");
+    assert(insert.parameter_count() == 2);
+    assert(insert.type() == memdb::PreparedStatement::INSERT);
+    for (int i = 0; i < 5; i++) {
+        insert.bind(0, "user" + std::to_string(i));
+        insert.bind(1, 20 + i);
+        insert.execute();
+    }
+
+    assert(db.tables[0].rows.size() == 5);
+    if (auto* value = std::get_if<std::string>(&db.tables[0].rows[3].values[1])) {
+        assert(*value == "\"user3\"");
+    } else {
+        assert(false);
+    }
+
+    bool thrown = false;
+    try {
+        insert.bind(0, "user0");
+        insert.execute();
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    thrown = false;
+    try {
+        insert.clear_bindings();
+        insert.execute();
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    memdb::PreparedStatement select = db.prepare("select id, login from users where age >= ?");
+    select.bind(0, 22);
+    auto result = select.execute();
+    assert(result.size() == 3);
+    assert(std::get<std::string>(result.get(0, 1)) == "\"user2\"");
+
+    memdb::PreparedStatement remove = db.prepare("delete users where login == ?");
+    remove.bind(0, "user1");
+    remove.execute();
+    assert(db.tables[0].live_size() == 4);
+
+    std::cout << "Test10 passed!" << std::endl;
+}
+
+void Test11() {
+    /*
+     * Приоритет && над || и скобки в условии
+     */
+    std::cout << "================ TEST 11 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, login: string[16], age: int32, is_admin: bool)");
+
+    db.execute("insert (,\"admin1\", 30, true) to users");
+    db.execute("insert (,\"user1\", 25, false) to users");
+    db.execute("insert (,\"admin2\", 40, true) to users");
+    db.execute("insert (,\"user2\", 35, false) to users");
+
+    assert(db.execute("select id from users where is_admin && age > 35 || id == 3").size() == 2);
+    assert(db.execute("select id from users where (id == 0 || id == 1) && age < 30").size() == 1);
+
+    memdb::Predicate predicate = memdb::compile_condition(
+            memdb::tokenize("is_admin && (age <= 30 || login == \"admin2\")"), db.tables[0].info_row);
+    assert(predicate.evaluate(db.tables[0].rows[0]));
+    assert(!predicate.evaluate(db.tables[0].rows[1]));
+    assert(predicate.evaluate(db.tables[0].rows[2]));
+
+    bool thrown = false;
+    try {
+        db.execute("select id from users where (id == 0 || id == 1");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    std::cout << "Test11 passed!" << std::endl;
+}
+
+void Test12() {
+    /*
+     * Колоночное хранилище: insert, select и delete
+     */
+    std::cout << "================ TEST 12 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, {unique} login: string[16], "
+               "hash: bytes[4], is_admin: bool = false) {columnar}");
+
+    auto& users = db.tables[0];
+    assert(users.layout == memdb::Table::COLUMN_LAYOUT);
+    assert(users.columns.size() == 4);
+
+    for (int i = 0; i < 10; i++) {
+        db.execute("insert (,\"user" + std::to_string(i) + "\", 0x0" + std::to_string(i) + "ff, " +
+                   (i % 3 == 0 ? "true" : "false") + ") to users");
+    }
+    assert(users.size() == 10);
+    assert(users.rows.empty());
+    assert(users.columns[0].ints.size() == 10);
+    assert(std::get<std::string>(users.get(4, 1)) == "\"user4\"");
+    assert(std::get<std::vector<uint8_t>>(users.get(4, 2)) == std::vector<uint8_t>({0x04, 0xff}));
+    assert(std::get<bool>(users.get(3, 3)));
+
+    bool thrown = false;
+    try {
+        db.execute("insert (,\"user1\", 0x00) to users");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(users.size() == 10);
+
+    assert(db.execute("select id, login from users where is_admin || login == \"user5\" && hash >= 0x05").size() == 5);
+
+    db.execute("delete users where id >= 2 && id < 8");
+    assert(users.size() == 4);
+    assert(std::get<int>(users.get(2, 0)) == 8);
+    assert(std::get<std::string>(users.get(2, 1)) == "\"user8\"");
+    assert(std::get<bool>(users.get(3, 3)));
+
+    std::cout << "Test12 passed!" << std::endl;
+}
+
+void Test13() {
+    /*
+     * Хеш-индексы по колонкам key/unique: проверка уникальности и точечный поиск
+     */
+    std::cout << "================ TEST 13 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, {unique} login: string[16], age: int32)");
+
+    auto& users = db.tables[0];
+    assert(users.hash_indexes.size() == 2);
+    assert(users.hash_index(0) != nullptr);
+    assert(users.hash_index(2) == nullptr);
+
+    memdb::PreparedStatement insert = db.prepare("insert (login = ?, age = ?) to users");
+    for (int i = 0; i < 2000; i++) {
+        insert.bind(0, "user" + std::to_string(i));
+        insert.bind(1, i % 50);
+        insert.execute();
+    }
+    assert(users.hash_index(1)->positions.size() == 2000);
+
+    auto result = db.execute("select id, age from users where login == \"user1234\"");
+    assert(result.size() == 1);
+    assert(std::get<int>(result.get(0, 0)) == 1234);
+
+    assert(db.execute("select id from users where age == 10 && login == \"user1234\"").empty());
+
+    db.execute("delete users where id == 7");
+    assert(users.live_size() == 1999);
+    assert(users.hash_index(1)->positions.count(std::string("\"user7\"")) == 0);
+    assert(users.hash_index(1)->positions.at(std::string("\"user8\"")) == 8);
+
+    insert.bind(0, "user7");
+    insert.execute();
+
+    bool thrown = false;
+    try {
+        insert.bind(0, "user8");
+        insert.execute();
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    std::cout << "Test13 passed!" << std::endl;
+}
+
+void Test14() {
+    /*
+     * create index и выборка по диапазону через упорядоченный индекс
+     */
+    std::cout << "================ TEST 14 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, login: string[16], age: int32)");
+    for (int i = 0; i < 100; i++) {
+        db.execute("insert (,\"user" + std::to_string(i) + "\", " + std::to_string(i % 60) + ") to users");
+    }
+
+    db.execute("create index users_age on users(age)");
+    auto& users = db.tables[0];
+    assert(users.ordered_indexes.size() == 1);
+    assert(users.ordered_index(2)->name == "users_age");
+    assert(users.ordered_index(2)->entries.size() == 100);
+
+    auto result = db.execute("select id, age from users where age >= 30 && age < 40");
+    assert(result.size() == 20);
+    for (size_t i = 1; i < result.size(); i++) {
+        assert(std::get<int>(result.get(i - 1, 0)) < std::get<int>(result.get(i, 0)));
+    }
+
+    assert(db.execute("select id from users where age == 5 && id > 50").size() == 1);
+    assert(db.execute("select id from users where age > 57 || id == 0").size() == 3);
+
+    db.execute("delete users where age < 10");
+    assert(users.live_size() == 80);
+    assert(users.ordered_index(2)->entries.size() == 80);
+    assert(users.ordered_index(2)->entries.begin()->first == memdb::Table::column_value(10));
+
+    db.execute("insert (,\"late\", 1) to users");
+    assert(db.execute("select id from users where age <= 1").size() == 1);
+
+    bool thrown = false;
+    try {
+        db.execute("create index users_age on users(login)");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // index и on зарезервированы только внутри create index
+    db.execute("create table a (index: int32, on: int32)");
+    db.execute("create table on (id: int32)");
+    db.execute("insert (index = 1, on = 2) to a");
+    db.execute("create index a_on on a(on)");
+    result = db.execute("select index, on from a where on == 2");
+    assert(result.size() == 1 && std::get<int>(result.get(0, 0)) == 1);
+    assert(db.execute("select id from on where id > 0").size() == 0);
+
+    std::cout << "Test14 passed!" << std::endl;
+}
+
+void Test15() {
+    /*
+     * Векторные фильтры: все наборы инструкций дают одинаковые битовые маски
+     */
+    std::cout << "================ TEST 15 ================" << std::endl;
+
+    std::vector<int32_t> values;
+    for (int i = 0; i < 1000; i++) {
+        values.push_back((i * 7919) % 201 - 100);
+    }
+
+    const memdb::Predicate::compare_op ops[] = {memdb::Predicate::EQ, memdb::Predicate::NE, memdb::Predicate::LT,
+                                                memdb::Predicate::GT, memdb::Predicate::LE, memdb::Predicate::GE};
+    const memdb::filter_isa isas[] = {memdb::SCALAR, memdb::SSE2, memdb::AVX2};
+    for (size_t count: {0, 1, 63, 64, 65, 130, 1000}) {
+        for (auto op: ops) {
+            std::vector<uint64_t> expected((count + 63) / 64 + 1, 0);
+            memdb::compare_int32(values.data(), count, op, 3, expected.data(), memdb::SCALAR);
+            for (size_t i = 0; i < count; i++) {
+                bool bit = (expected[i / 64] >> (i % 64)) & 1;
+                assert(bit == memdb::compare_values(op, values[i], 3));
+            }
+            for (auto isa: isas) {
+                if (!memdb::filter_isa_supported(isa)) {
+                    continue;
+                }
+                std::vector<uint64_t> actual((count + 63) / 64 + 1, 0);
+                memdb::compare_int32(values.data(), count, op, 3, actual.data(), isa);
+                assert(actual == expected);
+            }
+        }
+    }
+
+    memdb::Database db;
+    db.execute("create table rows_t (id: int32, flag: bool, name: string[8])");
+    db.execute("create table cols_t (id: int32, flag: bool, name: string[8]) {columnar}");
+    for (int i = 0; i < 200; i++) {
+        std::string values_text = "(" + std::to_string(values[i] + 100) + ", " + (i % 3 ? "true" : "false") +
+                                  ", \"n" + std::to_string(i % 10) + "\")";
+        db.execute("insert " + values_text + " to rows_t");
+        db.execute("insert " + values_text + " to cols_t");
+    }
+
+    for (const char* condition: {"id < 50", "flag", "flag == false || id >= 150",
+                                 "(name == \"n3\" || name > \"n7\") && id != 100", "name"}) {
+        auto by_rows = memdb::check_condition(memdb::tokenize(condition), db.tables[0]);
+        auto by_columns = memdb::check_condition(memdb::tokenize(condition), db.tables[1]);
+        assert(by_rows.size() == 200);
+        assert(by_rows.words == by_columns.words);
+        auto predicate = memdb::compile_condition(memdb::tokenize(condition), db.tables[0].info_row);
+        for (size_t i = 0; i < 200; i++) {
+            assert(predicate.evaluate(db.tables[0].rows[i]) == by_rows.get(i));
+        }
+    }
+
+    std::cout << "Test15 passed!" << std::endl;
+}
+
+void Test16() {
+    /*
+     * Удаление через надгробия и уплотнение по порогу
+     */
+    std::cout << "================ TEST 16 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table users ({key, autoincrement} id: int32, age: int32)") + layout);
+        auto& users = db.tables[0];
+        users.compaction_threshold = 0.5;
+
+        memdb::PreparedStatement insert = db.prepare("insert (age = ?) to users");
+        for (int i = 0; i < 1000; i++) {
+            insert.bind(0, i % 10);
+            insert.execute();
+        }
+
+        db.execute("delete users where age == 0");
+        assert(users.size() == 1000);
+        assert(users.live_size() == 900);
+        assert(users.dead_rows == 100);
+        assert(users.compactions == 0);
+        assert(!users.is_live(0) && users.is_live(1));
+
+        assert(db.execute("select id from users where age < 2").size() == 100);
+        assert(db.execute("select id from users where id == 10").empty());
+
+        db.execute("delete users where age == 1");
+        db.execute("delete users where age == 1");
+        assert(users.dead_rows == 200);
+        assert(users.compactions == 0);
+
+        users.compact();
+        assert(users.size() == 800);
+        assert(users.dead_rows == 0);
+        assert(users.compactions == 1);
+        assert(std::get<int>(users.get(0, 0)) == 2);
+        assert(users.hash_index(0)->positions.at(2) == 0);
+
+        db.execute("delete users where age < 7");
+        assert(users.compactions == 2);
+        assert(users.size() == 300);
+        assert(std::get<int>(users.get(0, 0)) == 7);
+
+        db.execute("insert (id = 0, age = 0) to users");
+        assert(db.execute("select id from users where age == 0").size() == 1);
+    }
+
+    std::cout << "Test16 passed!" << std::endl;
+}
+
+void Test17() {
+    /*
+     * Параллельное сканирование кусками на пуле потоков совпадает с однопоточным
+     */
+    std::cout << "================ TEST 17 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table numbers (id: int32, value: int32, even: bool)") + layout);
+        auto& numbers = db.tables[0];
+        for (int i = 0; i < 5000; i++) {
+            numbers.add_row(memdb::Table::row{{i, (i * 7919) % 1000, i % 2 == 0}});
+        }
+
+        const char* query = "select id from numbers where value < 100 || even && value > 900";
+        db.set_parallelism(1);
+        auto single = db.execute(query);
+
+        db.set_parallelism(4);
+        db.parallel_threshold = 1000;
+        db.morsel_size = 100; // Округляется до 64
+        auto parallel = db.execute(query);
+        assert(db.thread_pool()->size() == 3);
+        assert(single.size() == parallel.size());
+        for (size_t i = 0; i < single.size(); i++) {
+            assert(single.row_id(i) == parallel.row_id(i));
+        }
+
+        db.execute("delete numbers where value >= 500");
+        assert(numbers.live_size() == 2500);
+        db.set_parallelism(1);
+        assert(db.execute("select id from numbers where value >= 250").size() == 1250);
+    }
+
+    memdb::ThreadPool pool(2);
+    std::vector<int> hits(100, 0);
+    pool.parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+    assert(std::count(hits.begin(), hits.end(), 1) == 100);
+
+    bool thrown = false;
+    try {
+        pool.parallel_for(10, [](size_t i) {
+            if (i == 5) {
+                throw memdb::BadQuery("Bad query: test");
+            }
+        });
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Смена числа потоков во время чтения: идущие сканирования дорабатывают на прежнем пуле
+    memdb::Database db;
+    db.execute("create table numbers (id: int32, value: int32)");
+    for (int i = 0; i < 5000; i++) {
+        db.tables[0].add_row(memdb::Table::row{{i, i % 1000}});
+    }
+    db.parallel_threshold = 1000;
+    db.morsel_size = 100;
+    std::atomic<bool> wrong{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; ++r) {
+        readers.emplace_back([&db, &wrong]() {
+            for (int i = 0; i < 100; ++i) {
+                if (db.execute("select id from numbers where value < 100").size() != 500) {
+                    wrong = true;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 100; ++i) {
+        db.set_parallelism(2 + i % 3);
+    }
+    for (auto& reader: readers) {
+        reader.join();
+    }
+    assert(!wrong);
+    assert(db.parallelism() == 2 && db.thread_pool()->size() == 1);
+
+    std::cout << "Test17 passed!" << std::endl;
+}
+
+void Test18() {
+    /*
+     * insert нескольких строк и пакетная загрузка с проверкой всей пачки
+     */
+    std::cout << "================ TEST 18 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table users ({key, autoincrement} id: int32, {unique} login: string[8], "
+                               "is_admin: bool = false)") + layout);
+        auto& users = db.tables[0];
+
+        db.execute("insert (,\"a\",), (,\"b\", true), (login = \"c\") to users");
+        assert(users.size() == 3);
+        assert(std::get<int>(users.get(2, 0)) == 2);
+        assert(std::get<bool>(users.get(1, 2)));
+        assert(db.execute("select id from users where login == \"c\"").size() == 1);
+
+        memdb::PreparedStatement insert = db.prepare("insert (login = ?), (login = ?) to users");
+        assert(insert.parameter_count() == 2);
+        insert.bind(0, "d");
+        insert.bind(1, "e");
+        insert.execute();
+        assert(users.size() == 5);
+
+        std::vector<memdb::Table::row> batch;
+        for (int i = 0; i < 1000; i++) {
+            batch.push_back({{std::monostate{}, "\"u" + std::to_string(i) + "\"", i % 2 == 0}});
+        }
+        db.bulk_insert("users", batch);
+        assert(users.size() == 1005);
+        assert(std::get<int>(users.get(1004, 0)) == 1004);
+        assert(users.info_row[0].auto_increment_counter == 1005);
+        assert(users.hash_index(1)->positions.at(std::string("\"u500\"")) == 505);
+
+        // Дубликат внутри пачки, слишком длинная строка и значение не того типа отклоняют всю пачку
+        for (const auto& bad_row: {memdb::Table::row{{std::monostate{}, "\"x\"", false}},
+                                   memdb::Table::row{{std::monostate{}, "\"toolongname\"", false}},
+                                   memdb::Table::row{{std::monostate{}, 5, false}}}) {
+            std::vector<memdb::Table::row> bad_batch = {{{std::monostate{}, "\"x\"", false}}, bad_row};
+            bool thrown = false;
+            try {
+                db.bulk_insert("users", bad_batch);
+            }
+            catch (memdb::BadQuery&) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+        assert(users.size() == 1005);
+        assert(users.info_row[0].auto_increment_counter == 1005);
+
+        bool thrown = false;
+        try {
+            db.execute("insert (,\"f\",), (,\"a\",) to users");
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(users.size() == 1005);
+    }
+
+    std::cout << "Test18 passed!" << std::endl;
+}
+
+void Test19() {
+    /*
+     * Журнал изменений: восстановление базы повтором журнала и отбрасывание недописанного хвоста
+     */
+    std::cout << "================ TEST 19 ================" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "memdb_test19.wal").string();
+
+    for (auto policy: {memdb::WriteAheadLog::SYNC_ALWAYS, memdb::WriteAheadLog::SYNC_GROUP,
+                       memdb::WriteAheadLog::SYNC_OFF}) {
+        std::filesystem::remove(path);
+        memdb::WriteAheadLog::Options options;
+        options.policy = policy;
+        options.group_records = 4;
+
+        {
+            memdb::Database db;
+            db.open_wal(path, options);
+            db.execute("create table users ({key, autoincrement} id: int32, {unique} login: string[16], "
+                       "age: int32 = 18) {columnar}");
+            db.execute("insert (,\"admin\", 40), (,\"guest\",) to users");
+
+            memdb::PreparedStatement insert = db.prepare("insert (login = ?, age = ?) to users");
+            for (int i = 0; i < 10; i++) {
+                insert.bind(0, "user" + std::to_string(i));
+                insert.bind(1, 20 + i);
+                insert.execute();
+            }
+            db.bulk_insert("users", {{{std::monostate{}, "\"bulk\"", 99}}});
+            db.execute("delete users where age < 22");
+            db.execute("create index users_age on users(age)");
+
+            try {
+                db.execute("insert (,\"admin\", 1) to users"); // Не попадает в журнал
+            }
+            catch (memdb::BadQuery&) {}
+
+            assert(db.wal_log()->records() == 15);
+            if (policy == memdb::WriteAheadLog::SYNC_ALWAYS) {
+                assert(db.wal_log()->syncs() == 16); // Заголовок и каждая запись
+            }
+        }
+
+        memdb::Database restored;
+        restored.open_wal(path, options);
+        auto& users = restored.tables[0];
+        assert(users.layout == memdb::Table::COLUMN_LAYOUT);
+        assert(users.live_size() == 10);
+        assert(users.ordered_index(2) != nullptr);
+        assert(users.info_row[0].auto_increment_counter == 13);
+        auto result = restored.execute("select id, login from users where age == 99");
+        assert(result.size() == 1);
+        assert(std::get<int>(result.get(0, 0)) == 12);
+        assert(restored.execute("select id from users where login == \"guest\"").empty());
+    }
+
+    // Недописанная запись в конце отбрасывается, новые записи идут после последней целой
+    auto size = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, size - 3);
+    {
+        memdb::Database db;
+        db.open_wal(path);
+        assert(db.tables[0].ordered_indexes.empty());
+        db.execute("insert (,\"late\", 50) to users");
+    }
+    memdb::Database restored;
+    restored.open_wal(path);
+    assert(restored.tables[0].live_size() == 11);
+    restored.close_wal();
+
+    // Заголовок записи с длиной больше остатка файла — тоже недописанный хвост, память под него не выделяется
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        file.write("\xff\xff\xff\xff\x00\x00\x00\x00\x01", 9);
+    }
+    memdb::Database torn;
+    torn.open_wal(path);
+    assert(torn.tables[0].live_size() == 11);
+    torn.close_wal();
+    std::filesystem::remove(path);
+
+    // При SYNC_GROUP одиночная запись попадает на диск по истечении group_interval и без следующего append
+    {
+        memdb::WriteAheadLog::Options options;
+        options.group_records = 1000;
+        options.group_interval = std::chrono::milliseconds(20);
+        memdb::Database db;
+        db.open_wal(path, options);
+        db.execute("create table idle (id: int32)");
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (db.wal_log()->syncs() < 2 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(db.wal_log()->syncs() == 2); // Заголовок и create table
+        assert(std::filesystem::file_size(path) == db.wal_log()->position());
+    }
+    std::filesystem::remove(path);
+
+    std::cout << "Test19 passed!" << std::endl;
+}
+
+void Test20() {
+    /*
+     * Сохранение и загрузка двоичного снимка для обоих видов хранилища
+     */
+    std::cout << "================ TEST 20 ================" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "memdb_test20.snapshot").string();
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, {unique} login: string[16], hash: bytes[4], "
+               "is_admin: bool = false)");
+    db.execute("create table events (id: int32, name: string[16], payload: bytes[4], ok: bool) {columnar}");
+    for (int i = 0; i < 300; i++) {
+        std::string tail = std::to_string(i) + "\", 0x" + (i % 2 ? "0a0b" : "") + "ff, " + (i % 3 ? "true" : "false");
+        db.execute("insert (,\"user" + tail + ") to users");
+        db.execute("insert (" + std::to_string(i) + ", \"event" + tail + ") to events");
+    }
+    db.execute("create index events_id on events(id)");
+    db.execute("delete users where id < 10");
+    db.execute("delete events where id >= 290");
+    db.save_snapshot(path);
+    assert(!std::filesystem::exists(path + ".tmp"));
+
+    // Неудачное сохранение не трогает прежний снимок: запись идёт во временный файл
+    std::filesystem::create_directory(path + ".tmp");
+    bool thrown = false;
+    try {
+        db.execute("insert (,\"extra\", 0x00,) to users");
+        db.save_snapshot(path);
+    }
+    catch (memdb::StorageError&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::filesystem::remove(path + ".tmp");
+    db.execute("delete users where login == \"extra\"");
+
+    memdb::Database restored;
+    restored.load_snapshot(path);
+    assert(restored.tables.size() == 2);
+    auto& users = restored.tables[0];
+    auto& events = restored.tables[1];
+    assert(users.layout == memdb::Table::ROW_LAYOUT && events.layout == memdb::Table::COLUMN_LAYOUT);
+    assert(users.size() == 290 && events.size() == 290);
+    assert(users.info_row[0].auto_increment_counter == 300);
+    assert(std::get<bool>(users.info_row[3].default_value) == false);
+    assert(users.hash_index(1)->positions.at(std::string("\"user10\"")) == 0);
+    assert(events.ordered_index(0)->name == "events_id");
+
+    for (size_t i = 0; i < 290; i++) {
+        assert(users.get_row(i).values == db.tables[0].get_row(i + 10).values);
+        assert(events.get_row(i).values == db.tables[1].get_row(i).values);
+    }
+    assert(restored.execute("select id from events where id >= 100 && id < 110 && ok").size() == 7);
+    restored.execute("insert (,\"user1000\", 0x00,) to users");
+    assert(std::get<int>(users.get(290, 0)) == 300);
+
+    // Таблицы базы могут быть нужны запросам и результатам, поэтому снимок загружается только в пустую базу
+    memdb::PreparedStatement prepared = restored.prepare("select id from users where id == ?");
+    thrown = false;
+    try {
+        restored.load_snapshot(path);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown && restored.tables.size() == 2);
+    prepared.bind(0, 300);
+    assert(prepared.execute().size() == 1);
+
+    // Испорченный байт данных ловится контрольной суммой
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(-20, std::ios::end);
+        file.put('x');
+    }
+    thrown = false;
+    try {
+        memdb::Database broken;
+        broken.load_snapshot(path);
+    }
+    catch (memdb::StorageError&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Без проверки контрольных сумм номер колонки индекса всё равно проверяется
+    db.save_snapshot(path);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        size_t name = content.find("events_id");
+        assert(name != std::string::npos);
+        file.seekp(static_cast<std::streamoff>(name + 9));
+        file.write("\xff\xff\x00\x00", 4);
+    }
+    thrown = false;
+    try {
+        memdb::Database broken;
+        broken.load_snapshot(path, false);
+    }
+    catch (memdb::StorageError&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::filesystem::remove(path);
+
+    // Снимок помнит позицию журнала: после загрузки повторяются только записи, сделанные после снимка
+    std::string log_path = (std::filesystem::temp_directory_path() / "memdb_test20.log").string();
+    std::filesystem::remove(log_path);
+    {
+        memdb::Database logged;
+        logged.open_wal(log_path, {memdb::WriteAheadLog::SYNC_OFF});
+        logged.execute("create table t (id: int32)");
+        logged.execute("insert (1) to t");
+        logged.execute("insert (2) to t");
+        logged.save_snapshot(path);
+        logged.execute("insert (3) to t");
+    }
+    memdb::Database recovered;
+    recovered.load_snapshot(path);
+    recovered.open_wal(log_path);
+    assert(recovered.tables.size() == 1 && recovered.tables[0].live_size() == 3);
+    recovered.execute("insert (4) to t");
+    recovered.close_wal();
+    recovered.open_wal(log_path); // Повторное открытие не применяет журнал второй раз
+    assert(recovered.tables[0].live_size() == 4);
+    recovered.close_wal();
+
+    // Чужой, более короткий журнал не подходит к снимку
+    std::filesystem::remove(log_path);
+    thrown = false;
+    try {
+        memdb::Database mismatched;
+        mismatched.load_snapshot(path);
+        mismatched.open_wal(log_path);
+    }
+    catch (memdb::StorageError&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::filesystem::remove(log_path);
+    std::filesystem::remove(path);
+
+    std::cout << "Test20 passed!" << std::endl;
+}
+
+void Test21() {
+    /*
+     * Чтение по снимку версии, отложенная сборка мусора и читатели параллельно с писателем
+     */
+    std::cout << "================ TEST 21 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, age: int32)");
+    memdb::PreparedStatement insert = db.prepare("insert (age = ?) to users");
+    for (int i = 0; i < 100; i++) {
+        insert.bind(0, i);
+        insert.execute();
+    }
+    auto& users = db.tables[0];
+
+    auto view = db.read_view();
+    auto before = db.execute("select id, age from users where age >= 90");
+    db.execute("delete users where age < 50");
+    for (int i = 0; i < 10; i++) {
+        insert.bind(0, 1000 + i);
+        insert.execute();
+    }
+    assert(db.version() == view->version() + 11);
+
+    assert(db.execute("select id from users where age >= 0").size() == 60);
+    assert(db.execute("select id from users where age >= 0", view).size() == 100);
+    assert(db.execute("select id from users where id == 10", view).size() == 1);
+    assert(db.execute("select id from users where id == 10").empty());
+    memdb::PreparedStatement select = db.prepare("select id from users where age < ?");
+    select.bind(0, 50);
+    assert(select.execute(view).size() == 50);
+    assert(select.execute().empty());
+
+    // Пока живы снимки, удалённые строки не вычищаются и номера строк в старых результатах верны
+    assert(users.dead_rows == 50);
+    assert(users.compactions == 0);
+    assert(db.collect_garbage() == 0);
+    assert(std::get<int>(before.get(9, 1)) == 99);
+
+    bool thrown = false;
+    try {
+        db.execute("delete users where age < 60", view);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Результат без явного снимка не держит уплотнение, но после него читать его нельзя
+    view.reset();
+    assert(db.collect_garbage() == 50);
+    assert(users.size() == 60);
+    assert(users.compactions == 1);
+    thrown = false;
+    try {
+        (void) before.get(9, 1);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Читатели видят только целые состояния, пока писатель вставляет строки
+    std::atomic<bool> done{false};
+    std::atomic<bool> consistent{true};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&] {
+            size_t seen = 0;
+            while (!done) {
+                auto result = db.execute("select id, age from users where age >= 1000");
+                if (result.size() < seen) {
+                    consistent = false;
+                }
+                seen = result.size();
+                for (size_t i = 0; i < result.size(); i++) {
+                    if (std::get<int>(result.get(i, 1)) < 1000) {
+                        consistent = false;
+                    }
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 500; i++) {
+        insert.bind(0, 2000 + i);
+        insert.execute();
+    }
+    done = true;
+    for (auto& reader: readers) {
+        reader.join();
+    }
+    assert(consistent);
+    assert(db.execute("select id from users where age >= 1000").size() == 510);
+
+    std::cout << "Test21 passed!" << std::endl;
+}
+
+void Test22() {
+    /*
+     * Тип колонки разбирается один раз; значения не того типа отклоняются при подготовке и привязке
+     */
+    std::cout << "================ TEST 22 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, login: string[8], hash: bytes[2], "
+               "is_admin: bool = false)");
+    const auto& info = db.tables[0].info_row;
+    assert(info[0].column_type.kind == memdb::Table::ColumnType::INT32);
+    assert(info[1].column_type.kind == memdb::Table::ColumnType::STRING && info[1].column_type.max_length == 8);
+    assert(info[2].column_type.kind == memdb::Table::ColumnType::BYTES && info[2].column_type.width == 2);
+    assert(info[3].column_type.kind == memdb::Table::ColumnType::BOOL);
+    assert(info[1].column_type.name() == "string[8]");
+
+    auto rejected = [&db](const std::string& query) {
+        try {
+            db.execute(query);
+        }
+        catch (memdb::BadQuery&) {
+            return true;
+        }
+        return false;
+    };
+    assert(rejected("insert (,\"x\", 0x01, 5) to users"));
+    assert(rejected("insert (,\"much too long\", 0x01,) to users"));
+    assert(rejected("insert (,\"x\", 0x010203,) to users"));
+    assert(rejected("select id from users where login == 5"));
+    assert(rejected("create table broken (flag: bool = 1)"));
+    assert(db.tables.size() == 1);
+
+    memdb::PreparedStatement insert = db.prepare("insert (login = ?, hash = ?) to users");
+    bool thrown = false;
+    try {
+        insert.bind(0, 42);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    thrown = false;
+    try {
+        insert.bind(0, "toolongname");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    insert.bind(0, "vasya");
+    insert.bind(1, std::vector<uint8_t>{0x01, 0x02});
+    insert.execute();
+
+    memdb::PreparedStatement select = db.prepare("select id from users where login == ? || id > ?");
+    thrown = false;
+    try {
+        select.bind(1, true);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+    select.bind(0, "a string longer than the column"); // В условии длина не ограничена
+    select.bind(1, -1);
+    assert(select.execute().size() == 1);
+
+    std::cout << "Test22 passed!" << std::endl;
+}
+
+void Test23() {
+    /*
+     * Короткие string[N] и bytes[N] в колоночной таблице лежат в слотах фиксированной ширины,
+     * длинные — в общей arena; результаты запросов от этого не зависят
+     */
+    std::cout << "================ TEST 23 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, login: string[12], hash: bytes[2], "
+               "bio: string[64]) {columnar}");
+    const auto& columns = db.tables[0].columns;
+    assert(columns[1].slot_width == 13);
+    assert(columns[2].slot_width == 3);
+    assert(columns[3].slot_width == 0);
+
+    for (int i = 0; i < 100; ++i) {
+        db.execute("insert (,\"user" + std::to_string(i) + "\", 0x" + (i % 2 == 0 ? "0a0b" : "0c") +
+                   ", \"bio of user " + std::to_string(i) + "\") to users");
+    }
+    db.execute("insert (,\"\", 0x0d, \"\") to users");
+    assert(columns[1].slots.size() == 101 * 13);
+
+    assert(db.execute("select id from users where login == \"user42\"").size() == 1);
+    assert(db.execute("select id from users where login != \"user42\"").size() == 100);
+    assert(db.execute("select id from users where login == \"a value longer than twelve\"").empty());
+    assert(db.execute("select id from users where login < \"user2\"").size() == 13);
+    assert(db.execute("select id from users where hash == 0x0a0b").size() == 50);
+    assert(db.execute("select id from users where hash == 0x0a").empty());
+    assert(db.execute("select id from users where bio == \"bio of user 7\"").size() == 1);
+
+    auto result = db.execute("select login, hash from users where id == 7");
+    assert(std::get<std::string>(result.get(0, 0)) == "\"user7\"");
+    assert(std::get<std::vector<uint8_t>>(result.get(0, 1)) == std::vector<uint8_t>({0x0c}));
+
+    db.execute("delete users where id < 50");
+    db.collect_garbage();
+    assert(columns[1].slots.size() == 51 * 13);
+    result = db.execute("select login, bio from users where login == \"user77\"");
+    assert(result.size() == 1 && std::get<std::string>(result.get(0, 1)) == "\"bio of user 77\"");
+
+    std::string path = (std::filesystem::temp_directory_path() / "memdb_test23.snapshot").string();
+    db.save_snapshot(path);
+    memdb::Database restored;
+    restored.load_snapshot(path);
+    assert(restored.tables[0].columns[1].slot_width == 13);
+
+    // Длина в слоте проверяется и без контрольных сумм
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        size_t value = content.find("\"user77\"");
+        assert(value != std::string::npos);
+        file.seekp(static_cast<std::streamoff>(value - 1));
+        file.put('\xff');
+    }
+    bool thrown = false;
+    try {
+        memdb::Database broken;
+        broken.load_snapshot(path, false);
+    }
+    catch (memdb::StorageError&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::filesystem::remove(path);
+    assert(restored.execute("select id from users where login == \"user77\"").size() == 1);
+    assert(restored.execute("select id from users where hash == 0x0c").size() == 25);
+
+    std::cout << "Test23 passed!" << std::endl;
+}
+
+void Test24() {
+    /*
+     * Колонка {dict} хранит коды словаря: равенство сравнивает коды, словарь расширяет коды по мере роста
+     */
+    std::cout << "================ TEST 24 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table people (id: int32, {dict} country: string[16], {dict} tag: string[8]) {columnar}");
+    const auto& columns = db.tables[0].columns;
+    assert(columns[1].code_width == 1 && columns[2].code_width == 1);
+
+    const char* countries[] = {"\"ru\"", "\"de\"", "\"fr\"", "\"us\""};
+    for (int i = 0; i < 1000; ++i) {
+        db.execute("insert (" + std::to_string(i) + ", " + countries[i % 4] + ", \"t" + std::to_string(i % 300) +
+                   "\") to people");
+    }
+    assert(columns[1].dictionary.size() == 5); // Код 0 занят пустым значением
+    assert(columns[1].codes.size() == 1000);
+    assert(columns[2].code_width == 2);
+
+    assert(db.execute("select id from people where country == \"de\"").size() == 250);
+    assert(db.execute("select id from people where country != \"de\"").size() == 750);
+    assert(db.execute("select id from people where country == \"cn\"").empty());
+    assert(db.execute("select id from people where country < \"fr\"").size() == 250);
+    assert(db.execute("select id from people where tag == \"t7\" && country == \"us\"").size() == 4);
+    auto result = db.execute("select country, tag from people where id == 301");
+    assert(std::get<std::string>(result.get(0, 0)) == "\"de\"");
+    assert(std::get<std::string>(result.get(0, 1)) == "\"t1\"");
+
+    db.execute("delete people where country == \"ru\"");
+    db.collect_garbage();
+    assert(columns[1].codes.size() == 750);
+    assert(db.execute("select id from people where country == \"fr\"").size() == 250);
+
+    std::string path = (std::filesystem::temp_directory_path() / "memdb_test24.snapshot").string();
+    db.save_snapshot(path);
+    memdb::Database restored;
+    restored.load_snapshot(path);
+    std::filesystem::remove(path);
+    assert(restored.tables[0].info_row[1].dictionary);
+    assert(restored.tables[0].columns[2].code_width == 2);
+    assert(restored.execute("select id from people where country == \"us\"").size() == 250);
+    assert(restored.execute("select id from people where tag == \"t299\"").size() == 3);
+
+    bool thrown = false;
+    try {
+        db.execute("create table broken ({dict} id: int32)");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    db.execute("create table rows_t (id: int32, {dict} status: string[8])");
+    db.execute("insert (1, \"new\") to rows_t");
+    assert(db.execute("select id from rows_t where status == \"new\"").size() == 1);
+
+    std::cout << "Test24 passed!" << std::endl;
+}
+
+void Test25() {
+    /*
+     * Каталог: поиск таблиц и колонок по хешу с учётом регистра, ссылки на таблицы не меняются при создании новых
+     */
+    std::cout << "================ TEST 25 ================" << std::endl;
+
+    memdb::Database db;
+    std::string columns;
+    for (int i = 0; i < 100; ++i) {
+        columns += (i == 0 ? "" : ", ") + std::string("c") + std::to_string(i) + ": int32 = " + std::to_string(i);
+    }
+    db.execute("create table wide (" + columns + ")");
+    memdb::Table& wide = db.find_table("wide");
+    for (int i = 0; i < 200; ++i) {
+        db.execute("create table t" + std::to_string(i) + " (id: int32)");
+    }
+    db.execute("create table Wide (id: int32)");
+    assert(&db.find_table("wide") == &wide);
+    assert(db.find_table("Wide").info_row.size() == 1);
+    assert(&db.find_table("t150") == &db.tables[151]);
+
+    assert(memdb::find_column_index(wide, "c77") == 77);
+    assert(&memdb::find_column_info(wide, "c42") == &wide.info_row[42]);
+    assert(wide.column_position("C42") == static_cast<size_t>(-1));
+
+    db.execute("insert (c99 = 1, c0 = 5) to wide");
+    auto result = db.execute("select c0, c50 from wide where c99 == 1");
+    assert(std::get<int>(result.get(0, 0)) == 5 && std::get<int>(result.get(0, 1)) == 50);
+
+    auto rejected = [&db](const std::string& query) {
+        try {
+            db.execute(query);
+        }
+        catch (memdb::BadQuery&) {
+            return true;
+        }
+        return false;
+    };
+    assert(rejected("select c1 from WIDE"));
+    assert(rejected("insert (c100 = 1) to wide"));
+    assert(rejected("select c100 from wide"));
+
+    // Второй таблицы с тем же именем нет: каталог остаётся полным, и поиск идёт по хешу
+    size_t table_count = db.tables.size();
+    assert(rejected("create table wide (id: int32)"));
+    assert(db.tables.size() == table_count && db.catalog.size() == table_count);
+    assert(&db.find_table("wide") == &wide);
+
+    std::cout << "Test25 passed!" << std::endl;
+}
+
+void Test26() {
+    /*
+     * explain analyze и QueryStats: время по этапам и счётчики строк и значений
+     */
+    std::cout << "================ TEST 26 ================" << std::endl;
+
+#ifdef MEMDB_PROFILING
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, age: int32, login: string[16])");
+    for (int i = 0; i < 100; ++i) {
+        db.execute("insert (, " + std::to_string(i) + ", \"user" + std::to_string(i) + "\") to users");
+    }
+
+    memdb::QueryStats stats;
+    auto result = db.execute("select id, login from users where age < 30", stats);
+    assert(result.size() == 30);
+    assert(stats.rows_scanned == 100 && stats.rows_matched == 30);
+    assert(stats.values_copied == 0 && stats.bytes_allocated > 0);
+    assert(stats.stage_time[memdb::QueryStats::TOKENIZE].count() > 0);
+    assert(stats.stage_time[memdb::QueryStats::SCAN].count() > 0);
+    assert(stats.stage_time[memdb::QueryStats::MATERIALIZE].count() == 0);
+
+    memdb::QueryStats explained;
+    auto plan = db.execute("EXPLAIN  Analyze select id, login from users where age < 30", explained);
+    assert(plan.column_count() == 1 && plan.column(0).name == "plan");
+    assert(plan.size() == explained.report().size());
+    assert(std::get<std::string>(plan.get(0, 0)).rfind("\"tokenize: ", 0) == 0);
+    assert(explained.rows_matched == 30 && explained.values_copied == 60);
+    plan.print();
+
+    memdb::QueryStats deleted;
+    db.execute("explain analyze delete users where age >= 90", deleted);
+    assert(deleted.rows_scanned == 100 && deleted.rows_matched == 10);
+    assert(db.execute("select id from users where age >= 0").size() == 90);
+
+    memdb::PreparedStatement insert = db.prepare("insert (, ?, ?) to users");
+    insert.bind(0, 5);
+    insert.bind(1, "new");
+    memdb::QueryStats inserted;
+    insert.execute(nullptr, &inserted);
+    assert(inserted.values_copied == 3 && inserted.stage_time[memdb::QueryStats::EXECUTE].count() > 0);
+#endif
+
+    std::cout << "Test26 passed!" << std::endl;
+}
+
+void Test27() {
+    /*
+     * Кеш планов: запросы, отличающиеся только литералами, разбираются один раз;
+     * изменение схемы сбрасывает кеш, журнал воспроизводит запросы, выполненные через план
+     */
+    std::cout << "================ TEST 27 ================" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "memdb_test27.wal").string();
+    std::filesystem::remove(path);
+    {
+        memdb::Database db;
+        db.open_wal(path);
+        db.execute("create table users ({key, autoincrement} id: int32, age: int32, login: string[16])");
+        for (int i = 0; i < 50; ++i) {
+            db.execute("insert (, " + std::to_string(i) + ", \"user" + std::to_string(i) + "\") to users");
+        }
+        assert(db.plan_cache.misses() == 1 && db.plan_cache.hits() == 49);
+
+        for (int i = 0; i < 50; ++i) {
+            auto result = db.execute("select login from users where id == " + std::to_string(i));
+            assert(result.size() == 1);
+            assert(std::get<std::string>(result.get(0, 0)) == "\"user" + std::to_string(i) + "\"");
+        }
+        assert(db.plan_cache.misses() == 2 && db.plan_cache.hits() == 98);
+        assert(db.plan_cache.size() == 2);
+
+        bool thrown = false;
+        try {
+            db.execute("select id from users where login == 5");
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            db.execute("insert (, 1, \"a login that is too long\") to users");
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(db.execute("select id from users where age >= 0").size() == 50);
+
+        db.execute("delete users where age < 10");
+        db.execute("create index by_age on users (age)");
+        assert(db.plan_cache.size() == 0);
+        assert(db.execute("select id from users where age >= 40").size() == 10);
+
+        db.plan_cache.set_capacity(1);
+        db.execute("select id from users where age < 20");
+        db.execute("select id from users where age > 20");
+        assert(db.plan_cache.size() == 1);
+
+        db.plan_cache.set_capacity(0);
+        size_t misses = db.plan_cache.misses();
+        db.execute("select id from users where age < 20");
+        assert(db.plan_cache.size() == 0 && db.plan_cache.misses() == misses);
+
+        // Текст ошибки не зависит от того, выполнялся ли запрос через план
+        auto error = [&db](const std::string& query) {
+            try {
+                db.execute(query);
+            }
+            catch (memdb::BadQuery& e) {
+                return std::string(e.what());
+            }
+            return std::string();
+        };
+        for (const char* query: {"insert (, 1, \"a login that is too long\") to users",
+                                 "select id from users where login == 5",
+                                 "select id from users where age > 0 limit true"}) {
+            db.plan_cache.set_capacity(0);
+            std::string uncached = error(query);
+            db.plan_cache.set_capacity(16);
+            std::string first = error(query);
+            std::string second = error(query);
+            assert(!uncached.empty() && uncached == first && uncached == second);
+        }
+        assert(error("insert (, 1, \"toolongvaluetoolong\") to users") ==
+               "Bad query: value \"toolongvaluetoolong\" doesn't fit column 'login' of type string[16]");
+    }
+
+    memdb::Database restored;
+    restored.open_wal(path);
+    assert(restored.execute("select id from users where age >= 0").size() == 40);
+    assert(restored.execute("select login from users where id == 42").size() == 1);
+    restored.close_wal();
+    std::filesystem::remove(path);
+
+    std::cout << "Test27 passed!" << std::endl;
+}
+
+void Test28() {
+    /*
+     * Курсор: строки читаются по одной и пачками, limit и offset работают через execute, query и
+     * подготовленные запросы, а limit 1 не сканирует всю таблицу. Курсор на снимке не видит новых изменений
+     */
+    std::cout << "================ TEST 28 ================" << std::endl;
+
+    memdb::Database db;
+    db.execute("create table users ({key, autoincrement} id: int32, age: int32, login: string[16])");
+    std::vector<memdb::Table::row> rows;
+    for (int i = 0; i < 10000; ++i) {
+        rows.push_back({{i, i % 100, "\"user" + std::to_string(i) + "\""}});
+    }
+    db.bulk_insert("users", rows);
+
+    memdb::Cursor cursor = db.query("select id, login from users where age == 7");
+    assert(cursor.column_count() == 2 && cursor.column(1).name == "login");
+    memdb::Table::row row;
+    assert(cursor.next(row));
+    assert(std::get<int>(row.values[0]) == 7 && std::get<std::string>(row.values[1]) == "\"user7\"");
+    std::vector<memdb::Table::row> batch = cursor.next_batch(60);
+    assert(batch.size() == 60 && std::get<int>(batch[0].values[0]) == 107);
+    batch = cursor.next_batch(60);
+    assert(batch.size() == 39);
+    assert(!cursor.next(row) && cursor.rows_scanned() == 10000);
+
+    // limit 1 заканчивает скан на первом куске
+    cursor = db.query("select id from users where age == 3 limit 1");
+    size_t row_id;
+    assert(cursor.next_row_id(row_id) && row_id == 3);
+    assert(!cursor.next_row_id(row_id));
+    assert(cursor.rows_scanned() < 10000);
+
+    auto result = db.execute("select id from users where age == 5 limit 3 offset 2");
+    assert(result.size() == 3);
+    assert(std::get<int>(result.get(0, 0)) == 205 && std::get<int>(result.get(2, 0)) == 405);
+    assert(db.execute("select id from users where age == 5 offset 98").size() == 2);
+    assert(db.execute("select id from users where age == 5 limit 0").empty());
+    // Форма с limit попадает в кеш планов, литерал limit становится параметром
+    assert(db.execute("select id from users where age == 5 limit 7").size() == 7);
+    assert(db.execute("select id from users where age == 6 limit 4").size() == 4);
+
+    bool thrown = false;
+    try {
+        db.execute("select id from users where age == 5 limit \"ten\"");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        db.query("delete users where age == 5");
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    memdb::PreparedStatement statement = db.prepare("select id from users where age < ? limit ? offset ?");
+    statement.bind(0, 50);
+    statement.bind(1, 5);
+    statement.bind(2, 10);
+    result = statement.execute();
+    assert(result.size() == 5 && std::get<int>(result.get(0, 0)) == 10);
+    thrown = false;
+    try {
+        statement.bind(1, -1);
+    }
+    catch (memdb::BadQuery&) {
+        thrown = true;
+    }
+    assert(thrown);
+    statement.bind(1, 2);
+    cursor = statement.query();
+    batch = cursor.next_batch(10);
+    assert(batch.size() == 2 && std::get<int>(batch[1].values[0]) == 11);
+
+    // Курсор по равенству ключа идёт через хеш-индекс
+    cursor = db.query("select login from users where id == 4242");
+    assert(cursor.next(row) && std::get<std::string>(row.values[0]) == "\"user4242\"");
+    assert(!cursor.next(row) && cursor.rows_scanned() == 1);
+
+    // Курсор по снимку не видит удалений и вставок, сделанных после его открытия
+    cursor = db.query("select id from users where age == 99", db.read_view());
+    db.execute("delete users where age == 99");
+    db.execute("insert (10000, 99, \"late\") to users");
+    size_t count = 0;
+    while (cursor.next_row_id(row_id)) {
+        ++count;
+    }
+    assert(count == 100);
+    assert(db.execute("select id from users where age == 99").size() == 1);
+    cursor = {};
+
+    std::cout << "Test28 passed!" << std::endl;
+}
+
+void Test29() {
+    /*
+     * order by: один и несколько ключей, asc и desc, top-K через limit
+     * совпадают с эталонной сортировкой в обеих раскладках
+     */
+    std::cout << "================ TEST 29 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table users ({key} id: int32, age: int32, login: string[16], "
+                               "hash: bytes[4], is_admin: bool)") + layout);
+        std::vector<memdb::Table::row> rows;
+        for (int i = 0; i < 5000; ++i) {
+            int age = (i * 7919) % 1000 - 500;
+            std::string login = "\"u" + std::to_string((i * 31) % 257) + "\"";
+            std::vector<uint8_t> hash = {static_cast<uint8_t>(i % 3), 0, static_cast<uint8_t>(i % 5)};
+            rows.push_back({{i, age, login, hash, i % 2 == 0}});
+        }
+        db.bulk_insert("users", rows);
+
+        // Эталон: устойчивая сортировка материализованных значений
+        auto expected = [&](const std::vector<std::pair<size_t, bool>>& keys, size_t limit) {
+            std::vector<memdb::Table::row> sorted = rows;
+            std::stable_sort(sorted.begin(), sorted.end(), [&](const auto& lhs, const auto& rhs) {
+                for (auto [column, descending]: keys) {
+                    const auto& a = lhs.values[column];
+                    const auto& b = rhs.values[column];
+                    if (a != b) {
+                        return descending ? b < a : a < b;
+                    }
+                }
+                return false;
+            });
+            std::vector<int> ids;
+            for (size_t i = 0; i < std::min(limit, sorted.size()); ++i) {
+                ids.push_back(std::get<int>(sorted[i].values[0]));
+            }
+            return ids;
+        };
+        auto ids = [&](const std::string& query) {
+            auto result = db.execute(query);
+            std::vector<int> values;
+            for (size_t i = 0; i < result.size(); ++i) {
+                values.push_back(std::get<int>(result.get(i, 0)));
+            }
+            return values;
+        };
+
+        assert(ids("select id from users where id >= 0 order by age") == expected({{1, false}}, 5000));
+        assert(ids("select id from users where id >= 0 order by age desc") == expected({{1, true}}, 5000));
+        assert(ids("select id from users where id >= 0 order by age desc limit 10") == expected({{1, true}}, 10));
+        assert(ids("select id from users where id >= 0 order by login, id desc") ==
+               expected({{2, false}, {0, true}}, 5000));
+        assert(ids("select id from users where id >= 0 order by login desc limit 25") == expected({{2, true}}, 25));
+        assert(ids("select id from users where id >= 0 order by hash, is_admin desc, age limit 100") ==
+               expected({{3, false}, {4, true}, {1, false}}, 100));
+        assert(ids("select id from users where id >= 0 order by is_admin") == expected({{4, false}}, 5000));
+
+        std::vector<int> tail = expected({{1, false}}, 5000);
+        tail = std::vector<int>(tail.begin() + 4990, tail.end());
+        assert(ids("select id from users where id >= 0 order by age limit 10 offset 4990") == tail);
+
+        auto result = db.execute("select id, age from users where age > 400 order by age desc limit 3");
+        assert(std::get<int>(result.get(0, 1)) == 499 && std::get<int>(result.get(2, 1)) == 499);
+
+        memdb::PreparedStatement statement = db.prepare("select id from users where age < ? order by age limit ?");
+        statement.bind(0, -490);
+        statement.bind(1, 2);
+        memdb::Cursor cursor = statement.query();
+        memdb::Table::row row;
+        std::vector<int> lowest = expected({{1, false}}, 2);
+        assert(cursor.next(row) && std::get<int>(row.values[0]) == lowest[0]);
+        assert(cursor.next(row) && std::get<int>(row.values[0]) == lowest[1]);
+        assert(!cursor.next(row));
+
+        bool thrown = false;
+        try {
+            db.execute("select id from users where id >= 0 order by missing");
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            db.execute("select id from users where id >= 0 order by age sideways");
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    // Слова подряд без запятой допустимы только в order by и limit после условия
+    memdb::Database db;
+    db.execute("create table words (id: int32, desc: int32, limit: int32)");
+    for (int i = 0; i < 10; ++i) {
+        db.execute("insert (" + std::to_string(i) + ", " + std::to_string(i % 2) + ", " + std::to_string(i) +
+                   ") to words");
+    }
+    auto result = db.execute("select id, limit from words where desc == 1 order by limit desc limit 2");
+    assert(result.size() == 2 && std::get<int>(result.get(0, 1)) == 9 && std::get<int>(result.get(1, 1)) == 7);
+    assert(db.execute("select id from words where limit < 5 limit 3").size() == 3);
+    for (const char* query: {"select id desc from words where id >= 0",
+                             "select id limit from words where id >= 0",
+                             "delete words where id desc"}) {
+        bool thrown = false;
+        try {
+            db.execute(query);
+        }
+        catch (memdb::BadQuery& e) {
+            thrown = std::string(e.what()).find("expected , or :") != std::string::npos;
+        }
+        assert(thrown);
+    }
+
+    std::cout << "Test29 passed!" << std::endl;
+}
+
+void Test30() {
+    /*
+     * Агрегаты: count/sum/min/max/avg без group by и с группировкой по одной и нескольким колонкам,
+     * order by и limit над группами; параллельный подсчёт по частям совпадает с последовательным
+     */
+    std::cout << "================ TEST 30 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table orders ({key} id: int32, user: int32, amount: int32, "
+                               "city: string[16], paid: bool)") + layout);
+        std::vector<memdb::Table::row> rows;
+        const char* cities[] = {"\"Moscow\"", "\"Kazan\"", "\"Omsk\""};
+        for (int i = 0; i < 3000; ++i) {
+            rows.push_back({{i, i % 10, i % 7 - 3, std::string(cities[i % 3]), i % 4 == 0}});
+        }
+        db.bulk_insert("orders", rows);
+
+        auto result = db.execute("select count(*), sum(amount), min(amount), max(city), avg(id) from orders "
+                                 "where id >= 0");
+        assert(result.size() == 1 && result.column_count() == 5);
+        assert(result.column(0).name == "count(*)" && result.column(3).name == "max(city)");
+        int64_t sum = 0;
+        for (int i = 0; i < 3000; ++i) {
+            sum += i % 7 - 3;
+        }
+        assert(std::get<int>(result.get(0, 0)) == 3000);
+        assert(std::get<int>(result.get(0, 1)) == sum);
+        assert(std::get<int>(result.get(0, 2)) == -3);
+        assert(std::get<std::string>(result.get(0, 3)) == "\"Omsk\"");
+        assert(std::get<int>(result.get(0, 4)) == 1499);
+
+        // Пустой вход: count 0, остальные агрегаты пустые
+        result = db.execute("select count(id), sum(amount) from orders where id < 0");
+        assert(result.size() == 1 && std::get<int>(result.get(0, 0)) == 0);
+        assert(std::holds_alternative<std::monostate>(result.get(0, 1)));
+
+        result = db.execute("select user, count(*), sum(paid) from orders where amount > 0 group by user");
+        assert(result.size() == 10);
+        assert(std::get<int>(result.get(0, 0)) == 4); // Группы в порядке первого появления
+        for (size_t g = 0; g < result.size(); ++g) {
+            int user = std::get<int>(result.get(g, 0));
+            int count = 0;
+            int paid = 0;
+            for (int i = 0; i < 3000; ++i) {
+                if (i % 10 == user && i % 7 - 3 > 0) {
+                    ++count;
+                    paid += i % 4 == 0;
+                }
+            }
+            assert(std::get<int>(result.get(g, 1)) == count && std::get<int>(result.get(g, 2)) == paid);
+        }
+
+        result = db.execute("select city, paid, count(*) from orders where id >= 0 group by city, paid "
+                            "order by city desc, paid limit 3");
+        assert(result.size() == 3);
+        assert(std::get<std::string>(result.get(0, 0)) == "\"Omsk\"" && !std::get<bool>(result.get(0, 1)));
+        assert(std::get<int>(result.get(0, 2)) == 750 && std::get<int>(result.get(1, 2)) == 250);
+        assert(std::get<std::string>(result.get(2, 0)) == "\"Moscow\"");
+
+        memdb::Cursor cursor = db.query("select user, max(amount) from orders where user < 3 group by user");
+        memdb::Table::row row;
+        size_t groups = 0;
+        while (cursor.next(row)) {
+            assert(std::get<int>(row.values[1]) == 3);
+            ++groups;
+        }
+        assert(groups == 3);
+
+        std::string grouped = "select user, city, count(*), sum(amount), min(id), max(id) from orders "
+                              "where id >= 0 group by user, city";
+        memdb::Table single = db.execute(grouped).materialize();
+        db.set_parallelism(4);
+        db.parallel_threshold = 1000;
+        db.morsel_size = 100;
+        memdb::Table parallel = db.execute(grouped).materialize();
+        db.set_parallelism(1);
+        assert(single.size() == 30 && parallel.size() == 30);
+        for (size_t i = 0; i < single.size(); ++i) {
+            assert(single.rows[i].values == parallel.rows[i].values);
+        }
+
+        for (const char* query: {"select id, count(*) from orders where id >= 0",
+                                 "select sum(city) from orders where id >= 0",
+                                 "select median(amount) from orders where id >= 0",
+                                 "select user, count(*) from orders where id >= 0 group by user order by city"}) {
+            bool thrown = false;
+            try {
+                db.execute(query);
+            }
+            catch (memdb::BadQuery&) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+    }
+
+    std::cout << "Test30 passed!" << std::endl;
+}
+
+void Test31() {
+    /*
+     * Хеш-соединение: проекция из обеих таблиц, хеш-таблица по любой из сторон, условия where до и после
+     * соединения, limit и курсор; результат совпадает с вложенными циклами
+     */
+    std::cout << "================ TEST 31 ================" << std::endl;
+
+    for (const char* layout: {"", " {columnar}"}) {
+        memdb::Database db;
+        db.execute(std::string("create table users ({key} id: int32, name: string[16], age: int32)") + layout);
+        db.execute(std::string("create table orders ({key} id: int32, user: int32, amount: int32)") + layout);
+        std::vector<memdb::Table::row> users;
+        for (int i = 0; i < 30; ++i) {
+            users.push_back({{i, "\"u" + std::to_string(i) + "\"", 20 + i * 2}});
+        }
+        db.bulk_insert("users", users);
+        std::vector<memdb::Table::row> orders;
+        for (int i = 0; i < 3000; ++i) {
+            orders.push_back({{i, i % 40, i % 7 - 3}}); // У заказов пользователей 30..39 пары нет
+        }
+        db.bulk_insert("orders", orders);
+        db.execute("delete orders where amount == 3");
+
+        // Ожидаемые тройки (имя, сумма, номер заказа) вложенными циклами
+        auto nested_loop = [&](const std::function<bool(int, int)>& keep) {
+            std::vector<std::tuple<std::string, int, int>> expected;
+            for (int o = 0; o < 3000; ++o) {
+                for (int u = 0; u < 30; ++u) {
+                    int amount = o % 7 - 3;
+                    if (o % 40 == u && amount != 3 && keep(u, amount)) {
+                        expected.emplace_back("\"u" + std::to_string(u) + "\"", amount, o);
+                    }
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            return expected;
+        };
+        auto triples = [](const memdb::ResultSet& result) {
+            std::vector<std::tuple<std::string, int, int>> actual;
+            for (size_t i = 0; i < result.size(); ++i) {
+                actual.emplace_back(std::get<std::string>(result.get(i, 0)), std::get<int>(result.get(i, 1)),
+                                    std::get<int>(result.get(i, 2)));
+            }
+            std::sort(actual.begin(), actual.end());
+            return actual;
+        };
+
+        // Таблица строится по users слева, затем по users справа
+        auto result = db.execute("select users.name, orders.amount, orders.id from users join orders "
+                                 "on users.id == orders.user where orders.amount > 0 && users.age < 40");
+        assert(result.column_count() == 3 && result.column(0).name == "users.name");
+        assert(result.column(2).name == "orders.id");
+        assert(triples(result) == nested_loop([](int u, int amount) { return amount > 0 && 20 + u * 2 < 40; }));
+
+        result = db.execute("select name, amount, orders.id from orders join users on user == users.id "
+                            "where orders.id >= 0");
+        assert(triples(result) == nested_loop([](int, int) { return true; }));
+        assert(std::get<int>(result.get(0, 2)) == 0 && std::get<int>(result.get(1, 2)) == 1); // Порядок orders
+
+        // Условие на обе таблицы проверяется на парах
+        result = db.execute("select name, amount, orders.id from users join orders on users.id == orders.user "
+                            "where (users.age > 70 || orders.amount == 0) && orders.id < 2000");
+        auto expected = nested_loop([](int u, int amount) { return 20 + u * 2 > 70 || amount == 0; });
+        expected.erase(std::remove_if(expected.begin(), expected.end(), [](const auto& item) {
+            return std::get<2>(item) >= 2000;
+        }), expected.end());
+        assert(triples(result) == expected);
+
+        result = db.execute("select name, amount, orders.id from users join orders on users.id == orders.user "
+                            "where orders.amount < 0 limit 5 offset 2");
+        assert(result.size() == 5);
+        for (size_t i = 0; i < result.size(); ++i) {
+            assert(std::get<int>(result.get(i, 1)) < 0);
+        }
+
+        memdb::Cursor cursor = db.query("select users.id, orders.user from users join orders "
+                                        "on users.id == orders.user where users.id == 7");
+        assert(cursor.column_count() == 2 && cursor.column(1).name == "orders.user");
+        memdb::Table::row row;
+        size_t pairs = 0;
+        while (cursor.next(row)) {
+            assert(std::get<int>(row.values[0]) == 7 && std::get<int>(row.values[1]) == 7);
+            ++pairs;
+        }
+        assert(pairs == 75 - 11); // Заказы 7, 47, ..., 2967 без тех, где amount == 3
+        size_t row_id;
+        bool thrown = false;
+        try {
+            cursor.next_row_id(row_id);
+        }
+        catch (memdb::BadQuery&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        // Ключи соединения должны быть одного типа: int32 с bool не соединяется
+        db.execute("create table flags (on: bool)");
+        db.execute("insert (true) to flags");
+        for (const char* query: {"select id from users join orders on users.id == orders.user where age > 0",
+                                 "select name from users join orders on users.id == users.age where age > 0",
+                                 "select name from users join orders on users.id < orders.user where age > 0",
+                                 "select name from users join orders on users.name == orders.user where age > 0",
+                                 "select name from users join flags on users.id == flags.on where age > 0",
+                                 "select name from users join orders on users.id == orders.user where carts.id > 0",
+                                 "select name from users join orders on users.id == orders.user where age > 0 "
+                                 "order by name"}) {
+            thrown = false;
+            try {
+                db.execute(query);
+            }
+            catch (memdb::BadQuery&) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+
+        // join — ключевое слово только сразу после from <таблица>
+        db.execute("create table join (id: int32, join: int32)");
+        db.execute("insert (1, 1) to join");
+        assert(db.execute("select join from join where join == 1").size() == 1);
+        result = db.execute("select users.name, join.join from users join join on users.id == join.id "
+                            "where join.join > 0");
+        assert(result.size() == 1 && std::get<std::string>(result.get(0, 0)) == "\"u1\"");
+    }
+
+    std::cout << "Test31 passed!" << std::endl;
+}
+
 int main() {
     Test1();
     Test2();
@@ -343,6 +2041,28 @@ int main() {
     Test7();
     Test8();
     Test9();
+    Test10();
+    Test11();
+    Test12();
+    Test13();
+    Test14();
+    Test15();
+    Test16();
+    Test17();
+    Test18();
+    Test19();
+    Test20();
+    Test21();
+    Test22();
+    Test23();
+    Test24();
+    Test25();
+    Test26();
+    Test27();
+    Test28();
+    Test29();
+    Test30();
+    Test31();
 
     return 0;
 }
@@ -0,0 +1,87 @@
+#include <utility>
+#include "memdb.h"
+
+
+memdb::ThreadPool::ThreadPool(size_t threads) {
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this] { worker_loop(); });
+    }
+}
+
+memdb::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+size_t memdb::ThreadPool::size() const {
+    return workers.size();
+}
+
+void memdb::ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        task_count = count;
+        next_task = 0;
+        error = nullptr;
+        busy = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    job = nullptr;
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+void memdb::ThreadPool::worker_loop() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        run_tasks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void memdb::ThreadPool::run_tasks() {
+    for (size_t task = next_task++; task < task_count; task = next_task++) {
+        try {
+            (*job)(task);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next_task = task_count; // Остальные задачи уже не нужны
+        }
+    }
+}
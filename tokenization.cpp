@@ -1,7 +1,8 @@
 #include <iostream>
 #include <vector>
-#include <regex>
 #include <string>
+#include <string_view>
+#include <array>
 #include "memdb.h"
 
 std::string memdb::tokenTypeToString(memdb::Token::token_type type) {
@@ -24,149 +25,309 @@ std::string memdb::tokenTypeToString(memdb::Token::token_type type) {
             return "SYMBOL";
         case Token::ATTRIBUTE:
             return "ATTRIBUTE";
+        case Token::PLACEHOLDER:
+            return "PLACEHOLDER";
         default:
             return "UNDEFINED";
     }
 }
 
-std::string memdb::trim(const std::string &str) {
-    size_t first = str.find_first_not_of(" \t\n\r");
-    size_t last = str.find_last_not_of(" \t\n\r");
-    return (first == std::string::npos) ? "" : str.substr(first, last - first + 1);
-}
+namespace {
 
+    enum char_class : uint8_t {
+        CH_OTHER = 0,
+        CH_SPACE = 1 << 0,
+        CH_SEPARATOR = 1 << 1,   // {}(),:;
+        CH_IDENT_START = 1 << 2, // [a-zA-Z_]
+        CH_DIGIT = 1 << 3,
+        CH_HEX = 1 << 4
+    };
 
-std::vector<std::string> memdb::splitIntoTokens(const std::string &str) {
-    std::vector<std::string> tokens;
-    std::string current_token;
+    constexpr std::array<uint8_t, 256> make_char_table() {
+        std::array<uint8_t, 256> table{};
+        for (unsigned ch: {' ', '\t', '\n', '\r', '\v', '\f'}) {
+            table[ch] |= CH_SPACE;
+        }
+        for (unsigned ch: {'{', '}', '(', ')', ',', ':', ';'}) {
+            table[ch] |= CH_SEPARATOR;
+        }
+        for (unsigned ch = 'a'; ch <= 'z'; ++ch) {
+            table[ch] |= CH_IDENT_START;
+        }
+        for (unsigned ch = 'A'; ch <= 'Z'; ++ch) {
+            table[ch] |= CH_IDENT_START;
+        }
+        table['_'] |= CH_IDENT_START;
+        for (unsigned ch = '0'; ch <= '9'; ++ch) {
+            table[ch] |= CH_DIGIT | CH_HEX;
+        }
+        for (unsigned ch = 'a'; ch <= 'f'; ++ch) {
+            table[ch] |= CH_HEX;
+        }
+        for (unsigned ch = 'A'; ch <= 'F'; ++ch) {
+            table[ch] |= CH_HEX;
+        }
+        return table;
+    }
 
-    bool inside_string = false;
+    constexpr std::array<uint8_t, 256> char_table = make_char_table();
 
-    for (size_t i = 0; i < str.size(); ++i) {
-        char ch = str[i];
+    inline bool has_class(char ch, uint8_t cls) {
+        return (char_table[static_cast<unsigned char>(ch)] & cls) != 0;
+    }
 
-        if (inside_string) {
-            current_token += ch;
-            if (ch == '\"') {
-                tokens.emplace_back(current_token); // Добавляем строку как токен
-                current_token.clear();
-                inside_string = false;
-            }
-        } else if (ch == '\"') {
-            if (!current_token.empty()) {
-                tokens.emplace_back(trim(current_token));
-                current_token.clear();
+    bool is_identifier(std::string_view str) {
+        if (str.empty() || !has_class(str[0], CH_IDENT_START)) {
+            return false;
+        }
+        for (size_t i = 1; i < str.size(); ++i) {
+            if (!has_class(str[i], CH_IDENT_START | CH_DIGIT)) {
+                return false;
             }
-            inside_string = true;
-            current_token += ch; // Добавляем открывающую кавычку
-        } else if (std::isspace(ch)) {
-            if (!current_token.empty()) {
-                tokens.emplace_back(trim(current_token));
-                current_token.clear();
+        }
+        return true;
+    }
+
+    // <таблица>.<колонка> в запросах с join
+    bool is_qualified_name(std::string_view str) {
+        size_t dot = str.find('.');
+        return dot != std::string_view::npos && is_identifier(str.substr(0, dot)) &&
+               is_identifier(str.substr(dot + 1));
+    }
+
+    bool is_digits(std::string_view str) {
+        if (str.empty()) {
+            return false;
+        }
+        for (char ch: str) {
+            if (!has_class(ch, CH_DIGIT)) {
+                return false;
             }
-        } else if (std::string("{}(),:;").find(ch) != std::string::npos) {
-            if (!current_token.empty()) {
-                tokens.emplace_back(trim(current_token));
-                current_token.clear();
+        }
+        return true;
+    }
+
+    // "..." с поддержкой экранирования через обратный слэш
+    bool is_string_literal(std::string_view str) {
+        if (str.size() < 2 || str.front() != '"' || str.back() != '"') {
+            return false;
+        }
+        size_t i = 1;
+        while (i < str.size() - 1) {
+            if (str[i] == '\\') {
+                i += 2;
+            } else if (str[i] == '"') {
+                return false;
+            } else {
+                ++i;
             }
-            tokens.emplace_back(1, ch);
-        } else if ((ch == '<' || ch == '>' || ch == '=' || ch == '!') && i + 1 < str.size() && str[i + 1] == '=') {
-            if (!current_token.empty()) {
-                tokens.push_back(trim(current_token));
-                current_token.clear();
+        }
+        return i == str.size() - 1;
+    }
+
+    bool is_value(std::string_view str) {
+        if (str.size() > 2 && str[0] == '0' && str[1] == 'x') {
+            for (size_t i = 2; i < str.size(); ++i) {
+                if (!has_class(str[i], CH_HEX)) {
+                    return false;
+                }
             }
-            tokens.push_back(std::string(1, ch) + str[i + 1]);
-            ++i;
-        } else if (ch == '|' && i + 1 < str.size() && str[i + 1] == '|') {
-            if (!current_token.empty()) {
-                tokens.push_back(trim(current_token));
-                current_token.clear();
+            return true;
+        }
+        return is_digits(str) || str == "true" || str == "false" || is_string_literal(str);
+    }
+
+    bool is_sized_type(std::string_view str, std::string_view prefix) {
+        if (str.size() < prefix.size() + 3 || str.substr(0, prefix.size()) != prefix) {
+            return false;
+        }
+        if (str[prefix.size()] != '[' || str.back() != ']') {
+            return false;
+        }
+        return is_digits(str.substr(prefix.size() + 1, str.size() - prefix.size() - 2));
+    }
+
+    bool is_type_name(std::string_view str) {
+        return str == "int32" || str == "bool" || is_sized_type(str, "string") || is_sized_type(str, "bytes");
+    }
+
+    bool is_keyword(std::string_view str) {
+        static constexpr std::string_view keywords[] = {
+                "create", "table", "insert", "select", "from", "where", "to", "delete"
+        };
+        for (auto keyword: keywords) {
+            if (memdb::iequals(str, keyword)) {
+                return true;
             }
-            tokens.emplace_back("||");
-            ++i;
+        }
+        return false;
+    }
+
+    // index и on — ключевые слова только в create index <name> on <table>, join — только сразу
+    // после from <table>, а on ещё и после join <table>; в остальных местах это обычные имена
+    // таблиц и колонок
+    bool is_contextual_keyword(std::string_view str, const std::vector<memdb::Token> &tokens) {
+        auto keyword_at = [&tokens](size_t pos, std::string_view keyword) {
+            return pos < tokens.size() && tokens[pos].type == memdb::Token::KEYWORD &&
+                   memdb::iequals(tokens[pos].value, keyword);
+        };
+        size_t count = tokens.size();
+        if (memdb::iequals(str, "index")) {
+            return count == 1 && keyword_at(0, "create");
+        }
+        if (memdb::iequals(str, "join")) {
+            return count >= 2 && tokens.back().type == memdb::Token::TABLE_NAME && keyword_at(count - 2, "from");
+        }
+        if (memdb::iequals(str, "on")) {
+            return (count == 3 && keyword_at(0, "create") && keyword_at(1, "index")) ||
+                   (count >= 2 && tokens.back().type == memdb::Token::TABLE_NAME && keyword_at(count - 2, "join"));
+        }
+        return false;
+    }
+
+    bool opens_table_name(std::string_view keyword) {
+        return memdb::iequals(keyword, "from") || memdb::iequals(keyword, "table") || memdb::iequals(keyword, "to") ||
+               memdb::iequals(keyword, "delete") || memdb::iequals(keyword, "on") || memdb::iequals(keyword, "join");
+    }
 
-        } else if (ch == '|') {
-            if (!current_token.empty()) {
-                tokens.emplace_back(trim(current_token));
-                current_token.clear();
+    bool is_operator(std::string_view str) {
+        return str == "%" || str == "||" || str == "<" || str == ">" || str == "<=" || str == ">=" ||
+               str == "==" || str == "!=" || str == "\\" || str == "&&";
+    }
+
+    bool is_symbol(std::string_view str) {
+        return str.size() == 1 && (str[0] == '(' || str[0] == ')' || str[0] == ',' || str[0] == ':' ||
+                                   str[0] == '=' || str[0] == '{' || str[0] == '}' || str[0] == '*');
+    }
+
+    bool is_attribute(std::string_view str) {
+        return str == "key" || str == "autoincrement" || str == "unique" || str == "columnar" || str == "dict";
+    }
+
+    // Разбивает строку на сырые токены за один проход, вызывая emit для каждого
+    template<typename Emit>
+    void scan(std::string_view str, Emit &&emit) {
+        size_t start = 0;
+        size_t length = 0;
+
+        auto flush = [&]() {
+            if (length != 0) {
+                emit(memdb::trim(str.substr(start, length)));
+                length = 0;
             }
-            tokens.emplace_back("|");
-        } else if (ch == '&' && i + 1 < str.size() && str[i + 1] == '&') {
-            if (!current_token.empty()) {
-                tokens.push_back(trim(current_token));
-                current_token.clear();
+        };
+
+        for (size_t i = 0; i < str.size(); ++i) {
+            char ch = str[i];
+
+            if (ch == '"') {
+                flush();
+                size_t end = str.find('"', i + 1);
+                if (end == std::string_view::npos) {
+                    start = i;
+                    length = str.size() - i;
+                    break;
+                }
+                emit(str.substr(i, end - i + 1)); // Строка целиком, вместе с кавычками
+                i = end;
+            } else if (has_class(ch, CH_SPACE)) {
+                flush();
+            } else if (has_class(ch, CH_SEPARATOR)) {
+                flush();
+                emit(str.substr(i, 1));
+            } else if ((ch == '<' || ch == '>' || ch == '=' || ch == '!') && i + 1 < str.size() && str[i + 1] == '=') {
+                flush();
+                emit(str.substr(i, 2));
+                ++i;
+            } else if (ch == '|' || (ch == '&' && i + 1 < str.size() && str[i + 1] == '&')) {
+                flush();
+                size_t op_length = (i + 1 < str.size() && str[i + 1] == ch) ? 2 : 1;
+                emit(str.substr(i, op_length));
+                i += op_length - 1;
+            } else {
+                if (length == 0) {
+                    start = i;
+                }
+                ++length;
             }
-            tokens.emplace_back("&&");
-            ++i;
-        } else {
-            current_token += ch;
         }
-    }
 
-    if (!current_token.empty()) {
-        tokens.emplace_back(trim(current_token));
+        flush();
     }
+}
+
+std::string_view memdb::trim(std::string_view str) {
+    size_t first = str.find_first_not_of(" \t\n\r");
+    size_t last = str.find_last_not_of(" \t\n\r");
+    return (first == std::string_view::npos) ? std::string_view() : str.substr(first, last - first + 1);
+}
+
+
+std::vector<std::string_view> memdb::splitIntoTokens(std::string_view str) {
+    std::vector<std::string_view> tokens;
+    scan(str, [&tokens](std::string_view raw_token) {
+        tokens.push_back(raw_token);
+    });
     return tokens;
 }
 
-std::string memdb::to_lower(const std::string &str) {
-    std::string res;
-    for (auto ch: str) {
-        res += std::tolower(static_cast<unsigned char>(ch));
+std::string memdb::to_lower(std::string_view str) {
+    std::string res(str);
+    for (auto &ch: res) {
+        ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
     }
     return res;
 }
 
-std::vector<memdb::Token> memdb::tokenize(const std::string &str) {
+bool memdb::iequals(std::string_view lhs, std::string_view rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (std::tolower(static_cast<unsigned char>(lhs[i])) != std::tolower(static_cast<unsigned char>(rhs[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<memdb::Token> memdb::tokenize(std::string_view str) {
     std::vector<Token> tokens;
-    std::vector<std::string> raw_tokens = splitIntoTokens(str);
-
-    const std::regex keyword_regex("^(create|table|insert|select|from|where|to|delete)$", std::regex_constants::icase);
-    const std::regex field_name_regex("^[a-zA-Z_][a-zA-Z0-9_]*$");
-    const std::regex type_name_regex(R"(^int32$|^bool$|^string\[\d+\]$|^bytes\[\d+\]$)");
-    const std::regex table_name_regex("^[a-zA-Z_][a-zA-Z0-9_]*$");
-    const std::regex operator_regex(R"(^(%|\|\||<|>|<=|>=|==|!=|\\|&&)$)");
-    const std::regex value_regex(R"(^(0x[0-9a-fA-F]+|\d+|true|false|"(?:[^"\\]|\\.)*")$)");
-    const std::regex default_value_regex(R"(^(0x[0-9a-fA-F]+|\d+|true|false|"(?:[^"\\]|\\.)*")$)");
-    const std::regex symbol_regex(R"(^(\(|\)|,|:|=|\{|\})$)");
-    const std::regex attribute_regex("^key$|^autoincrement$|^unique$");
+    tokens.reserve(str.size() / 4 + 1);
 
     bool expect_table_name = false;
     bool expect_attribute = false;
     bool expect_type_name = false;
-    bool expect_default_value = false;
-
+    bool joined = false; // После join слово on начинает условие соединения, а не имя таблицы
+    size_t next_slot = 0;
 
-    for (const auto &raw_token: raw_tokens) {
+    scan(str, [&](std::string_view raw_token) {
         Token token;
 
-        if (std::regex_match(raw_token, keyword_regex)) {
+        if (raw_token == "?") {
+            token.type = Token::PLACEHOLDER;
+            token.slot = next_slot++;
+        } else if (is_keyword(raw_token) || is_contextual_keyword(raw_token, tokens)) {
             token.type = Token::KEYWORD;
-            if (to_lower(raw_token) == "from" || to_lower(raw_token) == "table" || to_lower(raw_token) == "to" ||
-                    to_lower(raw_token) == "delete") {
+            joined = joined || memdb::iequals(raw_token, "join");
+            if (opens_table_name(raw_token) && !(joined && memdb::iequals(raw_token, "on"))) {
                 expect_table_name = true;
             }
-        } else if (expect_table_name && std::regex_match(raw_token, table_name_regex)) {
+        } else if (expect_table_name && is_identifier(raw_token)) {
             token.type = Token::TABLE_NAME;
             expect_table_name = false;
-        } else if (expect_attribute && std::regex_match(raw_token, attribute_regex)) {
+        } else if (expect_attribute && is_attribute(raw_token)) {
             token.type = Token::ATTRIBUTE;
-        } else if (expect_type_name && std::regex_match(raw_token, type_name_regex)) {
+        } else if (expect_type_name && is_type_name(raw_token)) {
             token.type = Token::TYPE_NAME;
             expect_type_name = false;
-        } else if (expect_default_value && std::regex_match(raw_token, default_value_regex)) {
-            token.type = Token::DEFAULT_VALUE;
-            expect_default_value = false;
-        } else if (std::regex_match(raw_token, value_regex)) {
+        } else if (is_value(raw_token)) {
             token.type = Token::VALUE;
-        } else if (std::regex_match(raw_token, field_name_regex)) {
+        } else if (is_identifier(raw_token) || is_qualified_name(raw_token)) {
             token.type = Token::FIELD_NAME;
-        } else if (std::regex_match(raw_token, operator_regex)) {
+        } else if (is_operator(raw_token)) {
             token.type = Token::OPERATOR;
-            if (raw_token == "=") {
-                expect_default_value = true;
-            }
-        } else if (std::regex_match(raw_token, symbol_regex)) {
+        } else if (is_symbol(raw_token)) {
             token.type = Token::SYMBOL;
             if (raw_token == "{") {
                 expect_attribute = true;
@@ -183,7 +344,7 @@ std::vector<memdb::Token> memdb::tokenize(const std::string &str) {
 
         token.value = raw_token;
         tokens.push_back(token);
-    }
+    });
 
     return tokens;
 }
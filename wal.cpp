@@ -0,0 +1,269 @@
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "memdb.h"
+#include "exceptions.h"
+
+
+namespace {
+    constexpr char wal_magic[8] = {'M', 'E', 'M', 'D', 'B', 'W', 'A', 'L'};
+    constexpr uint32_t wal_version = 1;
+    constexpr size_t header_size = sizeof(wal_magic) + 4;
+    constexpr size_t record_header_size = 9; // длина, crc32, тип
+    constexpr size_t write_threshold = 1 << 16; // SYNC_OFF копит столько байт перед write
+
+    memdb::StorageError io_error(const std::string &what) {
+        return memdb::StorageError("Storage error: " + what + ": " + std::strerror(errno));
+    }
+
+    uint32_t load_u32(const char* data) {
+        return memdb::BinaryReader(data, 4).u32();
+    }
+}
+
+memdb::WriteAheadLog::WriteAheadLog(const std::string &path, Options options, size_t valid_end) :
+        options(options), last_sync(std::chrono::steady_clock::now()),
+        end(valid_end == 0 ? header_size : valid_end) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        throw io_error("can't open " + path);
+    }
+    if (::ftruncate(fd, static_cast<off_t>(valid_end)) != 0 || ::lseek(fd, 0, SEEK_END) < 0) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        throw io_error("can't prepare " + path);
+    }
+    if (valid_end == 0) {
+        BinaryWriter header;
+        header.raw(wal_magic, sizeof(wal_magic));
+        header.u32(wal_version);
+        buffer = std::move(header.buffer);
+        sync();
+    }
+    if (options.policy == SYNC_GROUP) {
+        flusher = std::thread(&WriteAheadLog::flush_loop, this);
+    }
+}
+
+memdb::WriteAheadLog::~WriteAheadLog() {
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        flusher.join();
+    }
+    try {
+        if (options.policy == SYNC_OFF) {
+            write_buffer();
+        } else {
+            sync();
+        }
+    }
+    catch (StorageError &) {} // Из деструктора не бросаем
+    ::close(fd);
+}
+
+std::string memdb::WriteAheadLog::encode_statement(std::string_view text, const Parameters &params) {
+    BinaryWriter writer;
+    writer.string(text);
+    writer.u32(static_cast<uint32_t>(params.size()));
+    for (const auto &param: params) {
+        writer.value(param);
+    }
+    return std::move(writer.buffer);
+}
+
+std::string memdb::WriteAheadLog::encode_bulk_insert(std::string_view table_name, const std::vector<Table::row> &rows) {
+    BinaryWriter writer;
+    writer.string(table_name);
+    writer.u32(static_cast<uint32_t>(rows.size()));
+    writer.u32(static_cast<uint32_t>(rows.empty() ? 0 : rows[0].values.size()));
+    for (const auto &row: rows) {
+        for (const auto &value: row.values) {
+            writer.value(value);
+        }
+    }
+    return std::move(writer.buffer);
+}
+
+void memdb::WriteAheadLog::append(record_type type, const std::string &payload) {
+    auto kind = static_cast<uint8_t>(type);
+    BinaryWriter header;
+    header.u32(static_cast<uint32_t>(payload.size()));
+    header.u32(crc32(payload.data(), payload.size(), crc32(&kind, 1)));
+    header.u8(kind);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer += header.buffer;
+    buffer += payload;
+    end += header.buffer.size() + payload.size();
+    ++pending;
+    ++record_count;
+
+    switch (options.policy) {
+        case SYNC_ALWAYS:
+            sync_locked();
+            break;
+        case SYNC_GROUP:
+            if (pending >= options.group_records ||
+                std::chrono::steady_clock::now() - last_sync >= options.group_interval) {
+                sync_locked();
+            } else if (pending == 1) {
+                wakeup.notify_one(); // Первая запись пачки: поток сброса отсчитывает group_interval
+            }
+            break;
+        case SYNC_OFF:
+            if (buffer.size() >= write_threshold) {
+                write_buffer();
+            }
+            break;
+    }
+}
+
+void memdb::WriteAheadLog::write_buffer() {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t result = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            buffer.erase(0, written);
+            throw io_error("can't write log");
+        }
+        written += static_cast<size_t>(result);
+    }
+    buffer.clear();
+}
+
+void memdb::WriteAheadLog::sync() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sync_locked();
+}
+
+void memdb::WriteAheadLog::sync_locked() {
+    write_buffer();
+    if (::fsync(fd) != 0) {
+        throw io_error("can't sync log");
+    }
+    pending = 0;
+    last_sync = std::chrono::steady_clock::now();
+    ++sync_count;
+}
+
+void memdb::WriteAheadLog::flush_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (pending == 0) {
+            wakeup.wait(lock, [this] { return stopping || pending != 0; });
+            continue;
+        }
+        // Ждём, пока не истечёт group_interval с прошлого fsync; append за это время мог сбросить пачку сам
+        if (wakeup.wait_until(lock, last_sync + options.group_interval,
+                              [this] { return stopping || pending == 0; })) {
+            continue;
+        }
+        try {
+            sync_locked();
+        }
+        catch (StorageError &) {
+            // Ошибку получит следующий append или sync; до тех пор повторяем не чаще раза в интервал
+            wakeup.wait_for(lock, options.group_interval, [this] { return stopping; });
+        }
+    }
+}
+
+size_t memdb::WriteAheadLog::records() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return record_count;
+}
+
+size_t memdb::WriteAheadLog::syncs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sync_count;
+}
+
+size_t memdb::WriteAheadLog::position() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return end;
+}
+
+size_t memdb::WriteAheadLog::replay(const std::string &path, const std::function<void(const Record &)> &apply,
+                                   size_t from) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return 0;
+    }
+    auto file_size = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    char header[header_size];
+    if (!file.read(header, header_size)) {
+        return 0; // Сбой во время записи заголовка: журнал пуст
+    }
+    if (std::memcmp(header, wal_magic, sizeof(wal_magic)) != 0) {
+        throw StorageError("Storage error: " + path + " is not a memdb log");
+    }
+    if (load_u32(header + sizeof(wal_magic)) != wal_version) {
+        throw StorageError("Storage error: unsupported log version in " + path);
+    }
+
+    size_t valid_end = header_size;
+    std::string payload;
+    while (true) {
+        char record_header[record_header_size];
+        if (!file.read(record_header, record_header_size)) {
+            break;
+        }
+        uint32_t length = load_u32(record_header);
+        uint32_t checksum = load_u32(record_header + 4);
+        auto kind = static_cast<uint8_t>(record_header[8]);
+        // Длина из недописанного заголовка может быть любой: не выделяем память под то, чего нет в файле
+        if (length > file_size - valid_end - record_header_size) {
+            break;
+        }
+
+        payload.resize(length);
+        if (!file.read(payload.data(), length) ||
+            crc32(payload.data(), length, crc32(&kind, 1)) != checksum) {
+            break; // Недописанная или испорченная запись: дальше доверять нечему
+        }
+
+        Record record;
+        BinaryReader reader(payload.data(), payload.size());
+        record.type = static_cast<record_type>(kind);
+        record.text = reader.string();
+        if (record.type == STATEMENT) {
+            uint32_t count = reader.u32();
+            record.params.reserve(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                record.params.push_back(reader.value());
+            }
+        } else if (record.type == BULK_INSERT) {
+            uint32_t count = reader.u32();
+            uint32_t width = reader.u32();
+            record.rows.resize(count);
+            for (auto &row: record.rows) {
+                row.values.reserve(width);
+                for (uint32_t i = 0; i < width; ++i) {
+                    row.values.push_back(reader.value());
+                }
+            }
+        } else {
+            throw StorageError("Storage error: unknown log record type in " + path);
+        }
+
+        if (valid_end >= from) {
+            apply(record);
+        } else if (valid_end + record_header_size + length > from) {
+            throw StorageError("Storage error: " + path + " doesn't match the snapshot: no record ends at its position");
+        }
+        valid_end += record_header_size + length;
+    }
+    return valid_end;
+}